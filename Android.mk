@@ -1,13 +1,42 @@
 LOCAL_PATH:= $(call my-dir)
-include $(CLEAR_VARS)
 
-LOCAL_SRC_FILES:=   \
-    main.c   \
+libmeminfo_src_files := \
+    libmeminfo.c \
     getpss.c   \
     hash.c     \
+    sketch.c   \
+    record.c   \
+    diff.c     \
+    output.c   \
+    serve.c    \
+    batch.c    \
+    files.c    \
+    profile.c  \
+    psi.c      \
     getmem.c   \
     error.c
 
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := $(libmeminfo_src_files)
+LOCAL_MODULE := libmeminfo_tool
+LOCAL_MULTILIB := both
+LOCAL_CFLAGS += -DANDROID
+LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_PATH)
+include $(BUILD_STATIC_LIBRARY)
+
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := $(libmeminfo_src_files)
+LOCAL_MODULE := libmeminfo_tool
+LOCAL_MULTILIB := both
+LOCAL_CFLAGS += -DANDROID
+LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_PATH)
+include $(BUILD_SHARED_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES:=   \
+    main.c
+
 LOCAL_MODULE:= meminfo
 
 LOCAL_MODULE_TAGS := tests
@@ -16,6 +45,7 @@ LOCAL_MULTILIB := both
 LOCAL_MODULE_STEM_32 := meminfo
 LOCAL_MODULE_STEM_64 := meminfo
 LOCAL_CFLAGS += -DANDROID
+LOCAL_STATIC_LIBRARIES := libmeminfo_tool
 LOCAL_SHARED_LIBRARIES := \
     libcutils \
     libutils \
@@ -0,0 +1,828 @@
+#define _XOPEN_SOURCE 700     /* for nftw */
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "batch.h"
+#include "context.h"
+
+/*
+ * many captured trees at once. every worker has a context of its own
+ * and a deque of snapshots; one that runs dry steals from the fullest
+ * deque, so a few huge captures don't leave the other cores idle. each
+ * snapshot's line goes out in one write as it's done, the per worker
+ * fleet tables are merged at the end.
+ */
+
+/* a cmdline across the fleet */
+struct fleet_proc {
+    char cmdline[96];
+    uint32_t snapshots;     /* snapshots it ran in */
+    int last;               /* the last of them, counted once each */
+    uint64_t cur_pss;       /* kB, its instances in that one */
+    uint64_t sum_pss;       /* kB, over every snapshot */
+    uint64_t max_pss;       /* kB, the largest snapshot */
+};
+
+struct fleet {
+    struct fleet_proc *procs;   /* open addressing, empty cmdline is free */
+    unsigned int cap, n;
+    uint64_t heap[_NUM_HEAP];   /* summed pss by heap, kB */
+    int64_t part[_NUM_PART];    /* summed kernel view, kB */
+    int snapshots, kernel, failed;
+};
+
+/* tasks are path indexes, the owner pops at tail, thieves take at head */
+struct deque {
+    pthread_mutex_t lock;
+    int *task;
+    int head, tail;
+};
+
+struct batch;
+
+struct worker {
+    struct batch *b;
+    int id;
+    pthread_t tid;
+    struct meminfo_ctx *ctx;
+    struct deque dq;
+    struct fleet fl;
+    struct out o;
+    int stolen;
+};
+
+struct batch {
+    const struct batch_opts *opts;
+    struct worker *w;
+    int nworkers;
+    int fd, format;
+    pthread_mutex_t out_lock;
+};
+
+static unsigned int str_hash(const char *s)
+{
+    unsigned int hash = 5381;
+    int c;
+
+    while ((c = *s++) != '\0')
+        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+    return hash;
+}
+
+static int fleet_grow(struct fleet *fl)
+{
+    struct fleet_proc *old = fl->procs, *p;
+    unsigned int i, j, cap = fl->cap ? fl->cap * 2 : BATCH_TABLE_SIZE;
+
+    if ((fl->procs = calloc(cap, sizeof(*fl->procs))) == NULL) {
+        fl->procs = old;
+        return -1;
+    }
+    for (i = 0; i < fl->cap; i++) {
+        if (old[i].cmdline[0] == '\0')
+            continue;
+        for (j = str_hash(old[i].cmdline) & (cap - 1); fl->procs[j].cmdline[0];
+                j = (j + 1) & (cap - 1))
+            ;
+        p = &fl->procs[j];
+        *p = old[i];
+    }
+    free(old);
+    fl->cap = cap;
+    return 0;
+}
+
+static struct fleet_proc *fleet_lookup(struct fleet *fl, const char *cmdline)
+{
+    struct fleet_proc *p;
+    unsigned int j;
+
+    if ((fl->n + 1) * 100 > fl->cap * 70 && fleet_grow(fl) < 0)
+        return NULL;
+    for (j = str_hash(cmdline) & (fl->cap - 1); ; j = (j + 1) & (fl->cap - 1)) {
+        p = &fl->procs[j];
+        if (p->cmdline[0] == '\0') {
+            snprintf(p->cmdline, sizeof(p->cmdline), "%s", cmdline);
+            p->last = -1;
+            fl->n++;
+            return p;
+        }
+        if (!strcmp(p->cmdline, cmdline))
+            return p;
+    }
+}
+
+static void fleet_add(struct fleet *fl, int idx, struct meminfo *minfo)
+{
+    struct mem_part part[_NUM_PART];
+    struct fleet_proc *p;
+    struct proc_info *proc;
+    int i;
+
+    fl->snapshots++;
+    for (i = 0; i < _NUM_HEAP; i++)
+        fl->heap[i] += minfo->pss_detail[i].num;
+    if (minfo->item[MEMINFO_TOTAL].num != 0) {
+        mem_breakdown(minfo->item, part);
+        for (i = 0; i < _NUM_PART; i++)
+            fl->part[i] += part[i].kb;
+        fl->kernel++;
+    }
+
+    for (i = 0; i < minfo->num_procs; i++) {
+        proc = minfo->pss[i];
+        if (proc == NULL || proc->totalpss == 0 || proc->cmdline[0] == '\0')
+            continue;
+        if ((p = fleet_lookup(fl, proc->cmdline)) == NULL)
+            continue;
+        // instances of a cmdline in one snapshot add up, zygote children too
+        if (p->last != idx) {
+            p->last = idx;
+            p->snapshots++;
+            p->cur_pss = 0;
+        }
+        p->cur_pss += proc->totalpss;
+        p->sum_pss += proc->totalpss;
+        if (p->cur_pss > p->max_pss)
+            p->max_pss = p->cur_pss;
+    }
+}
+
+/* src into dst, a snapshot is in just one of them so counts add up */
+static void fleet_merge(struct fleet *dst, const struct fleet *src)
+{
+    struct fleet_proc *p;
+    unsigned int i;
+
+    for (i = 0; i < _NUM_HEAP; i++)
+        dst->heap[i] += src->heap[i];
+    for (i = 0; i < _NUM_PART; i++)
+        dst->part[i] += src->part[i];
+    dst->snapshots += src->snapshots;
+    dst->kernel += src->kernel;
+    dst->failed += src->failed;
+
+    for (i = 0; i < src->cap; i++) {
+        if (src->procs[i].cmdline[0] == '\0')
+            continue;
+        if ((p = fleet_lookup(dst, src->procs[i].cmdline)) == NULL)
+            continue;
+        p->snapshots += src->procs[i].snapshots;
+        p->sum_pss += src->procs[i].sum_pss;
+        if (src->procs[i].max_pss > p->max_pss)
+            p->max_pss = src->procs[i].max_pss;
+    }
+}
+
+/*
+ * minimal ustar reader: regular files and directories, the prefix
+ * field and GNU long names. links, devices and pax headers are
+ * skipped, names are kept inside dir.
+ */
+struct tar_header {
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char chksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char pad[12];
+};
+
+static uint64_t tar_octal(const char *s, size_t n)
+{
+    uint64_t v = 0;
+
+    while (n > 0 && (*s == ' ' || *s == '\0')) {
+        s++;
+        n--;
+    }
+    for (; n > 0 && *s >= '0' && *s <= '7'; s++, n--)
+        v = v * 8 + (*s - '0');
+    return v;
+}
+
+static int tar_checksum_ok(const struct tar_header *h)
+{
+    const unsigned char *p = (const unsigned char *)h;
+    uint64_t sum = 0;
+    size_t i;
+
+    for (i = 0; i < sizeof(*h); i++)
+        sum += (i >= offsetof(struct tar_header, chksum)
+                && i < offsetof(struct tar_header, chksum) + sizeof(h->chksum)) ? ' ' : p[i];
+    return sum == tar_octal(h->chksum, sizeof(h->chksum));
+}
+
+/* name without leading / or ./, NULL when it climbs out with .. */
+static const char *tar_safe_name(const char *name)
+{
+    const char *p;
+
+    while (*name == '/' || (name[0] == '.' && name[1] == '/'))
+        name += (*name == '/') ? 1 : 2;
+    for (p = name; *p != '\0'; p = strchr(p, '/') ? strchr(p, '/') + 1 : p + strlen(p))
+        if (p[0] == '.' && p[1] == '.' && (p[2] == '/' || p[2] == '\0'))
+            return NULL;
+    return name;
+}
+
+/* the directories leading to path, path itself too when dir is set */
+static int make_dirs(char *path, int dir)
+{
+    char *p;
+
+    for (p = path + 1; *p != '\0'; p++) {
+        if (*p != '/')
+            continue;
+        *p = '\0';
+        if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+            *p = '/';
+            return -1;
+        }
+        *p = '/';
+    }
+    if (dir && mkdir(path, 0755) < 0 && errno != EEXIST)
+        return -1;
+    return 0;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+    char *p = buf;
+    ssize_t n;
+
+    while (len > 0) {
+        n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* copy size bytes of member data to out, -1 for out to skip it */
+static int tar_data(int fd, int out, uint64_t size, char *buf, size_t buflen)
+{
+    uint64_t left = (size + 511) & ~(uint64_t)511;
+    size_t n;
+
+    while (left > 0) {
+        n = left < buflen ? left : buflen;
+        if (read_full(fd, buf, n) < 0)
+            return -1;
+        if (out >= 0 && size > 0 && write(out, buf, n < size ? n : size) < 0)
+            return -1;
+        size = size > n ? size - n : 0;
+        left -= n;
+    }
+    return 0;
+}
+
+static int tar_extract(struct meminfo_ctx *ctx, const char *tar, const char *dir)
+{
+    struct tar_header h;
+    char name[PATH_MAX], path[PATH_MAX], buf[64 * 1024];
+    const char *safe;
+    uint64_t size;
+    int fd, out, longname = 0, ret = 0;
+
+    if ((fd = open(tar, O_RDONLY)) < 0)
+        return ctx_error(ctx, MEMINFO_EIO, "%s", strerror(errno));
+
+    for (;;) {
+        if (read_full(fd, &h, sizeof(h)) < 0) {
+            ret = ctx_error(ctx, MEMINFO_EFORMAT, "truncated archive");
+            break;
+        }
+        // two zero blocks end the archive, one will do
+        if (h.name[0] == '\0')
+            break;
+        if (memcmp(h.magic, "ustar", 5) || !tar_checksum_ok(&h)) {
+            ret = ctx_error(ctx, MEMINFO_EFORMAT, "not a ustar archive");
+            break;
+        }
+        size = tar_octal(h.size, sizeof(h.size));
+
+        if (h.typeflag == 'L') {
+            // GNU: the data is the name of the next member
+            if (size >= sizeof(name) || read_full(fd, name, (size + 511) & ~511) < 0) {
+                ret = ctx_error(ctx, MEMINFO_EFORMAT, "bad long name in archive");
+                break;
+            }
+            name[size] = '\0';
+            longname = 1;
+            continue;
+        }
+        if (!longname) {
+            if (h.prefix[0] != '\0')
+                snprintf(name, sizeof(name), "%.155s/%.100s", h.prefix, h.name);
+            else
+                snprintf(name, sizeof(name), "%.100s", h.name);
+        }
+        longname = 0;
+
+        out = -1;
+        if ((safe = tar_safe_name(name)) != NULL && *safe != '\0'
+                && (h.typeflag == '0' || h.typeflag == '\0' || h.typeflag == '5')) {
+            // a cut path would land on another file
+            if (snprintf(path, sizeof(path), "%s/%s", dir, safe) >= (int)sizeof(path)) {
+                ret = ctx_error(ctx, MEMINFO_EFORMAT, "member name too long");
+                break;
+            }
+            if (make_dirs(path, h.typeflag == '5') < 0) {
+                ret = ctx_error(ctx, MEMINFO_EIO, "mkdir %s: %s", path, strerror(errno));
+                break;
+            }
+            if (h.typeflag != '5'
+                    && (out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+                ret = ctx_error(ctx, MEMINFO_EIO, "create %s: %s", path, strerror(errno));
+                break;
+            }
+        }
+        if (tar_data(fd, out, size, buf, sizeof(buf)) < 0) {
+            ret = ctx_error(ctx, MEMINFO_EIO, "extract error");
+            if (out >= 0)
+                close(out);
+            break;
+        }
+        if (out >= 0)
+            close(out);
+    }
+    close(fd);
+    return ret;
+}
+
+static int rm_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+    (void)st;
+    (void)flag;
+    (void)ftw;
+    remove(path);
+    return 0;
+}
+
+/* the tree in an extracted archive, at its top or in its one directory */
+static void tar_root(const char *dir, char *root, size_t len)
+{
+    char path[PATH_MAX], only[NAME_MAX + 1] = "";
+    struct dirent *de;
+    struct stat st;
+    DIR *d;
+    int n = 0;
+
+    snprintf(root, len, "%s", dir);
+    snprintf(path, sizeof(path), "%s" PROCDIR, dir);
+    if (stat(path, &st) == 0 || (d = opendir(dir)) == NULL)
+        return;
+    while ((de = readdir(d)) != NULL) {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+            continue;
+        snprintf(only, sizeof(only), "%s", de->d_name);
+        n++;
+    }
+    closedir(d);
+    if (n == 1)
+        snprintf(root, len, "%s/%s", dir, only);
+}
+
+static void batch_fail(struct worker *w, const char *path, const char *msg)
+{
+    struct out *o = &w->o;
+
+    w->fl.failed++;
+    if (w->b->format == FORMAT_JSON) {
+        out_str(o, "{\"type\":\"batch_error\",\"path\":");
+        out_json_str(o, path);
+        out_str(o, ",\"error\":");
+        out_json_str(o, msg);
+        out_str(o, "}\n");
+    } else {
+        out_str(o, path);
+        out_str(o, ": error: ");
+        out_str(o, msg);
+        out_char(o, '\n');
+    }
+}
+
+/* the largest processes of minfo, best first */
+static int top_procs(struct meminfo *minfo, struct proc_info **top, int max)
+{
+    struct proc_info *proc;
+    int i, k, n = 0;
+
+    for (i = 0; i < minfo->num_procs; i++) {
+        proc = minfo->pss[i];
+        if (proc == NULL || proc->totalpss == 0)
+            continue;
+        if (n == max && proc->totalpss <= top[n - 1]->totalpss)
+            continue;
+        if (n < max)
+            n++;
+        for (k = n - 1; k > 0 && top[k - 1]->totalpss < proc->totalpss; k--)
+            top[k] = top[k - 1];
+        top[k] = proc;
+    }
+    return n;
+}
+
+static void batch_summary(struct worker *w, const char *path, struct meminfo *minfo)
+{
+    struct out *o = &w->o;
+    struct proc_info *top[BATCH_TOP];
+    struct mem_part part[_NUM_PART];
+    uint64_t pss = 0;
+    int i, n, procs = 0;
+
+    for (i = 0; i < minfo->num_procs; i++) {
+        if (minfo->pss[i] == NULL || minfo->pss[i]->totalpss == 0)
+            continue;
+        pss += minfo->pss[i]->totalpss;
+        procs++;
+    }
+    n = top_procs(minfo, top, BATCH_TOP);
+    mem_breakdown(minfo->item, part);
+
+    if (w->b->format == FORMAT_JSON) {
+        out_str(o, "{\"type\":\"batch_snapshot\",\"path\":");
+        out_json_str(o, path);
+        out_str(o, ",\"processes\":");
+        out_u64(o, procs, 0);
+        out_str(o, ",\"total_pss\":");
+        out_u64(o, pss, 0);
+        out_str(o, ",\"kernel\":{");
+        for (i = 0; i < _NUM_PART; i++) {
+            out_str(o, i ? ",\"" : "\"");
+            out_str(o, part[i].name);
+            out_str(o, "\":");
+            out_i64(o, part[i].kb, 0);
+        }
+        out_str(o, "},\"top\":[");
+        for (i = 0; i < n; i++) {
+            out_str(o, i ? ",{\"cmdline\":" : "{\"cmdline\":");
+            out_json_str(o, top[i]->cmdline);
+            out_str(o, ",\"pid\":");
+            out_i64(o, top[i]->pid, 0);
+            out_str(o, ",\"total_pss\":");
+            out_u64(o, top[i]->totalpss, 0);
+            out_char(o, '}');
+        }
+        out_str(o, "]}\n");
+        return;
+    }
+
+    out_str(o, path);
+    out_str(o, ": ");
+    out_u64(o, procs, 0);
+    out_str(o, " processes, pss ");
+    out_u64(o, pss, 0);
+    out_str(o, " KB, free ");
+    out_i64(o, part[PART_FREE].kb, 0);
+    out_str(o, " KB, kernel ");
+    out_i64(o, part[PART_KERNEL].kb, 0);
+    out_str(o, " KB; top:");
+    for (i = 0; i < n; i++) {
+        out_str(o, i ? ", " : " ");
+        out_str(o, top[i]->cmdline);
+        out_str(o, " (");
+        out_u64(o, top[i]->totalpss, 0);
+        out_str(o, " KB)");
+    }
+    out_char(o, '\n');
+}
+
+/* one snapshot: a directory as is, an archive through a private copy */
+static void batch_one(struct worker *w, int idx)
+{
+    const char *path = w->b->opts->paths[idx];
+    char tmp[PATH_MAX] = "", root[PATH_MAX];
+    const char *tmpdir = getenv("TMPDIR");
+    struct meminfo *minfo = NULL;
+    struct stat st;
+
+    if (stat(path, &st) < 0) {
+        batch_fail(w, path, strerror(errno));
+        return;
+    }
+    snprintf(root, sizeof(root), "%s", path);
+    if (S_ISREG(st.st_mode)) {
+        snprintf(tmp, sizeof(tmp), "%s/meminfo.XXXXXX", tmpdir ? tmpdir : "/tmp");
+        if (mkdtemp(tmp) == NULL) {
+            batch_fail(w, path, strerror(errno));
+            return;
+        }
+        if (tar_extract(w->ctx, path, tmp) < 0)
+            goto fail;
+        tar_root(tmp, root, sizeof(root));
+    }
+
+    if (meminfo_set_root(w->ctx, root) < 0 || (minfo = meminfo_snapshot(w->ctx)) == NULL)
+        goto fail;
+    batch_summary(w, path, minfo);
+    fleet_add(&w->fl, idx, minfo);
+    meminfo_free(minfo);
+    goto done;
+
+fail:
+    batch_fail(w, path, meminfo_last_error(w->ctx));
+done:
+    if (tmp[0] != '\0')
+        nftw(tmp, rm_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static int deque_pop(struct deque *dq)
+{
+    int idx = -1;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->head < dq->tail)
+        idx = dq->task[--dq->tail];
+    pthread_mutex_unlock(&dq->lock);
+    return idx;
+}
+
+static int deque_steal(struct deque *dq)
+{
+    int idx = -1;
+
+    pthread_mutex_lock(&dq->lock);
+    if (dq->head < dq->tail)
+        idx = dq->task[dq->head++];
+    pthread_mutex_unlock(&dq->lock);
+    return idx;
+}
+
+/* a task from the worker with the most left, -1 once all are dry */
+static int batch_steal(struct worker *w)
+{
+    struct batch *b = w->b;
+    int i, k, left, most, victim, idx;
+
+    for (;;) {
+        most = 0;
+        victim = -1;
+        for (k = 1; k < b->nworkers; k++) {
+            i = (w->id + k) % b->nworkers;
+            pthread_mutex_lock(&b->w[i].dq.lock);
+            left = b->w[i].dq.tail - b->w[i].dq.head;
+            pthread_mutex_unlock(&b->w[i].dq.lock);
+            if (left > most) {
+                most = left;
+                victim = i;
+            }
+        }
+        if (victim < 0)
+            return -1;
+        if ((idx = deque_steal(&b->w[victim].dq)) >= 0) {
+            w->stolen++;
+            return idx;
+        }
+    }
+}
+
+static void *batch_worker(void *arg)
+{
+    struct worker *w = arg;
+    struct batch *b = w->b;
+    int idx;
+
+    for (;;) {
+        if ((idx = deque_pop(&w->dq)) < 0 && (idx = batch_steal(w)) < 0)
+            break;
+        batch_one(w, idx);
+        // a snapshot's output is one write, whole lines never interleave
+        pthread_mutex_lock(&b->out_lock);
+        out_flush(&w->o);
+        pthread_mutex_unlock(&b->out_lock);
+    }
+    return NULL;
+}
+
+static int cmpfleet(const void *a, const void *b)
+{
+    const struct fleet_proc *x = a, *y = b;
+
+    if (x->sum_pss != y->sum_pss)
+        return x->sum_pss < y->sum_pss ? 1 : -1;
+    return strcmp(x->cmdline, y->cmdline);
+}
+
+static void fleet_print(struct batch *b, struct fleet *fl, struct out *o, double secs)
+{
+    int stolen = 0;
+    struct fleet_proc *p = fl->procs;
+    struct mem_part names[_NUM_PART];
+    struct mem_item heap[_NUM_HEAP];
+    struct mem_item dummy[MEMINFO_COUNT];
+    unsigned int i, n = 0;
+    int k, j, json = b->format == FORMAT_JSON;
+    int snaps = fl->snapshots ? fl->snapshots : 1;
+
+    for (k = 0; k < b->nworkers; k++)
+        stolen += b->w[k].stolen;
+    // the table packed and sorted in place, it isn't probed any more
+    for (i = 0; i < fl->cap; i++)
+        if (p[i].cmdline[0] != '\0')
+            p[n++] = p[i];
+    qsort(p, n, sizeof(*p), cmpfleet);
+    if (n > BATCH_FLEET_TOP)
+        n = BATCH_FLEET_TOP;
+
+    for (k = 0; k < _NUM_HEAP; k++) {
+        snprintf(heap[k].name, sizeof(heap[k].name), "%s", heap_name(k));
+        heap[k].num = fl->heap[k];
+    }
+    for (k = 1; k < _NUM_HEAP; k++) {
+        struct mem_item t = heap[k];
+        for (j = k; j > 0 && heap[j - 1].num < t.num; j--)
+            heap[j] = heap[j - 1];
+        heap[j] = t;
+    }
+    memset(dummy, 0, sizeof(dummy));
+    mem_breakdown(dummy, names);
+
+    if (json) {
+        out_str(o, "{\"type\":\"batch_summary\",\"snapshots\":");
+        out_u64(o, fl->snapshots, 0);
+        out_str(o, ",\"failed\":");
+        out_u64(o, fl->failed, 0);
+        out_str(o, ",\"processes\":[");
+        for (i = 0; i < n; i++) {
+            out_str(o, i ? ",{\"cmdline\":" : "{\"cmdline\":");
+            out_json_str(o, p[i].cmdline);
+            out_str(o, ",\"snapshots\":");
+            out_u64(o, p[i].snapshots, 0);
+            out_str(o, ",\"avg_pss\":");
+            out_u64(o, p[i].sum_pss / p[i].snapshots, 0);
+            out_str(o, ",\"max_pss\":");
+            out_u64(o, p[i].max_pss, 0);
+            out_char(o, '}');
+        }
+        out_str(o, "],\"heaps\":{");
+        for (k = 0; k < _NUM_HEAP; k++) {
+            if (k)
+                out_char(o, ',');
+            out_json_str(o, heap[k].name);
+            out_char(o, ':');
+            out_u64(o, heap[k].num / snaps, 0);
+        }
+        out_str(o, "},\"kernel\":{");
+        for (k = 0; k < _NUM_PART; k++) {
+            out_str(o, k ? ",\"" : "\"");
+            out_str(o, names[k].name);
+            out_str(o, "\":");
+            out_i64(o, fl->kernel ? fl->part[k] / fl->kernel : 0, 0);
+        }
+        out_str(o, "}}\n");
+        return;
+    }
+
+    out_str(o, "\nfleet: ");
+    out_u64(o, fl->snapshots, 0);
+    out_str(o, " snapshots, ");
+    out_u64(o, fl->failed, 0);
+    out_str(o, " failed, ");
+    out_u64(o, b->nworkers, 0);
+    out_str(o, " workers, ");
+    out_u64(o, stolen, 0);
+    out_str(o, " tasks stolen");
+    if (secs > 0) {
+        char rate[64];
+        snprintf(rate, sizeof(rate), ", %.3f s, %.1f snapshots/s",
+                secs, (fl->snapshots + fl->failed) / secs);
+        out_str(o, rate);
+    }
+    out_str(o, "\n\ntop processes by pss summed over the fleet, per snapshot they ran in:\n");
+    out_str(o, "   avg KB    max KB  snapshots  process\n");
+    for (i = 0; i < n; i++) {
+        out_u64(o, p[i].sum_pss / p[i].snapshots, 9);
+        out_u64(o, p[i].max_pss, 10);
+        out_u64(o, p[i].snapshots, 11);
+        out_str(o, "  ");
+        out_str(o, p[i].cmdline);
+        out_char(o, '\n');
+    }
+    out_str(o, "\npss by heap, average per snapshot:\n");
+    for (k = 0; k < _NUM_HEAP && heap[k].num > 0; k++) {
+        out_u64(o, heap[k].num / snaps, 9);
+        out_str(o, " KB: ");
+        out_str(o, heap[k].name);
+        out_char(o, '\n');
+    }
+    if (fl->kernel > 0) {
+        out_str(o, "\nkernel view, average per snapshot:\n");
+        for (k = 0; k < _NUM_PART; k++) {
+            out_i64(o, fl->part[k] / fl->kernel, 9);
+            out_str(o, " KB: ");
+            out_str(o, names[k].name);
+            out_char(o, '\n');
+        }
+    }
+}
+
+/*
+ * every path through the full snapshot path, jobs at a time. the lines
+ * go to o's fd as snapshots finish, the fleet summary last. returns the
+ * number of snapshots that failed, or a negative meminfo_error.
+ */
+int batch_run(struct meminfo_ctx *ctx, const struct batch_opts *opts, struct out *o)
+{
+    struct batch b;
+    struct worker *w;
+    struct timespec start, end;
+    int i, k, per, ret = 0;
+
+    memset(&b, 0, sizeof(b));
+    b.opts = opts;
+    b.fd = o->fd;
+    b.format = o->format;
+    b.nworkers = opts->jobs > 0 ? opts->jobs : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (b.nworkers < 1)
+        b.nworkers = 1;
+    if (b.nworkers > opts->npaths)
+        b.nworkers = opts->npaths > 0 ? opts->npaths : 1;
+    if ((b.w = calloc(b.nworkers, sizeof(*b.w))) == NULL)
+        return ctx_error(ctx, MEMINFO_ENOMEM, "calloc batch error");
+    pthread_mutex_init(&b.out_lock, NULL);
+
+    // dealt round robin, big and small snapshots mix in every deque
+    per = (opts->npaths + b.nworkers - 1) / b.nworkers;
+    for (i = 0; i < b.nworkers; i++) {
+        w = &b.w[i];
+        w->b = &b;
+        w->id = i;
+        pthread_mutex_init(&w->dq.lock, NULL);
+        out_init(&w->o, b.fd, b.format);
+        if ((w->dq.task = malloc((per + 1) * sizeof(int))) == NULL
+                || (w->ctx = meminfo_ctx_new()) == NULL) {
+            ret = ctx_error(ctx, MEMINFO_ENOMEM, "calloc batch error");
+            goto out;
+        }
+        meminfo_set_quiet(w->ctx, 1);
+        if (opts->collectors != NULL && collector_mask(w->ctx, opts->collectors) < 0) {
+            ret = ctx_error(ctx, MEMINFO_EINVAL, "%s", meminfo_last_error(w->ctx));
+            goto out;
+        }
+    }
+    // pushed in reverse, the owner pops them in the order given
+    for (k = opts->npaths - 1; k >= 0; k--) {
+        w = &b.w[k % b.nworkers];
+        w->dq.task[w->dq.tail++] = k;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < b.nworkers; i++)
+        if (pthread_create(&b.w[i].tid, NULL, batch_worker, &b.w[i]) != 0)
+            batch_worker(&b.w[i]);
+    for (i = 0; i < b.nworkers; i++)
+        if (b.w[i].tid)
+            pthread_join(b.w[i].tid, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (i = 1; i < b.nworkers; i++)
+        fleet_merge(&b.w[0].fl, &b.w[i].fl);
+    fleet_print(&b, &b.w[0].fl, o, (end.tv_sec - start.tv_sec)
+            + (end.tv_nsec - start.tv_nsec) / 1e9);
+    ret = b.w[0].fl.failed;
+
+out:
+    for (i = 0; i < b.nworkers; i++) {
+        w = &b.w[i];
+        out_free(&w->o);
+        free(w->dq.task);
+        free(w->fl.procs);
+        meminfo_ctx_free(w->ctx);
+        pthread_mutex_destroy(&w->dq.lock);
+    }
+    pthread_mutex_destroy(&b.out_lock);
+    free(b.w);
+    return ret;
+}
@@ -0,0 +1,24 @@
+#ifndef MEMINFO_BATCH_H
+#define MEMINFO_BATCH_H
+
+/* processes named in each snapshot's line */
+#define BATCH_TOP 5
+/* processes and heaps in the fleet summary */
+#define BATCH_FLEET_TOP 20
+/* initial slots of a worker's process table, a power of two */
+#define BATCH_TABLE_SIZE 1024
+
+/* what batch_run works through */
+struct batch_opts {
+    char **paths;           /* captured trees, directories or ustar files */
+    int npaths;
+    int jobs;               /* worker threads, 0 for one per core */
+    const char *collectors; /* -c list for every snapshot, NULL for all */
+};
+
+struct meminfo_ctx;
+struct out;
+
+int batch_run(struct meminfo_ctx *ctx, const struct batch_opts *opts, struct out *o);
+
+#endif
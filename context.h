@@ -0,0 +1,29 @@
+#ifndef MEMINFO_CONTEXT_H
+#define MEMINFO_CONTEXT_H
+
+#include "libmeminfo.h"
+
+/* room in a context for the collector table, getmem.c has the entries */
+#define MAX_COLLECTORS 16
+
+/* library internal, callers only see struct meminfo_ctx as a handle */
+struct meminfo_ctx {
+    struct collector collectors[MAX_COLLECTORS];
+    struct tracker tr;
+    struct recorder *rec;   /* -f recording, NULL when not recording */
+    struct replay *replay;  /* recording being read back */
+    struct server *srv;     /* metrics endpoint, NULL when not serving */
+    struct file_table *files;   /* per file pss, NULL when off */
+    struct prof *prof;      /* stage costs for --stats, NULL when off */
+    struct psi *psi;        /* pressure trigger, NULL when sampling on a timer */
+    char *root;             /* data root, MEMINFO_ROOT by default */
+    int quiet;              /* no warnings on stderr, errors still returned */
+    int err;
+    char errmsg[256];
+};
+
+int ctx_error(struct meminfo_ctx *ctx, int err, const char *fmt, ...);
+void collector_init(struct meminfo_ctx *ctx);
+void collector_set_root(struct meminfo_ctx *ctx);
+
+#endif
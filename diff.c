@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <stdint.h>
+
+#include "diff.h"
+#include "context.h"
+
+static unsigned int proc_hash(const struct proc_info *p)
+{
+    const char *s = p->cmdline;
+    unsigned int hash = 5381;
+    int c;
+
+    while ((c = *s++) != '\0')
+        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+
+    return hash ^ (unsigned int)p->pid * 2654435761u;
+}
+
+static int64_t abs64(int64_t v)
+{
+    return v < 0 ? -v : v;
+}
+
+static int row_pid(const struct proc_diff *r)
+{
+    return r->b ? r->b->pid : r->a->pid;
+}
+
+static int cmpdiff(const void *x, const void *y)
+{
+    const struct proc_diff *a = x, *b = y;
+    int64_t da = abs64(a->pss), db = abs64(b->pss);
+
+    if (da != db)
+        return da < db ? 1 : -1;
+    return row_pid(a) - row_pid(b);
+}
+
+/* kernel threads and processes gone before their maps were read don't count */
+static int diffable(struct proc_info *p)
+{
+    return p != NULL && p->totalpss != 0;
+}
+
+/*
+ * hash join: a goes into an open addressing table keyed by
+ * (cmdline, pid), b probes it. a processes nothing matched have exited.
+ */
+int snapshot_diff(struct meminfo_ctx *ctx, struct meminfo *a, struct meminfo *b,
+        struct snapshot_diff *d)
+{
+    struct proc_info *p, *q;
+    struct proc_diff *r;
+    struct mem_part part[_NUM_PART];
+    unsigned int cap = 16, j;
+    uint32_t *slots;
+    unsigned char *matched;
+    int i, k, match;
+
+    memset(d, 0, sizeof(*d));
+    while (cap < 2 * (unsigned int)a->num_procs)
+        cap <<= 1;
+    slots = calloc(cap, sizeof(*slots));
+    matched = calloc(a->num_procs + 1, 1);
+    d->procs = malloc((a->num_procs + b->num_procs + 1) * sizeof(*d->procs));
+    if (slots == NULL || matched == NULL || d->procs == NULL) {
+        free(slots);
+        free(matched);
+        snapshot_diff_free(d);
+        return ctx_error(ctx, MEMINFO_ENOMEM, "malloc diff error");
+    }
+
+    for (i = 0; i < a->num_procs; i++) {
+        if (!diffable(a->pss[i]))
+            continue;
+        for (j = proc_hash(a->pss[i]) & (cap - 1); slots[j] != 0; j = (j + 1) & (cap - 1))
+            ;
+        slots[j] = i + 1;
+    }
+
+    for (i = 0; i < b->num_procs; i++) {
+        if (!diffable(p = b->pss[i]))
+            continue;
+        match = -1;
+        for (j = proc_hash(p) & (cap - 1); slots[j] != 0; j = (j + 1) & (cap - 1)) {
+            k = slots[j] - 1;
+            q = a->pss[k];
+            if (q->pid == p->pid && !matched[k] && !strcmp(q->cmdline, p->cmdline)) {
+                match = k;
+                break;
+            }
+        }
+
+        r = &d->procs[d->nprocs];
+        r->b = p;
+        if (match < 0) {
+            r->a = NULL;
+            r->pss = p->totalpss;
+            d->nnew++;
+        } else {
+            matched[match] = 1;
+            q = a->pss[match];
+            if (q->totalpss == p->totalpss && !memcmp(q->stats, p->stats, sizeof(p->stats)))
+                continue;
+            r->a = q;
+            r->pss = (int64_t)(p->totalpss - q->totalpss);
+        }
+        d->pss += r->pss;
+        d->nprocs++;
+    }
+
+    for (i = 0; i < a->num_procs; i++) {
+        if (a->pss[i] == NULL || a->pss[i]->totalpss == 0 || matched[i])
+            continue;
+        r = &d->procs[d->nprocs++];
+        r->a = a->pss[i];
+        r->b = NULL;
+        r->pss = -(int64_t)r->a->totalpss;
+        d->pss += r->pss;
+        d->nexited++;
+    }
+    free(slots);
+    free(matched);
+    qsort(d->procs, d->nprocs, sizeof(d->procs[0]), cmpdiff);
+
+    // a single process snapshot comes without the kernel's view
+    mem_breakdown(a->item, d->kern);
+    mem_breakdown(b->item, part);
+    for (i = 0; i < _NUM_PART; i++)
+        d->kern[i].kb = a->item[MEMINFO_TOTAL].num != 0 && b->item[MEMINFO_TOTAL].num != 0
+            ? part[i].kb - d->kern[i].kb : 0;
+
+    // a dozen categories, an insertion sort will do
+    for (i = 0; i < _NUM_PART; i++) {
+        for (k = i; k > 0 && abs64(d->kern[d->kern_order[k - 1]].kb) < abs64(d->kern[i].kb); k--)
+            d->kern_order[k] = d->kern_order[k - 1];
+        d->kern_order[k] = i;
+    }
+    return 0;
+}
+
+void snapshot_diff_free(struct snapshot_diff *d)
+{
+    free(d->procs);
+    d->procs = NULL;
+    d->nprocs = 0;
+}
+
+static void print_heaps(const struct proc_diff *r)
+{
+    static const struct stats_t zero;
+    const struct stats_t *a, *b;
+    int64_t pss[_NUM_HEAP];
+    int order[_NUM_HEAP];
+    int i, k;
+
+    for (i = 0; i < _NUM_HEAP; i++) {
+        a = r->a ? &r->a->stats[i] : &zero;
+        b = r->b ? &r->b->stats[i] : &zero;
+        pss[i] = (int64_t)(b->pss - a->pss);
+        for (k = i; k > 0 && abs64(pss[order[k - 1]]) < abs64(pss[i]); k--)
+            order[k] = order[k - 1];
+        order[k] = i;
+    }
+
+    for (k = 0; k < _NUM_HEAP; k++) {
+        i = order[k];
+        a = r->a ? &r->a->stats[i] : &zero;
+        b = r->b ? &r->b->stats[i] : &zero;
+        if (pss[i] == 0 && a->privateDirty == b->privateDirty
+                && a->privateClean == b->privateClean
+                && a->sharedDirty == b->sharedDirty && a->sharedClean == b->sharedClean)
+            continue;
+        printf("%19s  pss %+7" PRId64 "  private dirty %+7" PRId64 " clean %+7" PRId64
+                "  shared dirty %+7" PRId64 " clean %+7" PRId64 "\n",
+                heap_name(i), pss[i], (int64_t)(b->privateDirty - a->privateDirty),
+                (int64_t)(b->privateClean - a->privateClean),
+                (int64_t)(b->sharedDirty - a->sharedDirty),
+                (int64_t)(b->sharedClean - a->sharedClean));
+    }
+}
+
+void print_diff(const struct meminfo *a, const struct meminfo *b,
+        const struct snapshot_diff *d)
+{
+    const struct tm *ta = &a->timestap, *tb = &b->timestap;
+    const struct proc_diff *r;
+    const struct proc_info *p;
+    const struct mem_part *m;
+    int i;
+
+    printf("PSS delta by process");
+    printf("(%02d-%02d-%02d %02d:%02d:%02d -> %02d-%02d-%02d %02d:%02d:%02d):\n",
+            ta->tm_year + 1900, ta->tm_mon + 1, ta->tm_mday,
+            ta->tm_hour, ta->tm_min, ta->tm_sec,
+            tb->tm_year + 1900, tb->tm_mon + 1, tb->tm_mday,
+            tb->tm_hour, tb->tm_min, tb->tm_sec);
+
+    for (i = 0; i < d->nprocs; i++) {
+        r = &d->procs[i];
+        p = r->b ? r->b : r->a;
+        printf("%+8" PRId64 " KB: %s (%d)%s\n", r->pss, p->cmdline, p->pid,
+                r->a == NULL ? " new" : r->b == NULL ? " exited" : "");
+        print_heaps(r);
+    }
+    printf("%10s: %+8" PRId64 " KB, %d new, %d exited\n", "total pss",
+            d->pss, d->nnew, d->nexited);
+
+    printf("\nKernel delta:\n");
+    for (i = 0; i < _NUM_PART; i++) {
+        m = &d->kern[d->kern_order[i]];
+        if (m->kb == 0)
+            break;
+        printf("%+8" PRId64 " KB: %s\n", m->kb, m->name);
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef MEMINFO_DIFF_H
+#define MEMINFO_DIFF_H
+
+#include "getmem.h"
+
+/* a process in both snapshots, or in just one of them */
+struct proc_diff {
+    const struct proc_info *a;      /* NULL when new in b */
+    const struct proc_info *b;      /* NULL when exited */
+    int64_t pss;                    /* total pss delta, kB */
+};
+
+/*
+ * what changed from snapshot a to b. processes are matched on
+ * (cmdline, pid), rows and the print_meminfo categories are sorted by
+ * the size of their delta. the rows point into the snapshots.
+ */
+struct snapshot_diff {
+    struct proc_diff *procs;
+    int nprocs;
+    int nnew, nexited;
+    int64_t pss;
+    struct mem_part kern[_NUM_PART];    /* kb is the delta */
+    int kern_order[_NUM_PART];
+};
+
+struct meminfo_ctx;
+
+int snapshot_diff(struct meminfo_ctx *ctx, struct meminfo *a, struct meminfo *b,
+        struct snapshot_diff *d);
+void snapshot_diff_free(struct snapshot_diff *d);
+void print_diff(const struct meminfo *a, const struct meminfo *b,
+        const struct snapshot_diff *d);
+
+#endif
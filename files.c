@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "files.h"
+#include "context.h"
+
+struct file_entry {
+    struct file_usage use;
+    uint32_t hash;
+    uint32_t len;
+    int tick;               /* the tick use was summed in */
+    int last_pid;           /* the process counted last in use.procs */
+};
+
+struct file_chunk {
+    struct file_chunk *next;
+    size_t used;
+    char data[FILES_CHUNK_SIZE];
+};
+
+static uint32_t name_hash(const char *s, size_t len)
+{
+    uint32_t hash = 2166136261u;
+
+    while (len-- > 0)
+        hash = (hash ^ (unsigned char)*s++) * 16777619u; /* fnv-1a */
+    return hash;
+}
+
+/* a copy of name that stays put, a path longer than a chunk gets its own */
+static const char *files_intern(struct file_table *ft, const char *name, size_t len)
+{
+    struct file_chunk *c = ft->pool;
+    size_t size = offsetof(struct file_chunk, data) + FILES_CHUNK_SIZE;
+    char *p;
+
+    if (c == NULL || c->used + len + 1 > FILES_CHUNK_SIZE) {
+        if (len + 1 > FILES_CHUNK_SIZE)
+            size = offsetof(struct file_chunk, data) + len + 1;
+        if ((c = malloc(size)) == NULL)
+            return NULL;
+        c->used = 0;
+        // an oversized chunk goes second, the current one keeps filling
+        if (len + 1 > FILES_CHUNK_SIZE && ft->pool != NULL) {
+            c->next = ft->pool->next;
+            ft->pool->next = c;
+        } else {
+            c->next = ft->pool;
+            ft->pool = c;
+        }
+    }
+    p = c->data + c->used;
+    memcpy(p, name, len);
+    p[len] = '\0';
+    c->used += len + 1;
+    return p;
+}
+
+static int files_grow(struct file_table *ft)
+{
+    unsigned int i, j, cap = ft->cap ? ft->cap * 2 : FILES_TABLE_SIZE;
+    uint32_t *slot;
+
+    if ((slot = calloc(cap, sizeof(*slot))) == NULL)
+        return -1;
+    for (i = 0; i < ft->nent; i++) {
+        for (j = ft->ent[i].hash & (cap - 1); slot[j]; j = (j + 1) & (cap - 1))
+            ;
+        slot[j] = i + 1;
+    }
+    free(ft->slot);
+    ft->slot = slot;
+    ft->cap = cap;
+    return 0;
+}
+
+static int idle(const struct file_table *ft, const struct file_entry *e)
+{
+    return ft->tick - e->tick >= FILES_IDLE_TICKS;
+}
+
+/*
+ * the table again with only the entries in use, their paths in a new
+ * pool. out of memory the rest is dropped too, an entry holds nothing
+ * between ticks that a lookup can't rebuild.
+ */
+static void files_compact(struct file_table *ft)
+{
+    struct file_chunk *old = ft->pool, *next;
+    unsigned int i, j, n = 0;
+
+    ft->pool = NULL;
+    for (i = 0; i < ft->nent; i++) {
+        if (idle(ft, &ft->ent[i]))
+            continue;
+        ft->ent[n] = ft->ent[i];
+        if ((ft->ent[n].use.name = files_intern(ft, ft->ent[i].use.name, ft->ent[i].len)) == NULL)
+            break;
+        n++;
+    }
+    for (; old != NULL; old = next) {
+        next = old->next;
+        free(old);
+    }
+
+    ft->nent = n;
+    ft->idle = 0;
+    memset(ft->slot, 0, ft->cap * sizeof(*ft->slot));
+    for (i = 0; i < n; i++) {
+        for (j = ft->ent[i].hash & (ft->cap - 1); ft->slot[j]; j = (j + 1) & (ft->cap - 1))
+            ;
+        ft->slot[j] = i + 1;
+    }
+}
+
+/*
+ * a new tick, the sums of the last one are dropped as entries are seen.
+ * when most entries went idle the table is rebuilt first, each entry
+ * goes idle once so that's paid for by the lookups that added them.
+ */
+void files_begin(struct file_table *ft)
+{
+    if (ft->idle * 2 > ft->nent)
+        files_compact(ft);
+    ft->tick++;
+    ft->touched = 0;
+    ft->last = NULL;
+}
+
+/*
+ * the sums of the file name[0..len) for this tick, pid counted once.
+ * valid until the next lookup, which may move the entries. NULL when
+ * out of memory, the mapping then just isn't attributed.
+ */
+struct file_usage *files_lookup(struct file_table *ft, const char *name, size_t len, int pid)
+{
+    struct file_entry *e = ft->last;
+    uint32_t hash;
+    unsigned int j;
+
+    if (e == NULL || e->len != len || memcmp(e->use.name, name, len) != 0) {
+        hash = name_hash(name, len);
+        e = NULL;
+        for (j = hash & (ft->cap - 1); ft->cap > 0 && ft->slot[j]; j = (j + 1) & (ft->cap - 1)) {
+            struct file_entry *p = &ft->ent[ft->slot[j] - 1];
+            if (p->hash == hash && p->len == len && !memcmp(p->use.name, name, len)) {
+                e = p;
+                break;
+            }
+        }
+        if (e == NULL) {
+            if ((ft->nent + 1) * 100 > ft->cap * 70 && files_grow(ft) < 0)
+                return NULL;
+            if (ft->nent == ft->entcap) {
+                unsigned int cap = ft->entcap ? ft->entcap * 2 : FILES_TABLE_SIZE / 2;
+                struct file_entry *ent = realloc(ft->ent, cap * sizeof(*ent));
+                if (ent == NULL)
+                    return NULL;
+                ft->ent = ent;
+                ft->entcap = cap;
+            }
+            e = &ft->ent[ft->nent];
+            memset(e, 0, sizeof(*e));
+            if ((e->use.name = files_intern(ft, name, len)) == NULL)
+                return NULL;
+            e->hash = hash;
+            e->len = len;
+            for (j = hash & (ft->cap - 1); ft->slot[j]; j = (j + 1) & (ft->cap - 1))
+                ;
+            ft->slot[j] = ++ft->nent;
+        }
+        ft->last = e;
+    }
+
+    if (e->tick != ft->tick) {
+        memset(&e->use.stats, 0, sizeof(e->use.stats));
+        e->use.procs = 0;
+        e->last_pid = 0;
+        e->tick = ft->tick;
+        ft->touched++;
+    }
+    if (e->last_pid != pid) {
+        e->last_pid = pid;
+        e->use.procs++;
+    }
+    return &e->use;
+}
+
+static int cmpfile(const void *a, const void *b)
+{
+    const struct file_usage *x = a, *y = b;
+
+    if (x->stats.pss != y->stats.pss)
+        return x->stats.pss < y->stats.pss ? 1 : -1;
+    return strcmp(x->name, y->name);
+}
+
+/*
+ * the top files of this tick into minfo, by pss, their names copied
+ * after them in the same block as the table may drop its own.
+ */
+int files_collect(struct file_table *ft, struct meminfo *minfo)
+{
+    struct file_usage *files, *top;
+    size_t names = 0;
+    unsigned int i;
+    char *p;
+    int n = 0;
+
+    minfo->files = NULL;
+    minfo->num_files = 0;
+    ft->idle = 0;
+    for (i = 0; i < ft->nent; i++)
+        ft->idle += idle(ft, &ft->ent[i]);
+    if (ft->touched == 0)
+        return 0;
+    if ((files = malloc(ft->touched * sizeof(*files))) == NULL)
+        return MEMINFO_ENOMEM;
+    for (i = 0; i < ft->nent; i++)
+        if (ft->ent[i].tick == ft->tick && ft->ent[i].use.stats.pss > 0)
+            files[n++] = ft->ent[i].use;
+    qsort(files, n, sizeof(*files), cmpfile);
+    if (n > ft->top)
+        n = ft->top;
+    if (n == 0) {
+        free(files);
+        return 0;
+    }
+
+    for (i = 0; i < (unsigned int)n; i++)
+        names += strlen(files[i].name) + 1;
+    if ((top = realloc(files, n * sizeof(*files) + names)) == NULL) {
+        free(files);
+        return MEMINFO_ENOMEM;
+    }
+    p = (char *)(top + n);
+    for (i = 0; i < (unsigned int)n; i++) {
+        names = strlen(top[i].name) + 1;
+        memcpy(p, top[i].name, names);
+        top[i].name = p;
+        p += names;
+    }
+    minfo->files = top;
+    minfo->num_files = n;
+    return 0;
+}
+
+void files_free(struct file_table *ft)
+{
+    struct file_chunk *c, *next;
+
+    if (ft == NULL)
+        return;
+    for (c = ft->pool; c != NULL; c = next) {
+        next = c->next;
+        free(c);
+    }
+    free(ft->ent);
+    free(ft->slot);
+    free(ft);
+}
+
+/*
+ * sum pss per mapped file over every process, the top files kept with
+ * each snapshot; 0 turns it off
+ */
+int meminfo_set_files(struct meminfo_ctx *ctx, int top)
+{
+    if (top < 0)
+        return ctx_error(ctx, MEMINFO_EINVAL, "negative file count %d", top);
+    if (top == 0) {
+        files_free(ctx->files);
+        ctx->files = NULL;
+        return 0;
+    }
+    if (ctx->files == NULL && (ctx->files = calloc(1, sizeof(*ctx->files))) == NULL)
+        return ctx_error(ctx, MEMINFO_ENOMEM, "calloc file table error");
+    ctx->files->top = top;
+    return 0;
+}
+
+void print_files(struct out *o, struct meminfo *minfo)
+{
+    struct file_usage *f;
+    int i;
+
+    if (minfo->num_files == 0)
+        return;
+    out_str(o, "\nTotal PSS by file:\n"
+            "    pss  Private  Private   Shared   Shared  procs\n"
+            "  Total    Dirty    Clean    Dirty    Clean\n");
+    for (i = 0; i < minfo->num_files; i++) {
+        f = &minfo->files[i];
+        out_u64(o, f->stats.pss, 7);
+        out_u64(o, f->stats.privateDirty, 9);
+        out_u64(o, f->stats.privateClean, 9);
+        out_u64(o, f->stats.sharedDirty, 9);
+        out_u64(o, f->stats.sharedClean, 9);
+        out_u64(o, f->procs, 7);
+        out_str(o, "  ");
+        out_str(o, f->name);
+        out_char(o, '\n');
+    }
+}
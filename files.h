@@ -0,0 +1,56 @@
+#ifndef MEMINFO_FILES_H
+#define MEMINFO_FILES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "getpss.h"
+
+/* initial slots of the path table, a power of two */
+#define FILES_TABLE_SIZE 4096
+/* bytes of interned paths per pool chunk */
+#define FILES_CHUNK_SIZE (64 * 1024)
+/* a path not mapped for this many ticks is idle, see files_begin */
+#define FILES_IDLE_TICKS 16
+
+/* a mapped file summed over every process of a tick */
+struct file_usage {
+    const char *name;       /* the snapshot's own copy */
+    struct stats_t stats;
+    int procs;              /* processes mapping it */
+};
+
+struct file_entry;
+struct file_chunk;
+
+/*
+ * paths seen in smaps, interned once while they're mapped. the sums are
+ * per tick: an entry last touched in an earlier tick is zeroed when it's
+ * seen again, so a tick costs nothing for files not mapped. the table is
+ * rebuilt without the idle entries once they are most of it, deleted
+ * ashmem and memfd names or reinstalled apks don't pile up.
+ */
+struct file_table {
+    struct file_entry *ent;
+    unsigned int nent, entcap;
+    uint32_t *slot;             /* entry index + 1, 0 is free */
+    unsigned int cap;
+    struct file_chunk *pool;
+    struct file_entry *last;    /* mappings of a file come in a row */
+    int tick;
+    int touched;                /* entries seen this tick */
+    unsigned int idle;          /* entries idle at the last files_collect */
+    int top;                    /* files kept per snapshot */
+};
+
+struct meminfo_ctx;
+struct out;
+
+int meminfo_set_files(struct meminfo_ctx *ctx, int top);
+void files_free(struct file_table *ft);
+void files_begin(struct file_table *ft);
+struct file_usage *files_lookup(struct file_table *ft, const char *name, size_t len, int pid);
+int files_collect(struct file_table *ft, struct meminfo *minfo);
+void print_files(struct out *o, struct meminfo *minfo);
+
+#endif
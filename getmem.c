@@ -3,6 +3,8 @@
 #include <string.h>
 #include <errno.h>
 #include <ctype.h>
+#include <inttypes.h>
+#include <limits.h>
 
 #include <unistd.h>
 #include <fcntl.h>	/* for open etc. system call */
@@ -14,8 +16,85 @@
 #include "getmem.h"
 #include "error.h"
 #include "getpss.h"
+#include "context.h"
 
-static int get_meminfo(struct mem_item *mem)
+/* highest "[n]POOL size:" index expected in codec_mm_dump */
+#define CODEC_MAX_FROM 16
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* file i of c under the data root */
+static const char *collector_path(struct collector *c, int i, char *buf, size_t len)
+{
+    snprintf(buf, len, "%s%s", c->root, c->files[i]);
+    return buf;
+}
+
+/* lines in a buffer read whole, for the profile */
+static void collector_lines(struct collector *c, const char *buf, int len)
+{
+#ifdef MEMINFO_PROFILE
+    const char *p = buf, *end = buf + len;
+
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL) {
+        c->last_lines++;
+        p++;
+    }
+#else
+    (void)c;
+    (void)buf;
+    (void)len;
+#endif
+}
+
+static char *collector_gets(struct collector *c, char *line, int size, FILE *fp)
+{
+    char *s = fgets(line, size, fp);
+#ifdef MEMINFO_PROFILE
+    if (s != NULL)
+        c->last_lines++;
+#else
+    (void)c;
+#endif
+    return s;
+}
+
+static int collector_open(struct collector *c, int i)
+{
+    char path[PATH_MAX];
+
+#ifdef MEMINFO_PROFILE
+    c->last_opens++;
+#endif
+    return open(collector_path(c, i, path, sizeof(path)), O_RDONLY);
+}
+
+static FILE *collector_fopen(struct collector *c, int i)
+{
+    char path[PATH_MAX];
+    FILE *fp = fopen(collector_path(c, i, path, sizeof(path)), "r");
+#ifdef MEMINFO_PROFILE
+    c->last_opens++;
+#endif
+    if (fp == NULL)
+        err_msg("open file %s error %s", path, strerror(errno));
+    return fp;
+}
+
+static void collector_fclose(struct collector *c, FILE *fp)
+{
+    long pos = ftell(fp);
+    if (pos > 0)
+        c->last_bytes += pos;
+    fclose(fp);
+}
+
+static int get_meminfo(struct collector *c, struct meminfo *minfo)
 {
     const char* const tags[] = {
         "MemTotal:",
@@ -61,22 +140,25 @@ static int get_meminfo(struct mem_item *mem)
 
     char buffer[1536];
     int num_found = 0;
+    struct mem_item *mem = minfo->item;
 
-    int fd = open(PROC_MEMINFO, O_RDONLY);
+    int fd = collector_open(c, 0);
     if (fd < 0)
-        err_sys("unable to open file %s:%s", PROC_MEMINFO, strerror(errno));
+        return MEMINFO_EIO;
 
     int len = read(fd, buffer, sizeof(buffer)-1);
     close(fd);
 
     if (len < 0)
-        err_quit("file %s is empty\n", PROC_MEMINFO);
+        return MEMINFO_EIO;
+    c->last_bytes += len;
+    collector_lines(c, buffer, len);
 
     buffer[len] = 0;
     char *p = strstr(buffer, "MemTotal:");
 
     if (p == NULL)
-        err_quit("input file is not /proc/meminfo\n");
+        return MEMINFO_EFORMAT;
 
     while (*p && num_found < 17) {
         int i = 0;
@@ -90,7 +172,7 @@ static int get_meminfo(struct mem_item *mem)
                     *p = 0;
                     p++;
                 }
-                mem[i].num = atoi(num);
+                mem[i].num = strtoull(num, NULL, 10);
                 strcpy(mem[i].name,  tags[i]);
                 num_found++;
                 break;
@@ -105,119 +187,211 @@ static int get_meminfo(struct mem_item *mem)
     return 0;
 }
 
-static int get_zram_mem(int *zram)
+static int get_zram_mem(struct collector *c, struct meminfo *mem)
 {
     int fd, len;
     char buffer[64];
 
-    fd = open(ZRAM_MEM, O_RDONLY);
-    if (fd >= 0) {
-        len = read(fd, buffer, sizeof(buffer)-1);
-        close(fd);
-        if (len > 0) {
-            buffer[len] = 0;
-            *zram = atoi(buffer)/1024;
-        }
-    } else {
-        err_msg("%s open error\n", ZRAM_MEM);
+    fd = collector_open(c, 0);
+    if (fd < 0) {
+        err_msg("%s%s open error\n", c->root, c->files[0]);
+        return -1;
+    }
+
+    len = read(fd, buffer, sizeof(buffer)-1);
+    close(fd);
+    if (len > 0) {
+        c->last_bytes += len;
+        collector_lines(c, buffer, len);
+        buffer[len] = 0;
+        mem->item[MEMINFO_ZRAM_TOTAL].num = strtoull(buffer, NULL, 10)/1024;
     }
 
     return 0;
 }
 
-static int get_ion_mem(int *buffer, int *ion)
+static int get_ion_mem(struct collector *c, struct meminfo *mem)
 {
     FILE *ion_fp;
     char line[1024];
 
     char ion_name[128], *p;
     int ion_pid;
-    unsigned int ion_size;
-    size_t unaccounted_size = 0;
-    size_t buffer_size = 0;
+    uint64_t ion_size;
+    uint64_t unaccounted_size = 0;
+    uint64_t buffer_size = 0;
 
-    if ((ion_fp = fopen(ION_MEM, "r")) == NULL)
-        err_sys("open file %s error %s", ION_MEM, strerror(errno));
+    if ((ion_fp = collector_fopen(c, 0)) == NULL)
+        return -1;
 
-    while(fgets(line, sizeof(line), ion_fp) != NULL) {
+    while(collector_gets(c, line, sizeof(line), ion_fp) != NULL) {
         if ((p=strstr(line, "="))) {
             p++;
-            if(sscanf(p, "%u%s", &ion_size, ion_name) ==2)
+            if(sscanf(p, "%"SCNu64"%s", &ion_size, ion_name) ==2)
                 buffer_size += ion_size;
         }
 
-        if (sscanf(line, "%s%d%u", ion_name, &ion_pid, &ion_size) != 3)
+        if (sscanf(line, "%s%d%"SCNu64, ion_name, &ion_pid, &ion_size) != 3)
             continue;
         else
             unaccounted_size += ion_size;
     }
-    fclose(ion_fp);
+    collector_fclose(c, ion_fp);
 
     //convert to kb
-    *ion = unaccounted_size/1024;
-    *buffer = buffer_size/1024;
+    mem->item[MEMINFO_ION].num = unaccounted_size/1024;
+    mem->item[MEMINFO_ION_BUFFER].num = buffer_size/1024;
 
     return 0;
 }
 
-int get_gpu_mem(int *gpu)
+static int get_gpu_mem(struct collector *c, struct meminfo *mem)
 {
     FILE *gpu_fd;
-    char line[1024];
+    char line[1024], path[PATH_MAX];
 
-    int gpu_size, flag = 0;
+    uint64_t gpu_size = 0;
+    int flag = 0;
 
-    if ((gpu_fd = fopen(GL_MEM, "r")) == NULL) {
+    if ((gpu_fd = fopen(collector_path(c, 0, path, sizeof(path)), "r")) == NULL) {
         //err_msg("open file %s error %s", GL_MEM, strerror(errno));
         flag = 1;
-        if ((gpu_fd = fopen(GL_MEMTX, "r")) == NULL) {
-            err_msg("open file %s error %s", GL_MEMTX, strerror(errno));
-            return -errno;
-        }
+        if ((gpu_fd = collector_fopen(c, 1)) == NULL)
+            return -1;
     }
 
-    while(fgets(line, sizeof(line), gpu_fd) != NULL) {
+    while(collector_gets(c, line, sizeof(line), gpu_fd) != NULL) {
         if (flag == 0) {
             // mali450 (in bytes)
             // Mali mem usage: 42856448
-            if (sscanf(line, "Mali mem usage: %d", &gpu_size) != 1)
+            if (sscanf(line, "Mali mem usage: %"SCNu64, &gpu_size) != 1)
                 continue;
             else
                 break;
         } else if (flag == 1) {
             // mali t82x t83x (in pages)
             // mali0                  12282
-            if (sscanf(line, "%*s%d", &gpu_size) != 1)
+            if (sscanf(line, "%*s%"SCNu64, &gpu_size) != 1)
                 continue;
             else
                 break;
         }
     }
 
-    fclose(gpu_fd);
+    collector_fclose(c, gpu_fd);
     if (flag == 0)
-        *gpu = gpu_size/1024;
+        mem->item[MEMINFO_GPU_USED].num = gpu_size/1024;
     else if (flag == 1)
-        *gpu = gpu_size * 4;
+        mem->item[MEMINFO_GPU_USED].num = gpu_size * 4;
 
     return 0;
 }
 
-static int get_codec_mem(int *codec)
+const char *codec_pool_name(int which)
 {
-    FILE *codec_fd;
-    char line[1024], *p;
+    switch (which) {
+        case CODEC_POOL_CMA: return "CMA";
+        case CODEC_POOL_RES: return "RES";
+        case CODEC_POOL_TVP: return "TVP";
+        case CODEC_POOL_SYS: return "SYS";
+        default: return "???";
+    }
+}
 
-    int codec_size;
+static int codec_pool_index(const char *name)
+{
+    int i;
+    for (i = 0; i < CODEC_POOL_COUNT; i++)
+        if (!strcmp(name, codec_pool_name(i)))
+            return i;
+    return -1;
+}
+
+static struct codec_owner *codec_owner_find(struct codec_info *info, const char *name)
+{
+    int i;
+    struct codec_owner *o;
+
+    for (i = 0; i < info->num_owners; i++)
+        if (!strcmp(info->owner[i].name, name))
+            return &info->owner[i];
 
-    if ((codec_fd = fopen(CODEC_MEM, "r")) == NULL) {
-        err_msg("open file %s error %s", CODEC_MEM, strerror(errno));
-        return -errno;
+    if (info->num_owners >= CODEC_MAX_OWNERS)
+        return NULL;
+
+    o = &info->owner[info->num_owners++];
+    snprintf(o->name, sizeof(o->name), "%s", name);
+    o->bytes = 0;
+    o->cnt = 0;
+    return o;
+}
+
+/*
+ * owner lines look like
+ *   owner: codec_264:no,addr=0000000027c00000,s=3145728,from=4,cnt=1
+ * where "from" refers to the "[4]CMA size:..." line of the same dump.
+ */
+static void codec_parse_owner(struct codec_info *info, const int *from_pool, char *p)
+{
+    char name[32], *q;
+    uint64_t size;
+    int from, cnt = 1;
+    struct codec_owner *o;
+
+    p += sizeof("owner:") - 1;
+    while (*p == ' ') p++;
+    if (sscanf(p, "%31[^:]", name) != 1)
+        return;
+    if ((q = strstr(p, ",s=")) == NULL || sscanf(q, ",s=%"SCNu64, &size) != 1)
+        return;
+    if ((q = strstr(p, ",cnt=")) != NULL)
+        sscanf(q, ",cnt=%d", &cnt);
+
+    if ((o = codec_owner_find(info, name)) != NULL) {
+        o->bytes += size;
+        o->cnt += cnt;
     }
 
-    while(fgets(line, sizeof(line), codec_fd) != NULL) {
+    if ((q = strstr(p, ",from=")) != NULL && sscanf(q, ",from=%d", &from) == 1
+            && from >= 0 && from < CODEC_MAX_FROM && from_pool[from] >= 0)
+        info->pool[from_pool[from]] += size;
+}
+
+static int get_codec_mem(struct collector *c, struct meminfo *mem)
+{
+    FILE *codec_fd;
+    char line[1024], pool[8], *p;
+    int from_pool[CODEC_MAX_FROM];
+    int i, from;
+    struct codec_info *info = &mem->codec;
+
+    uint64_t codec_size;
+
+    memset(info, 0, sizeof(*info));
+    for (i = 0; i < CODEC_MAX_FROM; i++)
+        from_pool[i] = -1;
+
+    if ((codec_fd = collector_fopen(c, 0)) == NULL)
+        return -1;
+
+    while(collector_gets(c, line, sizeof(line), codec_fd) != NULL) {
+        p = line;
+        while (*p == ' ' || *p == '\t') p++;
+
+        if (!strncmp(p, "owner:", 6)) {
+            codec_parse_owner(info, from_pool, p);
+            continue;
+        }
+
+        // [3]RES size:65 MB,alloced:63 MB free:1 MB
+        if (sscanf(p, "[%d]%7[A-Z] size:", &from, pool) == 2
+                && from >= 0 && from < CODEC_MAX_FROM)
+            from_pool[from] = codec_pool_index(pool);
+
         if ((p=strstr(line, "CMA size:"))) {
             p = strstr(line, "alloced:");
+            if (p == NULL)
+                continue;
             p += sizeof("alloced");
 
             while (*p == ' ') p++;
@@ -227,30 +401,27 @@ static int get_codec_mem(int *codec)
                 *p = 0;
                 p++;
             }
-            codec_size = atoi(num);
-            *codec = codec_size * 1024;
-            break;
+            codec_size = strtoull(num, NULL, 10);
+            mem->item[MEMINFO_CODEC_USED].num += codec_size * 1024;
         }
     }
 
-    fclose(codec_fd);
+    collector_fclose(c, codec_fd);
     return 0;
 }
 
-static int get_codec_mem_scatter(int *codec)
+static int get_codec_mem_scatter(struct collector *c, struct meminfo *mem)
 {
     FILE *codec_fd;
     char line[1024], *p;
 
-    int codec_size;
-    int total = 0;
+    uint64_t codec_size;
+    uint64_t total = 0;
 
-    if ((codec_fd = fopen(CODEC_MEM_SCATTER, "r")) == NULL) {
-        err_msg("open file %s error %s", CODEC_MEM_SCATTER, strerror(errno));
-        return -errno;
-    }
+    if ((codec_fd = collector_fopen(c, 0)) == NULL)
+        return -1;
 
-    while(fgets(line, sizeof(line), codec_fd) != NULL) {
+    while(collector_gets(c, line, sizeof(line), codec_fd) != NULL) {
         // alloc from sys pages cnt:
         if ((p=strstr(line, "alloc from sys pages cnt:"))) {
             p += sizeof("alloc from sys pages cnt");
@@ -262,7 +433,7 @@ static int get_codec_mem_scatter(int *codec)
                 *p = 0;
                 p++;
             }
-            codec_size = atoi(num);
+            codec_size = strtoull(num, NULL, 10);
             total += codec_size * 4;
         } else if ((p=strstr(line, "one_page_cnt:"))) {
             p += sizeof("one_page_cnt");
@@ -274,30 +445,28 @@ static int get_codec_mem_scatter(int *codec)
                 *p = 0;
                 p++;
             }
-            codec_size = atoi(num);
+            codec_size = strtoull(num, NULL, 10);
             total += codec_size * 4;
         }
     }
 
-    fclose(codec_fd);
-    *codec = total;
+    collector_fclose(c, codec_fd);
+    mem->item[MEMINFO_CODEC_USED].num += total;
     return 0;
 }
 
-static int get_vmalloc_mem(int *vmalloc)
+static int get_vmalloc_mem(struct collector *c, struct meminfo *mem)
 {
     FILE *vmalloc_fd;
     char line[1024], *p;
 
-    int vmalloc_size = 0;
-    int vmap_size;
+    uint64_t vmalloc_size = 0;
+    uint64_t vmap_size;
 
-    if ((vmalloc_fd = fopen(VMALLOC_INFO, "r")) == NULL) {
-        err_msg("open file %s error %s", VMALLOC_INFO, strerror(errno));
+    if ((vmalloc_fd = collector_fopen(c, 0)) == NULL)
         return -1;
-    }
 
-    while (fgets(line, sizeof(line), vmalloc_fd) != NULL) {
+    while (collector_gets(c, line, sizeof(line), vmalloc_fd) != NULL) {
         if (strstr(line, "ioremap")) {
             continue;
         } else if ((p=strstr(line, "pages=")) != NULL) {
@@ -307,34 +476,33 @@ static int get_vmalloc_mem(int *vmalloc)
             if (*p != 0)
                 *p = 0;
             // convert to KB
-            vmalloc_size += atoi(num) * 4;
+            vmalloc_size += strtoull(num, NULL, 10) * 4;
         } else if (strstr(line, "vmap")) {
             // skip ion vmap
             if (strstr(line, "ion"))
                 continue;
-            if(sscanf(line, "%*s%d%*s%*s", &vmap_size) == 1)
+            if(sscanf(line, "%*s%"SCNu64"%*s%*s", &vmap_size) == 1)
                 vmalloc_size += vmap_size/1024;
         }
     }
 
-    fclose(vmalloc_fd);
-    *vmalloc = vmalloc_size;
+    collector_fclose(c, vmalloc_fd);
+    mem->item[MEMINFO_VMALLOC_INFO].num = vmalloc_size;
     return 0;
 }
 
-static int get_cma_mem(int *cma)
+static int get_cma_mem(struct collector *c, struct meminfo *mem)
 {
     FILE *file;
     char line[1024], *p;
 
-    int cma_free = 0, flag = 0;
+    uint64_t cma_free = 0;
+    int flag = 0;
 
-    if ((file = fopen(PAGETYPE, "r")) == NULL) {
-        err_msg("open file %s error %s", PAGETYPE, strerror(errno));
+    if ((file = collector_fopen(c, 0)) == NULL)
         return -1;
-    }
 
-    while (fgets(line, sizeof(line), file) != NULL) {
+    while (collector_gets(c, line, sizeof(line), file) != NULL) {
         if (flag == 0 && strstr(line, "total")) {
             flag = 1;
             continue;
@@ -343,118 +511,487 @@ static int get_cma_mem(int *cma)
                 if((p=strrchr(line, ' '))) {
                     p++;
                     if (isdigit(*p)) {
-                        cma_free = atoi(p) * 4;
+                        cma_free = strtoull(p, NULL, 10) * 4;
                         break;
                     }
                 }
         }
     }
 
-    fclose(file);
-    *cma = cma_free;
+    collector_fclose(c, file);
+    mem->item[MEMINFO_FREE_CMA].num = cma_free;
     return 0;
 }
 
-int print_meminfo(struct mem_item *mem)
+/* name of a kernel category, the sources other than meminfo don't set one */
+const char *mem_label(const struct mem_item *mem, int i)
 {
-    int total, kernel, kernel_cached;
-    int pss, free_ram, unknown, ion;
+    if (mem[i].name[0] != '\0')
+        return mem[i].name;
+    switch (i) {
+        case MEMINFO_VMALLOC_INFO: return "vmalloc:";
+        case MEMINFO_ZRAM_TOTAL: return "zram:";
+        case MEMINFO_ION: return "ion:";
+        case MEMINFO_ION_BUFFER: return "ion buffer:";
+        case MEMINFO_GPU_USED: return "gpu:";
+        case MEMINFO_CODEC_USED: return "codec:";
+        case MEMINFO_FREE_CMA: return "free cma:";
+        default: return NULL;
+    }
+}
 
+/* one "<tree><name> <kB> KB" line of print_meminfo, tree may be empty */
+static void meminfo_line(struct out *o, const char *tree, const char *name, int64_t kb)
+{
+    out_str(o, tree);
+    out_pad(o, name, 15);
+    out_i64(o, kb, 7);
+    out_str(o, " KB\n");
+}
+
+void mem_breakdown(const struct mem_item *mem, struct mem_part *part)
+{
+    static const char *names[_NUM_PART] = {
+        "pss", "free", "kernel", "buffers", "slab", "page_tables",
+        "kernel_stack", "shmem", "vmalloc", "zram", "ion", "gpu",
+        "codec", "unknown",
+    };
+    int64_t kernel = 0;
+    int i;
+
+    for (i = 0; i < _NUM_PART; i++)
+        part[i].name = names[i];
+    part[PART_PSS].kb = mem[MEMINFO_ANONPAGES].num + mem[MEMINFO_MAPPED].num;
+    part[PART_FREE].kb = mem[MEMINFO_CACHED].num - mem[MEMINFO_MAPPED].num
+        + mem[MEMINFO_FREE].num;
+    part[PART_BUFFERS].kb = mem[MEMINFO_BUFFERS].num;
+    part[PART_SLAB].kb = mem[MEMINFO_SLAB].num;
+    part[PART_PAGE_TABLES].kb = mem[MEMINFO_PAGE_TABLES].num;
+    part[PART_KERNEL_STACK].kb = mem[MEMINFO_KERNEL_STACK].num;
+    part[PART_SHMEM].kb = mem[MEMINFO_SHMEM].num;
+    part[PART_VMALLOC].kb = mem[MEMINFO_VMALLOC_INFO].num;
+    part[PART_ZRAM].kb = mem[MEMINFO_ZRAM_TOTAL].num;
+    part[PART_ION].kb = mem[MEMINFO_ION].num + mem[MEMINFO_ION_BUFFER].num;
+    part[PART_GPU].kb = mem[MEMINFO_GPU_USED].num;
+    part[PART_CODEC].kb = mem[MEMINFO_CODEC_USED].num;
+
+    for (i = PART_BUFFERS; i < PART_UNKNOWN; i++)
+        kernel += part[i].kb;
+    part[PART_UNKNOWN].kb = (int64_t)mem[MEMINFO_TOTAL].num
+        - part[PART_PSS].kb - part[PART_FREE].kb - kernel;
+    part[PART_KERNEL].kb = kernel + part[PART_UNKNOWN].kb;
+}
+
+int print_meminfo(struct out *o, struct mem_item *mem)
+{
+    int64_t total, kernel, kernel_cached;
+    int64_t pss, free_ram, unknown, ion;
+    struct mem_part part[_NUM_PART];
+    static const char *first = "             +---";
+    static const char *next = "             |---";
+
+    mem_breakdown(mem, part);
     total = mem[MEMINFO_TOTAL].num;
-    pss = mem[MEMINFO_ANONPAGES].num + mem[MEMINFO_MAPPED].num;
+    pss = part[PART_PSS].kb;
 
-    printf("\nmemory information in kernel's view\n");
-    printf("%15s%7d KB\n", mem[MEMINFO_TOTAL].name, total);
+    out_str(o, "\nmemory information in kernel's view\n");
+    meminfo_line(o, "", mem[MEMINFO_TOTAL].name, total);
 
-    printf("%15s%7d KB\n", "PSS:", pss);
-    printf("             +---");
-    printf("%15s%7d KB\n", mem[MEMINFO_ANONPAGES].name, mem[MEMINFO_ANONPAGES].num);
-    printf("             |---");
-    printf("%15s%7d KB\n", mem[MEMINFO_MAPPED].name, mem[MEMINFO_MAPPED].num);
+    meminfo_line(o, "", "PSS:", pss);
+    meminfo_line(o, first, mem[MEMINFO_ANONPAGES].name, mem[MEMINFO_ANONPAGES].num);
+    meminfo_line(o, next, mem[MEMINFO_MAPPED].name, mem[MEMINFO_MAPPED].num);
 
     kernel_cached = mem[MEMINFO_CACHED].num - mem[MEMINFO_MAPPED].num;
-    free_ram = kernel_cached + mem[MEMINFO_FREE].num;
-    printf("%15s%7d KB\n", "Free Ram:", free_ram);
-    printf("             +---");
-    printf("%15s%7d KB", mem[MEMINFO_FREE].name, mem[MEMINFO_FREE].num);
-    if (mem[MEMINFO_FREE_CMA].num)
-        printf(" (free cma:%d KB)", mem[MEMINFO_FREE_CMA].num);
-
-    printf("\n             |---");
-    printf("%15s%7d KB\n", "Kernel cached:", kernel_cached);
-
-    ion = mem[MEMINFO_ION].num + mem[MEMINFO_ION_BUFFER].num;
-
-    kernel = mem[MEMINFO_BUFFERS].num
-        + mem[MEMINFO_SLAB].num
-        + mem[MEMINFO_PAGE_TABLES].num
-        + mem[MEMINFO_KERNEL_STACK].num
-        + mem[MEMINFO_SHMEM].num
-        + mem[MEMINFO_VMALLOC_INFO].num
-        + mem[MEMINFO_ZRAM_TOTAL].num
-        + ion
-        + mem[MEMINFO_GPU_USED].num
-        + mem[MEMINFO_CODEC_USED].num;
-
-    unknown = total - pss - free_ram - kernel;
-    printf("%15s%7d KB\n", "kernel used:", kernel+unknown);
-    printf("             +---");
-    printf("%15s%7d KB\n", mem[MEMINFO_BUFFERS].name, mem[MEMINFO_BUFFERS].num);
-    printf("             |---");
-    printf("%15s%7d KB\n", mem[MEMINFO_SLAB].name, mem[MEMINFO_SLAB].num);
-    printf("             |---");
-    printf("%15s%7d KB\n", mem[MEMINFO_PAGE_TABLES].name, mem[MEMINFO_PAGE_TABLES].num);
-    printf("             |---");
-    printf("%15s%7d KB\n", mem[MEMINFO_KERNEL_STACK].name, mem[MEMINFO_KERNEL_STACK].num);
-    printf("             |---");
-    printf("%15s%7d KB\n", mem[MEMINFO_SHMEM].name, mem[MEMINFO_SHMEM].num);
-    printf("             |---");
-    printf("%15s%7d KB\n", "vmalloc:", mem[MEMINFO_VMALLOC_INFO].num);
-    printf("             |---");
-    printf("%15s%7d KB\n", "zram:", mem[MEMINFO_ZRAM_TOTAL].num);
-    printf("             |---");
-    printf("%15s%7d KB (graphic:%d + buffer:%d)\n", "ion:", ion,
-            mem[MEMINFO_ION].num, mem[MEMINFO_ION_BUFFER].num);
-    printf("             |---");
-    printf("%15s%7d KB\n", "gpu:", mem[MEMINFO_GPU_USED].num);
-    printf("             |---");
-    printf("%15s%7d KB\n", "codecMem:", mem[MEMINFO_CODEC_USED].num);
-    printf("             |---");
-    printf("%15s%7d KB\n", "unknown:", unknown);
-
-    printf("\ncma memory information:\n");
-    printf("%15s%d KB %15s%d KB\n", "Total CMA:", mem[MEMINFO_TOTAL_CMA].num,
-            "driver used:", mem[MEMINFO_DUSED_CMA].num);
+    free_ram = part[PART_FREE].kb;
+    meminfo_line(o, "", "Free Ram:", free_ram);
+    out_str(o, first);
+    out_pad(o, mem[MEMINFO_FREE].name, 15);
+    out_u64(o, mem[MEMINFO_FREE].num, 7);
+    out_str(o, " KB");
+    if (mem[MEMINFO_FREE_CMA].num) {
+        out_str(o, " (free cma:");
+        out_u64(o, mem[MEMINFO_FREE_CMA].num, 0);
+        out_str(o, " KB)");
+    }
+    out_char(o, '\n');
+    meminfo_line(o, next, "Kernel cached:", kernel_cached);
+
+    ion = part[PART_ION].kb;
+    unknown = part[PART_UNKNOWN].kb;
+    kernel = part[PART_KERNEL].kb - unknown;
+    meminfo_line(o, "", "kernel used:", kernel+unknown);
+    meminfo_line(o, first, mem[MEMINFO_BUFFERS].name, mem[MEMINFO_BUFFERS].num);
+    meminfo_line(o, next, mem[MEMINFO_SLAB].name, mem[MEMINFO_SLAB].num);
+    meminfo_line(o, next, mem[MEMINFO_PAGE_TABLES].name, mem[MEMINFO_PAGE_TABLES].num);
+    meminfo_line(o, next, mem[MEMINFO_KERNEL_STACK].name, mem[MEMINFO_KERNEL_STACK].num);
+    meminfo_line(o, next, mem[MEMINFO_SHMEM].name, mem[MEMINFO_SHMEM].num);
+    meminfo_line(o, next, "vmalloc:", mem[MEMINFO_VMALLOC_INFO].num);
+    meminfo_line(o, next, "zram:", mem[MEMINFO_ZRAM_TOTAL].num);
+    out_str(o, next);
+    out_pad(o, "ion:", 15);
+    out_i64(o, ion, 7);
+    out_str(o, " KB (graphic:");
+    out_u64(o, mem[MEMINFO_ION].num, 0);
+    out_str(o, " + buffer:");
+    out_u64(o, mem[MEMINFO_ION_BUFFER].num, 0);
+    out_str(o, ")\n");
+    meminfo_line(o, next, "gpu:", mem[MEMINFO_GPU_USED].num);
+    meminfo_line(o, next, "codecMem:", mem[MEMINFO_CODEC_USED].num);
+    meminfo_line(o, next, "unknown:", unknown);
+
+    out_str(o, "\ncma memory information:\n");
+    out_pad(o, "Total CMA:", 15);
+    out_u64(o, mem[MEMINFO_TOTAL_CMA].num, 0);
+    out_str(o, " KB ");
+    out_pad(o, "driver used:", 15);
+    out_u64(o, mem[MEMINFO_DUSED_CMA].num, 0);
+    out_str(o, " KB\n");
 
     return 0;
 }
 
+static int cmpowner(const void *a, const void *b)
+{
+    const struct codec_owner *x = a, *y = b;
+    if (x->bytes == y->bytes)
+        return strcmp(x->name, y->name);
+    return x->bytes < y->bytes ? 1 : -1;
+}
+
+static const struct codec_owner *codec_owner_lookup(const struct codec_info *info,
+        const char *name)
+{
+    int i;
+    for (i = 0; i < info->num_owners; i++)
+        if (!strcmp(info->owner[i].name, name))
+            return &info->owner[i];
+    return NULL;
+}
+
+/* " (+12 KB)" */
+static void codec_delta(struct out *o, int64_t diff)
+{
+    out_str(o, " (");
+    out_sign(o, diff);
+    out_i64(o, diff, 0);
+    out_str(o, " KB)");
+}
+
+/*
+ * print the codec_mm pool and owner breakdown, with the change against
+ * the previous sample when one is given (periodic mode).
+ */
+void print_codec_mem(struct out *o, struct codec_info *codec, const struct codec_info *prev)
+{
+    int i;
+    const struct codec_owner *p, *q;
+
+    if (codec->num_owners == 0)
+        return;
+
+    qsort(codec->owner, codec->num_owners, sizeof(codec->owner[0]), cmpowner);
+
+    out_str(o, "\ncodec memory by pool:\n");
+    for (i = 0; i < CODEC_POOL_COUNT; i++) {
+        out_pad(o, codec_pool_name(i), 14);
+        out_char(o, ':');
+        out_u64(o, codec->pool[i]/1024, 7);
+        out_str(o, " KB");
+        if (prev)
+            codec_delta(o, (int64_t)(codec->pool[i]/1024) - (int64_t)(prev->pool[i]/1024));
+        out_char(o, '\n');
+    }
+
+    out_str(o, "codec memory by owner:\n");
+    for (i = 0; i < codec->num_owners; i++) {
+        q = &codec->owner[i];
+        out_pad(o, q->name, 14);
+        out_char(o, ':');
+        out_u64(o, q->bytes/1024, 7);
+        out_str(o, " KB  cnt ");
+        out_i64(o, q->cnt, -3);
+        if (prev) {
+            p = codec_owner_lookup(prev, q->name);
+            codec_delta(o, (int64_t)(q->bytes/1024) - (p ? (int64_t)(p->bytes/1024) : 0));
+            if (p == NULL)
+                out_str(o, " new");
+        }
+        out_char(o, '\n');
+    }
+
+    // owners that went away since the previous sample
+    if (prev) {
+        for (i = 0; i < prev->num_owners; i++) {
+            q = &prev->owner[i];
+            if (codec_owner_lookup(codec, q->name) != NULL)
+                continue;
+            out_pad(o, q->name, 14);
+            out_str(o, ":      0 KB  cnt 0  ");
+            codec_delta(o, -(int64_t)(q->bytes/1024));
+            out_str(o, " gone\n");
+        }
+    }
+}
+
 void print_mem(struct mem_item *mem)
 {
     int i;
     for (i = 0; i < 15; i++) {
-        printf("%s\t\t%d\n", mem[i].name, mem[i].num);
+        printf("%s\t\t%"PRIu64"\n", mem[i].name, mem[i].num);
     }
 }
 
-int get_mem(struct meminfo *mem)
+static const struct collector collector_defaults[] = {
+    { .name = "meminfo", .files = { PROC_MEMINFO }, .parse = get_meminfo,
+        .field = MEMINFO_TOTAL, .nfields = MEMINFO_DUSED_CMA + 1, .required = 1, .enabled = 1 },
+    { .name = "zram", .files = { ZRAM_MEM }, .parse = get_zram_mem,
+        .field = MEMINFO_ZRAM_TOTAL, .nfields = 1, .required = 0, .enabled = 1 },
+    { .name = "ion", .files = { ION_MEM }, .parse = get_ion_mem,
+        .field = MEMINFO_ION, .nfields = 2, .required = 0, .enabled = 1 },
+    { .name = "gpu", .files = { GL_MEM, GL_MEMTX }, .parse = get_gpu_mem,
+        .field = MEMINFO_GPU_USED, .nfields = 1, .required = 0, .enabled = 1 },
+    { .name = "vmalloc", .files = { VMALLOC_INFO }, .parse = get_vmalloc_mem,
+        .field = MEMINFO_VMALLOC_INFO, .nfields = 1, .required = 0, .enabled = 1 },
+    // codec and codec_scatter both add to MEMINFO_CODEC_USED
+    { .name = "codec", .files = { CODEC_MEM }, .parse = get_codec_mem,
+        .field = MEMINFO_CODEC_USED, .nfields = 1, .required = 0, .enabled = 1 },
+    { .name = "codec_scatter", .files = { CODEC_MEM_SCATTER }, .parse = get_codec_mem_scatter,
+        .field = MEMINFO_CODEC_USED, .nfields = 1, .required = 0, .enabled = 1 },
+    { .name = "cma", .files = { PAGETYPE }, .parse = get_cma_mem,
+        .field = MEMINFO_FREE_CMA, .nfields = 1, .required = 0, .enabled = 1 },
+    { .name = NULL }
+};
+
+/* a context starts with every known source on */
+void collector_init(struct meminfo_ctx *ctx)
+{
+    struct collector *c;
+
+    memcpy(ctx->collectors, collector_defaults, sizeof(collector_defaults));
+    for (c = ctx->collectors; c->name; c++)
+        c->root = ctx->root;
+}
+
+/*
+ * point the sources at the context's data root. an optional source
+ * with none of its files there is turned off now rather than failing
+ * on the first snapshot.
+ */
+void collector_set_root(struct meminfo_ctx *ctx)
+{
+    struct collector *c;
+    char path[PATH_MAX];
+    int i, found;
+
+    for (c = ctx->collectors; c->name; c++) {
+        c->root = ctx->root;
+        // a new root gets a fresh look at what an earlier one lacked
+        if (c->failed) {
+            c->failed = 0;
+            c->enabled = 1;
+        }
+        if (c->required || !c->enabled)
+            continue;
+        for (i = found = 0; i < COLLECTOR_MAX_FILES && c->files[i] && !found; i++)
+            found = access(collector_path(c, i, path, sizeof(path)), R_OK) == 0;
+        if (!found) {
+            if (!ctx->quiet)
+                err_msg("collector %s: no %s under %s, disabled\n", c->name,
+                        c->files[0], ctx->root[0] ? ctx->root : "/");
+            c->enabled = 0;
+            c->failed = 1;
+        }
+    }
+}
+
+static struct collector *collector_find(struct meminfo_ctx *ctx, const char *name, int len)
+{
+    struct collector *c;
+    for (c = ctx->collectors; c->name; c++)
+        if ((int)strlen(c->name) == len && !strncmp(c->name, name, len))
+            return c;
+    return NULL;
+}
+
+/*
+ * select the kernel sources to collect from a comma separated list.
+ * "ion,gpu" enables only those, "-vmalloc,-cma" disables just those.
+ * meminfo is always collected.
+ */
+int collector_mask(struct meminfo_ctx *ctx, const char *spec)
 {
-    int codec_scatter = 0;
+    const char *p = spec, *end;
+    struct collector *c;
+    int disable, only = 0;
 
-    get_meminfo(mem->item);
-    get_zram_mem(&(mem->item[MEMINFO_ZRAM_TOTAL].num));
-    get_ion_mem(&(mem->item[MEMINFO_ION_BUFFER].num),
-            &(mem->item[MEMINFO_ION].num));
-    get_gpu_mem(&(mem->item[MEMINFO_GPU_USED].num));
-    get_vmalloc_mem(&(mem->item[MEMINFO_VMALLOC_INFO].num));
+    while (*p) {
+        end = strchr(p, ',');
+        if (end == NULL)
+            end = p + strlen(p);
 
-    get_codec_mem(&(mem->item[MEMINFO_CODEC_USED].num));
-    get_codec_mem_scatter(&codec_scatter);
-    mem->item[MEMINFO_CODEC_USED].num += codec_scatter;
+        disable = (*p == '-');
+        if (disable)
+            p++;
 
-    //get cma information
-    get_cma_mem(&(mem->item[MEMINFO_FREE_CMA].num));
+        if ((c = collector_find(ctx, p, end - p)) == NULL)
+            return ctx_error(ctx, MEMINFO_EINVAL, "unknown collector %.*s",
+                    (int)(end - p), p);
+
+        if (!disable && !only) {
+            struct collector *o;
+            for (o = ctx->collectors; o->name; o++)
+                o->enabled = o->required;
+            only = 1;
+        }
+        c->enabled = disable ? c->required : 1;
 
+        p = *end ? end + 1 : end;
+    }
     return 0;
 }
 
+/* the optional sources, comma separated, into buf */
+const char *collector_names(char *buf, size_t len)
+{
+    const struct collector *c;
+    size_t n = 0;
+
+    buf[0] = 0;
+    for (c = collector_defaults; c->name && n < len; c++) {
+        if (c->required)
+            continue;
+        n += snprintf(buf + n, len - n, "%s%s", n ? "," : "", c->name);
+    }
+    return buf;
+}
+
+void print_collector_stats(struct meminfo_ctx *ctx)
+{
+    struct collector *c;
+
+    printf("\ncollector cost:\n");
+    printf("%15s%10s%10s%10s%12s  %s\n", "source", "last(us)", "avg(us)",
+            "bytes", "total bytes", "state");
+    for (c = ctx->collectors; c->name; c++) {
+        printf("%15s%10lld%10lld%10"PRIu64"%12"PRIu64"  %s\n", c->name,
+                c->last_ns/1000, c->runs ? c->total_ns/1000/c->runs : 0,
+                c->last_bytes, c->total_bytes,
+                c->failed ? "failed" : (c->enabled ? "on" : "off"));
+    }
+}
+
+/*
+ * run the enabled kernel sources. an optional source that fails is
+ * turned off for the rest of the session, a required one fails the
+ * whole call.
+ */
+int get_mem(struct meminfo_ctx *ctx, struct meminfo *mem)
+{
+    struct collector *c;
+    struct prof *prof = ctx->prof;
+    long long start;
+    int i, ret = 0, err;
+    PROF_SPAN(span);
+
+    PROF_BEGIN(prof, span);
+    for (c = ctx->collectors; c->name; c++)
+        for (i = 0; i < c->nfields; i++)
+            mem->item[c->field + i].num = 0;
+
+    for (c = ctx->collectors; c->name; c++) {
+        if (!c->enabled)
+            continue;
+
+        c->last_bytes = 0;
+        c->last_lines = 0;
+        c->last_opens = 0;
+        start = now_ns();
+        if ((err = c->parse(c, mem)) < 0) {
+            if (c->required) {
+                // plain -1 from a parser: the source couldn't be read
+                if (err == -1)
+                    err = MEMINFO_EIO;
+                ret = ctx_error(ctx, err, "%s%s: %s", c->root, c->files[0], meminfo_strerror(err));
+            } else {
+                // don't retry a source that isn't there for the rest of the session
+                if (!ctx->quiet)
+                    err_msg("collector %s failed, disabled\n", c->name);
+                c->enabled = 0;
+                c->failed = 1;
+            }
+        }
+        c->last_ns = now_ns() - start;
+        c->total_ns += c->last_ns;
+        c->total_bytes += c->last_bytes;
+        c->runs++;
+        PROF_COUNT(prof, PROF_KERNEL, lines, c->last_lines);
+        PROF_COUNT(prof, PROF_KERNEL, opens, c->last_opens);
+    }
+    PROF_END(prof, PROF_KERNEL, span);
+
+    return ret;
+}
+
+struct kernel_job {
+    struct meminfo_ctx *ctx;
+    struct meminfo *mem;
+    int ret;
+};
+
+static void *kernel_thread(void *arg)
+{
+    struct kernel_job *job = arg;
+
+    clock_gettime(CLOCK_MONOTONIC, &job->mem->kern_start);
+    job->ret = get_mem(job->ctx, job->mem);
+    clock_gettime(CLOCK_MONOTONIC, &job->mem->kern_end);
+    return NULL;
+}
+
+/*
+ * take one snapshot. the kernel sources and the per process smaps walk
+ * read disjoint files, so the kernel side runs on its own thread while
+ * the process scan runs here. falls back to serial when no thread.
+ */
+int get_snapshot(struct meminfo_ctx *ctx, struct meminfo *mem)
+{
+    struct kernel_job job = { ctx, mem, 0 };
+    pthread_t tid;
+    int threaded, ret;
+
+    threaded = (pthread_create(&tid, NULL, kernel_thread, &job) == 0);
+    if (!threaded)
+        err_msg("can't start kernel collector thread, collecting serially\n");
+
+    clock_gettime(CLOCK_MONOTONIC, &mem->proc_start);
+    mem->prof = ctx->prof;
+    ret = get_procmem(ctx->root, ctx->files, mem);
+    clock_gettime(CLOCK_MONOTONIC, &mem->proc_end);
+
+    if (threaded)
+        pthread_join(tid, NULL);
+    else
+        kernel_thread(&job);
+
+    if (ret < 0)
+        return ctx_error(ctx, ret, "process scan of %s" PROCDIR ": %s", ctx->root,
+                meminfo_strerror(ret));
+    return job.ret;
+}
+
+static double ts_ms(const struct timespec *ts)
+{
+    return ts->tv_sec * 1000.0 + ts->tv_nsec / 1000000.0;
+}
+
+void print_snapshot_skew(struct meminfo *mem)
+{
+    double ks = ts_ms(&mem->kern_start), ke = ts_ms(&mem->kern_end);
+    double ps = ts_ms(&mem->proc_start), pe = ts_ms(&mem->proc_end);
+
+    printf("\nsnapshot timing:\n");
+    printf("%15s%10.3f ms\n", "kernel:", ke - ks);
+    printf("%15s%10.3f ms\n", "process:", pe - ps);
+    printf("%15s%10.3f ms (start %+.3f ms, end %+.3f ms)\n", "skew:",
+            (ke > pe ? ke : pe) - (ks < ps ? ks : ps), ks - ps, ke - pe);
+}
@@ -1,9 +1,11 @@
 #ifndef MEMINFO_GETMEMINFO_H
 #define MEMINFO_GETMEMINFO_H
 
+#include <stddef.h>
+
 #include "getpss.h"
 
-#ifdef ANDROID
+/* sources, under the data root */
 #define PROC_MEMINFO "/proc/meminfo"
 #define VMALLOC_INFO "/proc/vmallocinfo"
 #define ION_MEM "/proc/ion/vmalloc_ion"
@@ -13,20 +15,76 @@
 #define CODEC_MEM "/sys/class/codec_mm/codec_mm_dump"
 #define CODEC_MEM_SCATTER "/sys/class/codec_mm/codec_mm_scatter_dump"
 #define PAGETYPE "/proc/pagetypeinfo"
-#else
-#define PROC_MEMINFO "test/meminfo"
-//#define VMALLOC_INFO "test/1.txt"
-#define VMALLOC_INFO "test/vmallocinfo"
-#define ION_MEM "test/vmalloc_ion"
-#define ZRAM_MEM "test/mem_used_total"
-#define GL_MEMTX "test/gpu_memory_tx"
-#define GL_MEM "test/gpu_memory"
-#define CODEC_MEM "test/codec_mm_dump"
-#define CODEC_MEM_SCATTER "test/codec_mm_scatter_dump"
-#define PAGETYPE "test/pagetypeinfo"
-#endif
-
-int get_mem(struct meminfo *mem);
-int print_meminfo(struct mem_item *mem);
+
+#define COLLECTOR_MAX_FILES 2
+
+/*
+ * one kernel memory source. files[] are tried in order by the parse
+ * function, which fills the nfields meminfo items starting at field.
+ */
+struct collector {
+    const char *name;
+    const char *files[COLLECTOR_MAX_FILES];
+    int (*parse)(struct collector *c, struct meminfo *mem);
+    int field;
+    int nfields;
+    int required;
+    int enabled;
+    int failed;
+    const char *root;       /* the context's data root */
+
+    /* cost accounting, last run and accumulated */
+    long long last_ns;
+    long long total_ns;
+    uint64_t last_bytes;
+    uint64_t total_bytes;
+    uint64_t last_lines;    /* with MEMINFO_PROFILE only */
+    uint64_t last_opens;
+    int runs;
+};
+
+/* a category of the kernel view print_meminfo draws, kB */
+struct mem_part {
+    const char *name;
+    int64_t kb;
+};
+
+/*
+ * where the memory went: pss, free and kernel used add up to the
+ * total, the kernel parts add up to kernel used.
+ */
+enum enum_part {
+    PART_PSS,
+    PART_FREE,
+    PART_KERNEL,
+    _NUM_TOP_PART,
+    PART_BUFFERS = _NUM_TOP_PART,
+    PART_SLAB,
+    PART_PAGE_TABLES,
+    PART_KERNEL_STACK,
+    PART_SHMEM,
+    PART_VMALLOC,
+    PART_ZRAM,
+    PART_ION,
+    PART_GPU,
+    PART_CODEC,
+    PART_UNKNOWN,
+    _NUM_PART
+};
+
+struct meminfo_ctx;
+
+int get_mem(struct meminfo_ctx *ctx, struct meminfo *mem);
+int get_snapshot(struct meminfo_ctx *ctx, struct meminfo *mem);
+void print_snapshot_skew(struct meminfo *mem);
+int collector_mask(struct meminfo_ctx *ctx, const char *spec);
+const char *collector_names(char *buf, size_t len);
+void print_collector_stats(struct meminfo_ctx *ctx);
+const char *mem_label(const struct mem_item *mem, int i);
+const char *codec_pool_name(int which);
+void mem_breakdown(const struct mem_item *mem, struct mem_part *part);
+struct out;
+int print_meminfo(struct out *o, struct mem_item *mem);
+void print_codec_mem(struct out *o, struct codec_info *codec, const struct codec_info *prev);
 
 #endif // MEMCOM_GETMEMINFO_H
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <inttypes.h>
+#include <limits.h>
 
 #include <errno.h>
 #include <ctype.h>
@@ -11,6 +12,7 @@
 
 #include "getpss.h"
 #include "error.h"
+#include "libmeminfo.h"
 
 char * heap_name(int which)
 {
@@ -38,14 +40,16 @@ char * heap_name(int which)
 
 
 #define INIT_PIDS 20
-static int get_pids(pid_t **pids_out, int *len) {
+static int get_pids(const char *root, pid_t **pids_out, int *len) {
     DIR *proc;
     struct dirent *dir;
     pid_t pid, *pids, *new_pids;
     size_t pids_count, pids_size;
     int error;
+    char path[PATH_MAX];
 
-    proc = opendir(PROCDIR);
+    snprintf(path, sizeof(path), "%s" PROCDIR, root);
+    proc = opendir(path);
     if (!proc)
         return errno;
 
@@ -91,19 +95,21 @@ static int get_pids(pid_t **pids_out, int *len) {
     return 0;
 }
 
-static void read_mapinfo(FILE *fp, struct stats_t *stats)
+/* stats by heap, and by mapped file into ft when it's given; lines read */
+static int read_mapinfo(FILE *fp, struct stats_t *stats, struct file_table *ft, int pid)
 {
     char line[1024];
     int len, nameLen;
     int skip, done = 0;
 
-    unsigned size = 0, rss = 0, pss = 0, swappable_pss = 0;
-    float sharing_proportion = 0.0;
-    unsigned shared_clean = 0, shared_dirty = 0;
-    unsigned private_clean = 0, private_dirty = 0;
+    uint64_t size = 0, rss = 0, pss = 0, swappable_pss = 0;
+    uint64_t swap = 0, swap_pss = 0, anonymous = 0, anon_huge = 0;
+    double sharing_proportion = 0.0;
+    uint64_t shared_clean = 0, shared_dirty = 0;
+    uint64_t private_clean = 0, private_dirty = 0;
     int is_swappable = 0;
-    unsigned referenced = 0;
-    unsigned temp;
+    uint64_t referenced = 0;
+    uint64_t temp;
 
     uint64_t start;
     uint64_t end = 0;
@@ -113,18 +119,22 @@ static void read_mapinfo(FILE *fp, struct stats_t *stats)
 
     int whichHeap = HEAP_UNKNOWN;
     int prevHeap = HEAP_UNKNOWN;
+    struct file_usage *file = NULL, *prevFile;
+    int lines = 1;
 
-    if(fgets(line, sizeof(line), fp) == 0) return;
+    if(fgets(line, sizeof(line), fp) == 0) return 0;
 
     while (!done) {
         prevHeap = whichHeap;
         prevEnd = end;
+        prevFile = file;
+        file = NULL;
         whichHeap = HEAP_UNKNOWN;
         skip = 0;
         is_swappable = 0;
 
         len = strlen(line);
-        if (len < 1) return;
+        if (len < 1) return lines;
         line[--len] = 0;
 
         if (sscanf(line, "%"SCNx64 "-%"SCNx64 " %*s %*x %*x:%*x %*d%n", &start, &end, &name_pos) != 2) {
@@ -197,36 +207,56 @@ static void read_mapinfo(FILE *fp, struct stats_t *stats)
             } else if (start == prevEnd && prevHeap == HEAP_SO) {
                 // bss section of a shared library.
                 whichHeap = HEAP_SO;
+                file = prevFile;
             }
+            // the name is gone with the next line, intern it now
+            if (ft != NULL && name[0] == '/')
+                file = files_lookup(ft, name, nameLen, pid);
         }
 
+        // SwapPss is new in 4.3, a missing line must not carry the last value
+        rss = 0;
+        pss = 0;
         shared_clean = 0;
         shared_dirty = 0;
         private_clean = 0;
         private_dirty = 0;
+        swap = 0;
+        swap_pss = 0;
+        anonymous = 0;
+        anon_huge = 0;
 
         while (1) {
             if (fgets(line, 1024, fp) == 0) {
                 done = 1;
                 break;
             }
+            lines++;
 
-            if (line[0] == 'S' && sscanf(line, "Size: %d kB", &temp) == 1) {
+            if (line[0] == 'S' && sscanf(line, "Size: %" SCNu64 " kB", &temp) == 1) {
                 size = temp;
-            } else if (line[0] == 'R' && sscanf(line, "Rss: %d kB", &temp) == 1) {
+            } else if (line[0] == 'R' && sscanf(line, "Rss: %" SCNu64 " kB", &temp) == 1) {
                 rss = temp;
-            } else if (line[0] == 'P' && sscanf(line, "Pss: %d kB", &temp) == 1) {
+            } else if (line[0] == 'P' && sscanf(line, "Pss: %" SCNu64 " kB", &temp) == 1) {
                 pss = temp;
-            } else if (line[0] == 'S' && sscanf(line, "Shared_Clean: %d kB", &temp) == 1) {
+            } else if (line[0] == 'S' && sscanf(line, "Shared_Clean: %" SCNu64 " kB", &temp) == 1) {
                 shared_clean = temp;
-            } else if (line[0] == 'S' && sscanf(line, "Shared_Dirty: %d kB", &temp) == 1) {
+            } else if (line[0] == 'S' && sscanf(line, "Shared_Dirty: %" SCNu64 " kB", &temp) == 1) {
                 shared_dirty = temp;
-            } else if (line[0] == 'P' && sscanf(line, "Private_Clean: %d kB", &temp) == 1) {
+            } else if (line[0] == 'P' && sscanf(line, "Private_Clean: %" SCNu64 " kB", &temp) == 1) {
                 private_clean = temp;
-            } else if (line[0] == 'P' && sscanf(line, "Private_Dirty: %d kB", &temp) == 1) {
+            } else if (line[0] == 'P' && sscanf(line, "Private_Dirty: %" SCNu64 " kB", &temp) == 1) {
                 private_dirty = temp;
-            } else if (line[0] == 'R' && sscanf(line, "Referenced: %d kB", &temp) == 1) {
+            } else if (line[0] == 'R' && sscanf(line, "Referenced: %" SCNu64 " kB", &temp) == 1) {
                 referenced = temp;
+            } else if (line[0] == 'A' && sscanf(line, "Anonymous: %" SCNu64 " kB", &temp) == 1) {
+                anonymous = temp;
+            } else if (line[0] == 'A' && sscanf(line, "AnonHugePages: %" SCNu64 " kB", &temp) == 1) {
+                anon_huge = temp;
+            } else if (line[0] == 'S' && sscanf(line, "Swap: %" SCNu64 " kB", &temp) == 1) {
+                swap = temp;
+            } else if (line[0] == 'S' && sscanf(line, "SwapPss: %" SCNu64 " kB", &temp) == 1) {
+                swap_pss = temp;
             } else if (sscanf(line, "%" SCNx64 "-%" SCNx64 " %*s %*x %*x:%*x %*d", &start, &end) == 2) {
                 // looks like a new mapping
                 // example: "10000000-10001000 ---p 10000000 00:00 0"
@@ -237,8 +267,10 @@ static void read_mapinfo(FILE *fp, struct stats_t *stats)
         if (!skip) {
             if (is_swappable && (pss > 0)) {
                 sharing_proportion = 0.0;
-                if ((shared_clean > 0) || (shared_dirty > 0)) {
-                    sharing_proportion = (pss - private_clean
+                // in floating point, the integer quotient was always 0 or 1
+                if (((shared_clean > 0) || (shared_dirty > 0))
+                        && pss > private_clean + private_dirty) {
+                    sharing_proportion = (double)(pss - private_clean
                             - private_dirty)/(shared_clean+shared_dirty);
                 }
                 swappable_pss = (sharing_proportion*shared_clean) + private_clean;
@@ -246,34 +278,57 @@ static void read_mapinfo(FILE *fp, struct stats_t *stats)
                 swappable_pss = 0;
 
             stats[whichHeap].pss += pss;
+            stats[whichHeap].rss += rss;
+            stats[whichHeap].swappablePss += swappable_pss;
+            stats[whichHeap].swap += swap;
+            stats[whichHeap].swapPss += swap_pss;
+            stats[whichHeap].anonymous += anonymous;
+            stats[whichHeap].anonHugePages += anon_huge;
 
             stats[whichHeap].privateDirty += private_dirty;
             stats[whichHeap].sharedDirty += shared_dirty;
             stats[whichHeap].privateClean += private_clean;
             stats[whichHeap].sharedClean += shared_clean;
 
+            if (file != NULL) {
+                file->stats.pss += pss;
+                file->stats.rss += rss;
+                file->stats.privateDirty += private_dirty;
+                file->stats.sharedDirty += shared_dirty;
+                file->stats.privateClean += private_clean;
+                file->stats.sharedClean += shared_clean;
+                file->stats.swappablePss += swappable_pss;
+                file->stats.swap += swap;
+                file->stats.swapPss += swap_pss;
+                file->stats.anonymous += anonymous;
+                file->stats.anonHugePages += anon_huge;
+            }
+
         }
     }
+    return lines;
 }
 
-static int load_maps(int pid, struct stats_t *stats)
+/* smaps lines read, -1 when it can't be opened */
+static int load_maps(const char *root, int pid, struct stats_t *stats, struct file_table *ft)
 {
-    char tmp[128];
+    char tmp[PATH_MAX];
     FILE *fp;
+    int lines;
 
-    sprintf(tmp, PROCDIR"/%d/smaps", pid);
+    snprintf(tmp, sizeof(tmp), "%s" PROCDIR "/%d/smaps", root, pid);
     fp = fopen(tmp, "r");
     if (fp == NULL) return -1;
-    read_mapinfo(fp, stats);
+    lines = read_mapinfo(fp, stats, ft, pid);
     fclose(fp);
 
-    return 0;
+    return lines;
 }
 
-void get_cmdline(int pid, char *cmd, int len)
+void get_cmdline(const char *root, int pid, char *cmd, int len)
 {
-    char path[256];
-    sprintf(path, PROCDIR"/%d/cmdline", pid);
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s" PROCDIR "/%d/cmdline", root, pid);
 
     FILE *fp = fopen(path, "r");
     if (fp != NULL) {
@@ -282,8 +337,8 @@ void get_cmdline(int pid, char *cmd, int len)
     }
 }
 
-int getprocname(pid_t pid, char *buf, int len) {
-    char filename[128];
+int getprocname(const char *root, pid_t pid, char *buf, int len) {
+    char filename[PATH_MAX];
     FILE *f;
     int rc = 0;
     static const char* unknown_cmdline = "<unknown>";
@@ -292,7 +347,7 @@ int getprocname(pid_t pid, char *buf, int len) {
         return -1;
     }
 
-    if (sprintf(filename, PROCDIR"/%d/cmdline", pid) < 0) {
+    if (snprintf(filename, sizeof(filename), "%s" PROCDIR "/%d/cmdline", root, pid) < 0) {
         rc = 1;
         goto exit;
     }
@@ -324,32 +379,89 @@ exit:
     return rc;
 }
 
-int get_pss(struct proc_info *proc)
+/*
+ * field 22 of /proc/<pid>/stat. together with the pid it names one
+ * process, a reused pid comes with another start time. the comm field
+ * may hold spaces and parens, so count from its closing paren.
+ */
+uint64_t get_starttime(const char *root, int pid)
+{
+    char path[PATH_MAX], buf[512], *p;
+    uint64_t start = 0;
+    int i;
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "%s" PROCDIR "/%d/stat", root, pid);
+    fp = fopen(path, "r");
+    if (fp == NULL)
+        return 0;
+    if (fgets(buf, sizeof(buf), fp) != NULL && (p = strrchr(buf, ')')) != NULL) {
+        // state is field 3, skip fields 3 to 21
+        for (i = 0; i < 20 && p != NULL; i++)
+            p = strchr(p + 1, ' ');
+        if (p != NULL)
+            start = strtoull(p + 1, NULL, 10);
+    }
+    fclose(fp);
+    return start;
+}
+
+static int proc_pss(const char *root, struct proc_info *proc, struct file_table *ft)
 {
     int ret;
     if (proc == NULL) return -1;
     memset(proc->stats, 0, sizeof(proc->stats));
-    ret = load_maps(proc->pid, proc->stats);
+    proc->starttime = get_starttime(root, proc->pid);
+    ret = load_maps(root, proc->pid, proc->stats, ft);
     return ret;
 }
 
-static void print_line(struct stats_t *tmp, char *name)
+int get_pss(const char *root, struct proc_info *proc)
 {
-    if (tmp->pss > 0)
-        printf("%15s%7d%7d%7d\n", name,
-                tmp->pss, tmp->privateDirty, tmp->privateClean);
+    return proc_pss(root, proc, NULL) < 0 ? -1 : 0;
+}
+
+static int has_pss(const struct proc_info *proc)
+{
+    int i;
+
+    // a process swapped out to zram still has a footprint
+    for (i = 0; i < _NUM_HEAP; i++)
+        if (proc->stats[i].pss != 0 || proc->stats[i].swapPss != 0)
+            return 1;
+    return 0;
+}
+
+static void print_line(struct out *o, struct stats_t *tmp, char *name)
+{
+    if (tmp->pss > 0 || tmp->swapPss > 0) {
+        out_pad(o, name, 15);
+        out_u64(o, tmp->pss, 7);
+        out_u64(o, tmp->privateDirty, 9);
+        out_u64(o, tmp->privateClean, 9);
+        out_u64(o, tmp->swapPss, 9);
+        out_u64(o, tmp->rss, 9);
+        out_u64(o, tmp->swappablePss, 11);
+        out_char(o, '\n');
+    }
 }
 
 static void pss_detail_add(struct stats_t *a, struct stats_t *b, struct stats_t *sum)
 {
         sum->pss = a->pss + b->pss;
+        sum->rss = a->rss + b->rss;
         sum->privateDirty = a->privateDirty + b->privateDirty ;
         sum->sharedDirty = a->sharedDirty + b->sharedDirty ;
         sum->privateClean = a->privateClean + b->privateClean ;
         sum->sharedClean = a->sharedClean + b->sharedClean ;
+        sum->swappablePss = a->swappablePss + b->swappablePss;
+        sum->swap = a->swap + b->swap;
+        sum->swapPss = a->swapPss + b->swapPss;
+        sum->anonymous = a->anonymous + b->anonymous;
+        sum->anonHugePages = a->anonHugePages + b->anonHugePages;
 }
 
-int print_pss(struct proc_info *proc)
+int print_pss(struct out *o, struct proc_info *proc)
 {
     int i;
     struct stats_t total, dalvik, othermap, unknown;
@@ -373,136 +485,237 @@ int print_pss(struct proc_info *proc)
             pss_detail_add(&tmp[i], &unknown, &unknown);
     }
 
-    printf("Applications Memory Usage %s(kB):\n", proc->cmdline);
-    printf("                  pss  Private  Private\n");
-    printf("                 Total    Dirty    Clean\n");
-    printf("                 -----   ------   ------\n");
-
-    print_line(&tmp[HEAP_NATIVE], heap_name(HEAP_NATIVE));
-    print_line(&dalvik, heap_name(HEAP_DALVIK));
-    print_line(&tmp[HEAP_STACK], heap_name(HEAP_STACK));
-    print_line(&tmp[HEAP_SO], heap_name(HEAP_SO));
-    print_line(&othermap,"other map");
-    print_line(&tmp[HEAP_GL], heap_name(HEAP_GL));
-    print_line(&unknown,"unkonw");
-    print_line(&total,"total");
+    out_str(o, "Applications Memory Usage ");
+    out_str(o, proc->cmdline);
+    out_str(o, "(kB):\n"
+            "                   pss  Private  Private  SwapPss      Rss  Swappable\n"
+            "                 Total    Dirty    Clean             Total        Pss\n"
+            "                 -----   ------   ------   ------   ------     ------\n");
+
+    print_line(o, &tmp[HEAP_NATIVE], heap_name(HEAP_NATIVE));
+    print_line(o, &dalvik, heap_name(HEAP_DALVIK));
+    print_line(o, &tmp[HEAP_STACK], heap_name(HEAP_STACK));
+    print_line(o, &tmp[HEAP_SO], heap_name(HEAP_SO));
+    print_line(o, &othermap,"other map");
+    print_line(o, &tmp[HEAP_GL], heap_name(HEAP_GL));
+    print_line(o, &unknown,"unkonw");
+    print_line(o, &total,"total");
+
+    out_str(o, "\n");
+    out_pad(o, "uss", 15);
+    out_u64(o, total.privateDirty + total.privateClean, 7);
+    out_str(o, "\n");
+    out_pad(o, "footprint", 15);
+    out_u64(o, total.pss + total.swapPss, 7);
+    out_str(o, "  (pss + SwapPss)\n");
 
     return 0;
 }
 
-static void stat_procmem(struct meminfo *meminfo)
+void stat_procmem(struct meminfo *meminfo)
 {
     int i, j;
     struct mem_item *stats = meminfo->pss_detail;
     struct proc_info **procs = meminfo->pss;
+    struct proc_info *proc;
+    const struct stats_t *s;
+    uint64_t sum[_NUM_HEAP] = { 0 };
+    uint64_t pss, uss, rss, swappss, swappable;
 
-    memset(stats, 0, sizeof(struct mem_item) * _NUM_HEAP);
-
+    // one pass over each process' heaps, every counter of a heap used while it's in cache
     for (i = 0; i < meminfo->num_procs; i++) {
-        struct stats_t *tmp = procs[i]->stats;
-
-        procs[i]->dalvikpss = tmp[HEAP_DALVIK].pss + tmp[HEAP_DALVIK_OTHER].pss;
-        procs[i]->nativepss = tmp[HEAP_NATIVE].pss;
-        procs[i]->totalpss = 0;
+        if ((proc = procs[i]) == NULL)
+            continue;
 
+        pss = uss = rss = swappss = swappable = 0;
         for (j = 0; j < _NUM_HEAP; j++) {
-            stats[j].num += tmp[j].pss;
-            strcpy(stats[j].name, heap_name(j));
-
-            // skip GL
+            s = &proc->stats[j];
+            sum[j] += s->pss;
+            // GL is accounted by the driver, keep it out of the process totals
             if (j == HEAP_GL)
                 continue;
-            procs[i]->totalpss += tmp[j].pss;
+            pss += s->pss;
+            uss += s->privateDirty + s->privateClean;
+            rss += s->rss;
+            swappss += s->swapPss;
+            swappable += s->swappablePss;
         }
+        proc->dalvikpss = proc->stats[HEAP_DALVIK].pss + proc->stats[HEAP_DALVIK_OTHER].pss;
+        proc->nativepss = proc->stats[HEAP_NATIVE].pss;
+        proc->totalpss = pss;
+        proc->totaluss = uss;
+        proc->totalrss = rss;
+        proc->totalswappss = swappss;
+        proc->totalswappable = swappable;
+    }
+
+    for (j = 0; j < _NUM_HEAP; j++) {
+        stats[j].num = sum[j];
+        strcpy(stats[j].name, heap_name(j));
     }
 }
 
 static int cmppss(const void *a, const void *b)
 {
-    return  (*((struct proc_info**)b))->totalpss - (*((struct proc_info**)a))->totalpss;
+    const struct proc_info *x = *(struct proc_info **)a;
+    const struct proc_info *y = *(struct proc_info **)b;
+
+    if (x == NULL || y == NULL)
+        return (x == NULL) - (y == NULL);
+    if (x->totalpss == y->totalpss)
+        return 0;
+    return x->totalpss < y->totalpss ? 1 : -1;
 }
 
 static int cmpcat(const void *a, const void *b)
 {
-    return (*(struct mem_item *)b).num - (*(struct mem_item *)a).num;
+    const struct mem_item *x = a, *y = b;
+
+    if (x->num == y->num)
+        return 0;
+    return x->num < y->num ? 1 : -1;
 }
 
-void print_procmem(struct meminfo *meminfo)
+void print_procmem(struct out *o, struct meminfo *meminfo)
 {
-    int i, total = 0;
+    int i;
+    uint64_t total = 0, swappss = 0;
     struct proc_info *tmp;
     struct tm *tm = &(meminfo->timestap);
+    char when[64];
+    PROF_SPAN(span);
 
+    PROF_BEGIN(meminfo->prof, span);
     qsort(meminfo->pss, meminfo->num_procs, sizeof(meminfo->pss[0]), cmppss);
+    PROF_END(meminfo->prof, PROF_SORT, span);
 
-    printf("Total PSS by process");
-    printf("(%02d-%02d-%02d %02d:%02d:%02d):\n", tm->tm_year + 1900, tm->tm_mon + 1,
-            tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec);
+    snprintf(when, sizeof(when), "(%02d-%02d-%02d %02d:%02d:%02d):\n", tm->tm_year + 1900,
+            tm->tm_mon + 1, tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec);
+    out_str(o, "Total PSS by process");
+    out_str(o, when);
+    out_str(o, "    pss KB     uss     rss  SwapPss  Swappable\n");
 
     for (i = 0; i < meminfo->num_procs; i++) {
         tmp = meminfo->pss[i];
         if (tmp == NULL)
             continue;
 
-        if (tmp->totalpss == 0)
+        if (tmp->totalpss == 0 && tmp->totalswappss == 0)
             continue;
 
-        if (getprocname(tmp->pid, tmp->cmdline, sizeof(tmp->cmdline)) < 0) {
-            free(meminfo->pss[i]);
-            meminfo->pss[i] = NULL;
-            continue;
-        }
         total += tmp->totalpss;
-
-        printf("%7d KB: %s (%d)\n", tmp->totalpss, tmp->cmdline, tmp->pid);
+        swappss += tmp->totalswappss;
+
+        out_u64(o, tmp->totalpss, 10);
+        out_u64(o, tmp->totaluss, 8);
+        out_u64(o, tmp->totalrss, 8);
+        out_u64(o, tmp->totalswappss, 9);
+        out_u64(o, tmp->totalswappable, 11);
+        out_str(o, "  ");
+        out_str(o, tmp->cmdline);
+        out_str(o, " (");
+        out_i64(o, tmp->pid, 0);
+        out_str(o, ")\n");
     }
-    printf("%10s: %7d KB\n", "total pss", total);
-
+    out_pad(o, "total pss", 10);
+    out_str(o, ": ");
+    out_u64(o, total, 7);
+    out_str(o, " KB\n");
+    out_pad(o, "swap pss", 10);
+    out_str(o, ": ");
+    out_u64(o, swappss, 7);
+    out_str(o, " KB\n");
+    out_pad(o, "footprint", 10);
+    out_str(o, ": ");
+    out_u64(o, total + swappss, 7);
+    out_str(o, " KB\n");
+
+    PROF_BEGIN(meminfo->prof, span);
     qsort(meminfo->pss_detail, _NUM_HEAP, sizeof(meminfo->pss_detail[0]), cmpcat);
+    PROF_END(meminfo->prof, PROF_SORT, span);
 
-    printf("\nTotal PSS by category:\n");
-    for (i = 0; i < _NUM_HEAP; i++)
-        printf("%7d KB: %s\n",
-                meminfo->pss_detail[i].num, meminfo->pss_detail[i].name);
+    out_str(o, "\nTotal PSS by category:\n");
+    for (i = 0; i < _NUM_HEAP; i++) {
+        out_u64(o, meminfo->pss_detail[i].num, 7);
+        out_str(o, " KB: ");
+        out_str(o, meminfo->pss_detail[i].name);
+        out_char(o, '\n');
+    }
 
 }
 
-int get_procmem(struct meminfo *meminfo)
+/*
+ * scan every process under root; MEMINFO_ENOPROC or MEMINFO_ENOMEM on
+ * failure. processes with memory come with their cmdline, one gone
+ * before it could be read is dropped. with ft the top mapped files go
+ * to meminfo too.
+ */
+int get_procmem(const char *root, struct file_table *ft, struct meminfo *meminfo)
 {
     pid_t *pids;
-    int i, num_procs = -1;
+    int i, lines, ret, num_procs = -1;
     struct proc_info **procs;
-
-    get_pids(&pids, &num_procs);
-    if (num_procs == -1)
-        err_quit("no process find\n");
+    struct prof *prof = meminfo->prof;
+    PROF_SPAN(span);
+
+    PROF_BEGIN(prof, span);
+    ret = get_pids(root, &pids, &num_procs);
+    PROF_COUNT(prof, PROF_PIDS, opens, 1);
+    PROF_END(prof, PROF_PIDS, span);
+    if (ret != 0 || num_procs <= 0)
+        return MEMINFO_ENOPROC;
     meminfo->pss = calloc(num_procs, sizeof(struct proc_info *));
-    if (meminfo->pss == NULL)
-        err_quit("calloc pss error\n");
+    if (meminfo->pss == NULL) {
+        free(pids);
+        return MEMINFO_ENOMEM;
+    }
     meminfo->num_procs = num_procs;
 
     procs = meminfo->pss;
+    if (ft != NULL)
+        files_begin(ft);
 
+    PROF_BEGIN(prof, span);
     for (i = 0; i < num_procs; i++) {
-        procs[i] = malloc(sizeof(struct proc_info));
+        procs[i] = calloc(1, sizeof(struct proc_info));
         if (procs[i] == NULL) continue;
         procs[i]->pid = pids[i];
-        get_pss(procs[i]);
+        // stat and smaps, then cmdline for the ones that stay
+        PROF_COUNT(prof, PROF_SMAPS, opens, 2);
+        if ((lines = proc_pss(root, procs[i], ft)) < 0 || !has_pss(procs[i]))
+            continue;
+        PROF_COUNT(prof, PROF_SMAPS, lines, lines);
+        PROF_COUNT(prof, PROF_SMAPS, opens, 1);
+        if (getprocname(root, pids[i], procs[i]->cmdline, sizeof(procs[i]->cmdline)) != 0) {
+            free(procs[i]);
+            procs[i] = NULL;
+        }
     }
+    PROF_END(prof, PROF_SMAPS, span);
+    free(pids);
 
+    PROF_BEGIN(prof, span);
     stat_procmem(meminfo);
+    PROF_END(prof, PROF_STAT, span);
 
+    if (ft != NULL) {
+        PROF_BEGIN(prof, span);
+        ret = files_collect(ft, meminfo);
+        PROF_END(prof, PROF_SORT, span);
+        return ret;
+    }
     return 0;
 }
 
-int get_pid(char *procn)
+int get_pid(const char *root, char *procn)
 {
     DIR *proc;
     struct dirent *dir;
     pid_t pid;
-    char cmdline[128];
+    char cmdline[128], path[PATH_MAX];
 
-    proc = opendir(PROCDIR);
+    snprintf(path, sizeof(path), "%s" PROCDIR, root);
+    proc = opendir(path);
     if (!proc)
         return -errno;
 
@@ -510,7 +723,7 @@ int get_pid(char *procn)
         if (sscanf(dir->d_name, "%d", &pid) < 1)
             continue;
 
-        if (getprocname(pid, cmdline, sizeof(cmdline)) < 0)
+        if (getprocname(root, pid, cmdline, sizeof(cmdline)) < 0)
             return -1;
         if (strstr(cmdline, procn)) {
             closedir(proc);
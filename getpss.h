@@ -1,12 +1,18 @@
 #ifndef MEMINFO_GETPSS_H
 #define MEMINFO_GETPSS_H
 
+/*
+ * every source is read under a data root laid out like the device, the
+ * host build defaults to the captured tree in test/
+ */
 #ifdef ANDROID
-#define PROCDIR "/proc"
+#define MEMINFO_ROOT ""
 #else
-#define PROCDIR "test"
+#define MEMINFO_ROOT "test"
 #endif
+#define PROCDIR "/proc"
 
+#include <stdint.h>
 #include <sys/types.h>
 #include <time.h>
 
@@ -38,9 +44,33 @@ enum enum_meminfo {
     MEMINFO_COUNT
 };
 
+/* all counters are kB unless noted, 64 bit so TB sized hosts don't wrap */
 struct mem_item {
     char name[64];
-    int num;
+    uint64_t num;
+};
+
+enum enum_codec_pool {
+    CODEC_POOL_CMA,
+    CODEC_POOL_RES,
+    CODEC_POOL_TVP,
+    CODEC_POOL_SYS,
+    CODEC_POOL_COUNT
+};
+
+#define CODEC_MAX_OWNERS 32
+
+/* one "owner: <name>:..." line group of codec_mm_dump, summed by name */
+struct codec_owner {
+    char name[32];
+    uint64_t bytes;
+    int cnt;
+};
+
+struct codec_info {
+    uint64_t pool[CODEC_POOL_COUNT];
+    struct codec_owner owner[CODEC_MAX_OWNERS];
+    int num_owners;
 };
 
 enum enum_heap {
@@ -65,38 +95,64 @@ enum enum_heap {
     _NUM_CORE_HEAP = HEAP_NATIVE+1
 };
 
+/* recordings store these in order, new counters go at the end */
 struct stats_t {
-    int pss;
-    int rss;
-    int privateDirty;
-    int sharedDirty;
-    int privateClean;
-    int sharedClean;
+    uint64_t pss;
+    uint64_t rss;
+    uint64_t privateDirty;
+    uint64_t sharedDirty;
+    uint64_t privateClean;
+    uint64_t sharedClean;
+    uint64_t swappablePss;  /* pss of file backed pages that could be dropped */
+    uint64_t swap;
+    uint64_t swapPss;       /* zram share, pss + swapPss is the real footprint */
+    uint64_t anonymous;
+    uint64_t anonHugePages;
 };
 
 struct proc_info {
     struct stats_t stats[_NUM_HEAP];
-    int dalvikpss;
-    int nativepss;
-    int otherpss;
-    int totalpss;
+    uint64_t dalvikpss;
+    uint64_t nativepss;
+    uint64_t otherpss;
+    uint64_t totalpss;
+    uint64_t totaluss;      /* private clean + dirty */
+    uint64_t totalrss;
+    uint64_t totalswappss;
+    uint64_t totalswappable;
+    uint64_t starttime;     /* clock ticks after boot, 0 when unknown */
     int pid;
     char cmdline[96];
 };
 
+struct file_usage;
+struct file_table;
+struct prof;
+
 struct meminfo {
     struct tm timestap;
+    /* CLOCK_MONOTONIC span of each half of the snapshot */
+    struct timespec kern_start, kern_end;
+    struct timespec proc_start, proc_end;
     struct proc_info **pss;
     int num_procs;
     struct mem_item pss_detail[_NUM_HEAP];
     struct mem_item item[MEMINFO_COUNT];
+    struct codec_info codec;
+    struct file_usage *files;   /* top mapped files by pss, see files.h */
+    int num_files;
+    struct prof *prof;          /* the context's while profiling, else NULL */
 };
 
-int get_procmem(struct meminfo *minfo);
-void print_procmem(struct meminfo *minfo);
-int print_pss(struct proc_info *proc);
-int get_pss(struct proc_info *proc);
-int get_pid(char *procn);
-int getprocname(pid_t pid, char *buf, int len);
+int get_procmem(const char *root, struct file_table *ft, struct meminfo *minfo);
+void stat_procmem(struct meminfo *minfo);
+struct out;
+void print_procmem(struct out *o, struct meminfo *minfo);
+int print_pss(struct out *o, struct proc_info *proc);
+int get_pss(const char *root, struct proc_info *proc);
+uint64_t get_starttime(const char *root, int pid);
+char *heap_name(int which);
+int get_pid(const char *root, char *procn);
+int getprocname(const char *root, pid_t pid, char *buf, int len);
 
 #endif
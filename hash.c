@@ -1,97 +1,497 @@
+#define _GNU_SOURCE     /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "error.h"
 #include "hash.h"
+#include "context.h"
+
+
+
+#define ALIGN8(x) (((x) + 7) & ~(size_t)7)
+#define ARENA_HDR ALIGN8(sizeof(struct state_header))
+#define REC(tr, i) ((struct hash *)((char *)(tr)->arena.hdr + ARENA_HDR + (size_t)(i) * (tr)->arena.record_size))
+#define REC_TS(h) ((int64_t *)((char *)(h) + ALIGN8(sizeof(struct hash))))
+#define REC_VAL(tr, h) ((int32_t *)(REC_TS(h) + (tr)->ring_cap))
 
+/*
+ * bytes per record besides the record at worst: 4 byte index slots
+ * just past HASH_LOAD_PCT, 16 in the sort buffer of lru_rebuild
+ */
+#define INDEX_BYTES 28
+/* record_alloc at the budget with no group left to evict */
+#define NO_ROOM (-2)
+/* kB of the budget left for what the rest of the tool grows within a tick */
+#define BUDGET_SLACK_KB 256
 
-struct hash htable[HASH_SIZE];
+/* heap behind each series, the total has none */
+static const int series_heap[_NUM_SERIES] = {
+    -1,
+    HEAP_NATIVE,
+    HEAP_DALVIK,
+    HEAP_DALVIK_OTHER,
+    HEAP_GL,
+    HEAP_ASHMEM,
+    HEAP_UNKNOWN,
+};
 
-static int list_size(struct proc *head)
+static const struct leak_threshold default_thresholds[_NUM_SERIES] = {
+    { 2.33, 2048 },     /* total */
+    { 2.33, 1024 },     /* native */
+    { 2.58, 4096 },     /* dalvik, GC churn makes it noisy */
+    { 2.33, 2048 },     /* dalvik other */
+    { 2.33, 4096 },     /* GL */
+    { 2.33, 2048 },     /* ashmem */
+    { 2.33, 2048 },     /* unknown */
+};
+
+const char *series_name(int which)
 {
-    int size = 0;
-    struct proc *tmp = head;
+    return which == SERIES_TOTAL ? "Total" : heap_name(series_heap[which]);
+}
 
-    while (tmp != NULL) {
-        size++;
-        tmp = tmp->next;
+/*
+ * seqlock style update markers: a record whose gen is odd on disk was
+ * being written when the tracker died, and its history can't be trusted.
+ */
+static void record_begin(struct hash *h)
+{
+    __atomic_store_n(&h->gen, h->gen + 1, __ATOMIC_RELEASE);
+}
+
+static void record_end(struct hash *h)
+{
+    __atomic_store_n(&h->gen, h->gen + 1, __ATOMIC_RELEASE);
+}
+
+/* ring position of the k-th sample counting from the oldest one */
+#define RING_IDX(tr, h, k) (((h)->first + (k)) % (tr)->ring_cap)
+#define RING_TS(tr, h, k) (REC_TS(h)[RING_IDX(tr, h, k)])
+#define RING_VAL(tr, h, n, k) (REC_VAL(tr, h)[(n) * (tr)->ring_cap + RING_IDX(tr, h, k)])
+
+static inline int sign32(int32_t a, int32_t b)
+{
+    return (a > b) - (a < b);
+}
+
+/*
+ * sum of sign(d - col[k]) over len ring slots from slot from on. the
+ * order doesn't matter, so it walks the (at most two) runs of slots
+ * without a modulo per sample.
+ */
+static int sign_sum(const int32_t *col, unsigned int from, unsigned int len,
+        unsigned int cap, int32_t d)
+{
+    unsigned int k, end = from + len;
+    int s = 0;
+
+    if (end > cap) {
+        for (k = 0; k < end - cap; k++)
+            s += sign32(d, col[k]);
+        end = cap;
     }
+    for (k = from; k < end; k++)
+        s += sign32(d, col[k]);
+    return s;
+}
 
-    return size;
+/* the most samples S covers, a short ring bounds it too */
+static unsigned int mk_window(const struct tracker *tr)
+{
+    return tr->ring_cap < MK_WINDOW ? tr->ring_cap : MK_WINDOW;
 }
 
-static int leak_check_process(struct hash *htable)
+/* samples S covers in h, the newest ones */
+static unsigned int mk_len(const struct tracker *tr, const struct hash *h)
 {
-    int *sample, count, i = 0, size;
-    int tp, gap, ret = 0;
-    float hit;
-    struct proc *tmp, *head = htable->head;
+    return h->len < mk_window(tr) ? h->len : mk_window(tr);
+}
 
-    if (head == NULL)
-        return -1;
-    // not enouph samples
-    if ((size = list_size(head)) < 4)
-        return -1;
+/*
+ * recompute the least squares sums from the ring with t0 moved to the
+ * oldest sample. done every ring_cap samples, it keeps x small and drops
+ * the rounding error the add/remove updates pile up. S is exact.
+ */
+static void trend_rebase(struct tracker *tr, struct hash *h)
+{
+    struct trend *t = &h->trend;
+    unsigned int k;
+    int n;
+    double x, y;
 
-    gap = (head->pss - htable->init_pss)/1024;
-    if (gap > GAP_SIZE)
-        ret = 2;
-
-    sample = calloc(size, sizeof(int));
-    while(head) {
-        tmp = head->next;
-        tp = head->pss;
-        count = 0;
-        hit = 0;
-
-        while(tmp) {
-            count++;
-            if (tp > tmp->pss)
-                hit++;
-            tmp = tmp->next;
-        }
-        if (count <= 3) break;
+    t->sx = t->sxx = 0;
+    for (n = 0; n < _NUM_SERIES; n++)
+        t->sy[n] = t->syy[n] = t->sxy[n] = 0;
+    t->since_rebase = 0;
+    if (h->len == 0)
+        return;
 
-        if (hit/count > 0.8) {
-            if (i >= size) break;
-            sample[i] = 1;
+    t->t0 = RING_TS(tr, h, 0);
+    for (k = 0; k < h->len; k++) {
+        x = (RING_TS(tr, h, k) - t->t0) / 1000.0;
+        t->sx += x;
+        t->sxx += x * x;
+        for (n = 0; n < _NUM_SERIES; n++) {
+            y = RING_VAL(tr, h, n, k);
+            t->sy[n] += y;
+            t->syy[n] += y * y;
+            t->sxy[n] += x * y;
         }
-        i++;
+    }
+}
+
+static void trend_update(struct tracker *tr, struct hash *h, unsigned int idx, int dir)
+{
+    struct trend *t = &h->trend;
+    double x = (REC_TS(h)[idx] - t->t0) / 1000.0, y;
+    int n;
+
+    t->sx += dir * x;
+    t->sxx += dir * x * x;
+    for (n = 0; n < _NUM_SERIES; n++) {
+        y = REC_VAL(tr, h)[n * tr->ring_cap + idx];
+        t->sy[n] += dir * y;
+        t->syy[n] += dir * y * y;
+        t->sxy[n] += dir * x * y;
+    }
+}
+
+static void ring_reset(struct hash *h)
+{
+    h->first = h->len = 0;
+    memset(&h->trend, 0, sizeof(h->trend));
+}
+
+/* value of series n, clamped to what the ring can hold relative to base */
+static int32_t ring_delta(const struct hash *h, int n, uint64_t v)
+{
+    int64_t d = (int64_t)v - (int64_t)h->base[n];
+
+    if (d > INT32_MAX)
+        return INT32_MAX;
+    if (d < INT32_MIN)
+        return INT32_MIN;
+    return d;
+}
+
+/*
+ * append a sample, evicting the oldest when full. the trend sums move in
+ * O(1). S covers the newest MK_WINDOW samples: the oldest of them leaves
+ * and the new one comes in, each signed against the rest, so a sample
+ * costs 2 * MK_WINDOW compares per series whatever the ring size.
+ */
+static void ring_push(struct tracker *tr, struct hash *h, int64_t ts, const uint64_t *v)
+{
+    struct trend *t = &h->trend;
+    unsigned int idx, keep, from, w = mk_window(tr), len;
+    int32_t *col, d;
+    int n;
+
+    if (h->len == 0) {
+        t->t0 = ts;
+        for (n = 0; n < _NUM_SERIES; n++)
+            h->base[n] = v[n];
+    }
 
-        head = head->next;
+    // the samples S keeps, after its oldest when the window is full
+    len = mk_len(tr, h);
+    keep = len < w ? len : w - 1;
+    from = RING_IDX(tr, h, h->len - keep);
+    for (n = 0; n < _NUM_SERIES; n++) {
+        col = REC_VAL(tr, h) + n * tr->ring_cap;
+        if (keep < len)
+            t->s[n] += sign_sum(col, from, keep, tr->ring_cap, col[RING_IDX(tr, h, h->len - len)]);
+        t->s[n] += sign_sum(col, from, keep, tr->ring_cap, ring_delta(h, n, v[n]));
     }
 
-    hit = 0;
-    for (i = 0; i < size; i++)
-        if (sample[i] == 1)
-            hit++;
-    free(sample);
+    if (h->len == tr->ring_cap) {
+        trend_update(tr, h, h->first, -1);
+        h->first = (h->first + 1) % tr->ring_cap;
+        h->len--;
+    }
+
+    idx = RING_IDX(tr, h, h->len);
+    for (n = 0; n < _NUM_SERIES; n++) {
+        col = REC_VAL(tr, h) + n * tr->ring_cap;
+        d = ring_delta(h, n, v[n]);
+        col[idx] = d;
+    }
+    REC_TS(h)[idx] = ts;
+    h->len++;
+    trend_update(tr, h, idx, 1);
+
+    if (++t->since_rebase >= tr->ring_cap)
+        trend_rebase(tr, h);
+}
+
+static uint64_t ring_value(struct tracker *tr, const struct hash *h, int n, unsigned int k)
+{
+    return h->base[n] + RING_VAL(tr, h, n, k);
+}
+
+/* two sided 95% student t for df 1..30, 1.96 beyond */
+static double t975(int df)
+{
+    static const double t[] = {
+        12.71, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    };
+    if (df < 1)
+        return t[0];
+    return df <= 30 ? t[df - 1] : 1.96;
+}
+
+/*
+ * least squares growth of series n against the sample timestamps, so
+ * irregular or adaptive intervals weigh in by time and not by count.
+ * returns -1 when the window has no spread in time.
+ */
+static int trend_rate(struct tracker *tr, const struct hash *h, int n, struct leak_rate *r)
+{
+    const struct trend *t = &h->trend;
+    double len = h->len, sxx, sxy, syy, b, s2, se;
+
+    r->rate = r->lo = r->hi = 0;
+    r->tto = -1;
+    if (h->len < 3)
+        return -1;
+
+    // centered sums
+    sxx = t->sxx - t->sx * t->sx / len;
+    sxy = t->sxy[n] - t->sx * t->sy[n] / len;
+    syy = t->syy[n] - t->sy[n] * t->sy[n] / len;
+    if (sxx <= 0)
+        return -1;
+
+    b = sxy / sxx;
+    s2 = (syy - b * sxy) / (len - 2);
+    se = s2 > 0 ? sqrt(s2 / sxx) : 0;
 
-    if (hit/size > 0.8)
-        ret++;
+    r->rate = b * 3600;
+    r->lo = (b - t975(h->len - 2) * se) * 3600;
+    r->hi = (b + t975(h->len - 2) * se) * 3600;
+    if (tr->free_kb > 0 && r->rate > 0)
+        r->tto = tr->free_kb / r->rate;
+    return 0;
+}
+
+/* normal score of S for series n, ties not corrected */
+static double trend_z(const struct tracker *tr, const struct hash *h, int n)
+{
+    double len = mk_len(tr, h), var = len * (len - 1) * (2 * len + 5) / 18;
+    int64_t s = h->trend.s[n];
+
+    if (len < 2 || var <= 0)
+        return 0;
+    if (s > 0)
+        return (s - 1) / sqrt(var);
+    if (s < 0)
+        return (s + 1) / sqrt(var);
+    return 0;
+}
+
+/*
+ * bit n set for every series trending up significantly, with the whole
+ * confidence interval of its rate above the threshold. -1 without
+ * enough samples, or while the ring fills and covers less than
+ * LEAK_MIN_SPAN. O(1) per series, it only reads the running state.
+ */
+static int leak_check_process(struct tracker *tr, struct hash *h)
+{
+    struct leak_rate r;
+    int n, ret = 0;
+
+    if (h->len < (tr->ring_cap < LEAK_MIN_SAMPLES ? tr->ring_cap : LEAK_MIN_SAMPLES))
+        return -1;
+    if (h->len < tr->ring_cap && RING_TS(tr, h, h->len - 1) - RING_TS(tr, h, 0) < LEAK_MIN_SPAN)
+        return -1;
+
+    for (n = 0; n < _NUM_SERIES; n++) {
+        if (trend_z(tr, h, n) < tr->thresholds[n].min_z)
+            continue;
+        if (trend_rate(tr, h, n, &r) < 0 || r.lo < tr->thresholds[n].min_rate)
+            continue;
+        ret |= 1 << n;
+    }
     return ret;
 }
 
-static void print_hash(struct hash *hit)
+static void print_tto(double hours)
+{
+    if (hours < 0)
+        printf("time to oom unknown");
+    else if (hours < 48)
+        printf("oom in %.1f h", hours);
+    else
+        printf("oom in %.1f days", hours / 24);
+}
+
+static void print_hash(struct tracker *tr, struct hash *hit, int leak)
 {
-    struct proc *head;
-    int i = 0;
+    struct leak_rate r;
+    double span;
+    int n;
 
     if (hit == NULL) return;
-    head = hit->head;
 
-    printf("process %s (%d) may have memory leak:\n",
-            hit->cmdline, head->pid);
-    printf("init %d, min %d, max %d samples(%d):",
-            hit->init_pss, hit->min_pss, hit->max_pss, hit->count);
+    span = (RING_TS(tr, hit, hit->len - 1) - RING_TS(tr, hit, 0)) / 3600000.0;
+    if (hit->kind == RECORD_GROUP)
+        printf("processes %s (%u running, %u restarts) may have memory leak, %u samples over %.1f h:\n",
+                hit->cmdline, hit->ninst, hit->restarts, hit->len, span);
+    else
+        printf("process %s (%d) may have memory leak, %u samples over %.1f h:\n",
+                hit->cmdline, hit->pid, hit->len, span);
+    for (n = 0; n < _NUM_SERIES; n++) {
+        if (!(leak & (1 << n)))
+            continue;
+        trend_rate(tr, hit, n, &r);
+        printf("%15s: %+.0f kB/h (%+.0f..%+.0f), ",
+                series_name(n), r.rate, r.lo, r.hi);
+        if (hit->kind == RECORD_GROUP)
+            printf("grown %+" PRId64 " kB, ", (int64_t)(ring_value(tr, hit, n, hit->len - 1)
+                        - ring_value(tr, hit, n, 0)));
+        else
+            printf("now %" PRIu64 " kB, ", ring_value(tr, hit, n, hit->len - 1));
+        printf("z %.2f, ", trend_z(tr, hit, n));
+        print_tto(r.tto);
+        printf("\n");
+    }
+    if (hit->kind == RECORD_INSTANCE)
+        printf("init %" PRIu64 ", min %" PRIu64 ", max %" PRIu64 " samples(%d)\n",
+                hit->init_pss, hit->min_pss, hit->max_pss, hit->count);
+}
+
+static void leak_event_fill(struct tracker *tr, struct hash *h, int leak,
+        struct leak_event *ev)
+{
+    int n;
+
+    memset(ev, 0, sizeof(*ev));
+    ev->group = h->kind == RECORD_GROUP;
+    ev->cmdline = h->cmdline;
+    ev->pid = ev->group ? -1 : h->pid;
+    ev->leak = leak;
+    ev->samples = h->len;
+    ev->hours = (RING_TS(tr, h, h->len - 1) - RING_TS(tr, h, 0)) / 3600000.0;
+    for (n = 0; n < _NUM_SERIES; n++)
+        trend_rate(tr, h, n, &ev->rate[n]);
+}
+
+/* hand a verdict to the report callback, or print it */
+static void report_leak(struct tracker *tr, struct hash *h, int leak)
+{
+    struct leak_event ev;
 
-    while(head) {
-        if ((++i)%10 == 0) printf("\n");
-        printf("\t%d", head->pss);
-        head = head->next;
+    if (tr->report == NULL) {
+        print_hash(tr, h, leak);
+        return;
     }
-    printf("\n");
+
+    leak_event_fill(tr, h, leak, &ev);
+    tr->report(tr->report_arg, &ev);
+}
+
+static void report_restart(struct tracker *tr, struct hash *g)
+{
+    struct leak_event ev;
+
+    if (tr->report == NULL) {
+        printf("process %s restarted, pid %d -> %d, total pss was %" PRIu64
+                " kB, memory reset not counted as growth\n",
+                g->cmdline, g->gone_pid, g->start_pid, g->gone_pss);
+        return;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.restart = 1;
+    ev.cmdline = g->cmdline;
+    ev.pid = g->gone_pid;
+    ev.new_pid = g->start_pid;
+    tr->report(tr->report_arg, &ev);
+}
+
+/*
+ * report a leaking process when it starts leaking, when another heap
+ * joins in, or when its rate rose noticeably, and at most once per
+ * LEAK_REPORT_INTERVAL otherwise.
+ */
+static void leak_report(struct tracker *tr, struct hash *h, int leak)
+{
+    struct leak_rate r;
+    int64_t now = RING_TS(tr, h, h->len - 1);
+
+    trend_rate(tr, h, SERIES_TOTAL, &r);
+    if (h->reported == (uint32_t)leak
+            && now - h->report_ms < LEAK_REPORT_INTERVAL
+            && r.rate * 100 <= h->report_rate * (100 + LEAK_REPORT_RISE_PCT))
+        return;
+
+    report_leak(tr, h, leak);
+    record_begin(h);
+    h->report_ms = now;
+    h->report_rate = r.rate;
+    h->reported = leak;
+    record_end(h);
+}
+
+/*
+ * growth thresholds in kB/hour, "2048" for every series or a list like
+ * "total=4096,native=512".
+ */
+int hash_set_threshold(struct meminfo_ctx *ctx, const char *spec)
+{
+    struct tracker *tr = &ctx->tr;
+    const char *p = spec;
+    char *end;
+    double rate;
+    int n, len;
+
+    while (*p) {
+        end = strchr(p, '=');
+        if (end == NULL || (strchr(p, ',') && strchr(p, ',') < end)) {
+            rate = strtod(p, &end);
+            if (end == p || rate < 0)
+                return -1;
+            for (n = 0; n < _NUM_SERIES; n++)
+                tr->thresholds[n].min_rate = rate;
+        } else {
+            len = end - p;
+            for (n = 0; n < _NUM_SERIES; n++)
+                if ((int)strlen(series_name(n)) == len && !strncasecmp(series_name(n), p, len))
+                    break;
+            if (n == _NUM_SERIES)
+                return -1;
+            p = end + 1;
+            rate = strtod(p, &end);
+            if (end == p || rate < 0)
+                return -1;
+            tr->thresholds[n].min_rate = rate;
+        }
+        if (*end == ',')
+            end++;
+        else if (*end)
+            return -1;
+        p = end;
+    }
+    return 0;
+}
+
+void hash_set_free(struct meminfo_ctx *ctx, uint64_t kb)
+{
+    ctx->tr.free_kb = kb;
 }
 
 static unsigned int hash_index(const char *str)
@@ -105,223 +505,1295 @@ static unsigned int hash_index(const char *str)
     return hash;
 }
 
-int hash_insert_item(struct proc_info *item)
+static int hash_grow(struct tracker *tr)
 {
-    int i;
-    struct proc *pinfo, **head;
-    struct hash *hit = NULL;
-
-    if (item == NULL) return -1;
-    if (item->totalpss == 0) {
-        for (i = 0; i < _NUM_HEAP; i++) {
-            // skip GL
-            if (i == HEAP_GL)
-                continue;
-            item->totalpss += item->stats[i].pss;
-        }
+    uint32_t *slots, *old = tr->htable.slots;
+    unsigned int i, j, cap = tr->htable.cap ? tr->htable.cap * 2 : HASH_INIT_SIZE;
 
-        if (item->totalpss == 0) {
-            err_msg("hash insert %s total pss is 0, skip\n", item->cmdline);
+    slots = calloc(cap, sizeof(uint32_t));
+    if (slots == NULL)
+        return -1;
+
+    for (i = 0; i < tr->htable.cap; i++) {
+        if (old[i] == 0)
+            continue;
+        j = REC(tr, old[i] - 1)->hval & (cap - 1);
+        while (slots[j] != 0)
+            j = (j + 1) & (cap - 1);
+        slots[j] = old[i];
+    }
+
+    free(old);
+    tr->htable.slots = slots;
+    tr->htable.cap = cap;
+    return 0;
+}
+
+/* slots for n records before a state file is indexed, not a rehash per doubling */
+static int hash_reserve(struct tracker *tr, uint32_t n)
+{
+    while ((uint64_t)n * 100 > (uint64_t)tr->htable.cap * HASH_LOAD_PCT)
+        if (hash_grow(tr) < 0)
             return -1;
-        }
+    return 0;
+}
+
+static int hash_index_record(struct tracker *tr, uint32_t rec)
+{
+    unsigned int i;
+
+    if ((tr->htable.size + 1) * 100 > tr->htable.cap * HASH_LOAD_PCT)
+        if (hash_grow(tr) < 0)
+            return -1;
+
+    i = REC(tr, rec)->hval & (tr->htable.cap - 1);
+    while (tr->htable.slots[i] != 0)
+        i = (i + 1) & (tr->htable.cap - 1);
+    tr->htable.slots[i] = rec + 1;
+    tr->htable.size++;
+    return 0;
+}
+
+static int64_t clock_ms(clockid_t id)
+{
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static size_t record_bytes(struct tracker *tr)
+{
+    return ALIGN8(ALIGN8(sizeof(struct hash))
+            + tr->ring_cap * (sizeof(int64_t) + _NUM_SERIES * sizeof(int32_t)));
+}
+
+static size_t arena_size(struct tracker *tr, uint32_t nrecords)
+{
+    return ARENA_HDR + (size_t)nrecords * tr->arena.record_size;
+}
+
+/* room for n records, a state file grows or shrinks along */
+static int arena_resize(struct tracker *tr, uint32_t n)
+{
+    size_t len = arena_size(tr, n);
+    void *p;
+
+    if (tr->arena.fd >= 0 && len > tr->arena.len && ftruncate(tr->arena.fd, len) < 0)
+        return -1;
+    p = mremap(tr->arena.hdr, tr->arena.len, len, MREMAP_MAYMOVE);
+    if (p == MAP_FAILED)
+        return -1;
+    if (tr->arena.fd >= 0 && len < tr->arena.len && ftruncate(tr->arena.fd, len) < 0)
+        return -1;
+
+    tr->arena.hdr = p;
+    tr->arena.len = len;
+    tr->arena.hdr->nrecords = n;
+    return 0;
+}
+
+/* make room for at least one more record, within the budget if there's one */
+static int arena_grow(struct tracker *tr)
+{
+    uint32_t n = tr->arena.hdr->nrecords * 2;
+
+    if (tr->budget_kb > 0 && n > tr->max_records)
+        n = tr->max_records;
+    if (n <= tr->arena.hdr->nrecords)
+        n = tr->arena.hdr->nrecords + 1;
+    return arena_resize(tr, n);
+}
+
+/* resident set of this process, kB, from /proc/self/statm */
+static uint64_t self_rss(void)
+{
+    unsigned long long size, resident = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+
+    if (fp == NULL)
+        return 0;
+    if (fscanf(fp, "%llu %llu", &size, &resident) != 2)
+        resident = 0;
+    fclose(fp);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static uint32_t records_live(struct tracker *tr)
+{
+    return tr->arena.hdr->used - tr->nfree;
+}
+
+/*
+ * bytes the free records of an anonymous arena may keep resident:
+ * record_free gives back the pages past the header, but not the
+ * partial ones at either end
+ */
+static size_t arena_free_bytes(struct tracker *tr)
+{
+    size_t keep = sizeof(struct hash) + 2 * sysconf(_SC_PAGESIZE);
+
+    if (tr->arena.hdr == NULL || tr->arena.fd >= 0)
+        return 0;
+    return (size_t)tr->nfree * (keep < tr->arena.record_size ? keep : tr->arena.record_size);
+}
+
+/*
+ * size the record cap from what the budget leaves the tracker. the rest
+ * of the tool, libc and the collection of a tick included, is the most
+ * the resident set ever was beyond the tracker state at its largest:
+ * measured before the arena exists, then again at every tick as it
+ * grows with the processes collected. the state is counted, not read:
+ * the header, the index, the live records whole and the free ones. a
+ * state file may have all of its records mapped, fault-around takes
+ * the free ones along, so it counts whole and is cut down to the cap.
+ */
+static void budget_fit(struct tracker *tr)
+{
+    uint64_t rss = self_rss(), state = 0, room;
+    size_t fixed = ARENA_HDR + tr->htable.cap * sizeof(uint32_t) + arena_free_bytes(tr);
+    uint32_t n;
+
+    if (tr->arena.hdr != NULL) {
+        n = tr->arena.fd >= 0 ? tr->arena.hdr->nrecords : records_live(tr);
+        state = (fixed + (size_t)n * tr->arena.record_size) / 1024;
     }
 
-    pinfo = (struct proc *) malloc(sizeof(struct proc));
-    if (pinfo == NULL)
-        err_sys("malloc error \n");
+    if (rss > state && rss - state > tr->overhead_kb)
+        tr->overhead_kb = rss - state;
+    room = tr->budget_kb > tr->overhead_kb + BUDGET_SLACK_KB
+        ? (tr->budget_kb - tr->overhead_kb - BUDGET_SLACK_KB) * 1024 : 0;
+    room = room > fixed ? room - fixed : 0;
+    room /= record_bytes(tr) + INDEX_BYTES;
+    tr->max_records = room < UINT32_MAX ? room : UINT32_MAX;
+}
+
+static uint32_t init_records(struct tracker *tr)
+{
+    if (tr->budget_kb > 0 && tr->max_records < STATE_INIT_RECORDS)
+        return tr->max_records;
+    return STATE_INIT_RECORDS;
+}
 
-    pinfo->pid = item->pid;
-    pinfo->pss = item->totalpss;
+static void arena_init(struct tracker *tr, struct state_header *hdr, uint32_t nrecords)
+{
+    memset(hdr, 0, ARENA_HDR);
+    memcpy(hdr->magic, STATE_MAGIC, sizeof(hdr->magic));
+    hdr->version = STATE_VERSION;
+    hdr->ring_cap = tr->ring_cap;
+    hdr->record_size = tr->arena.record_size;
+    hdr->nrecords = nrecords;
+    hdr->clock_ms = clock_ms(CLOCK_MONOTONIC);
+    hdr->wall_ms = clock_ms(CLOCK_REALTIME);
+}
 
-    i = hash_index(item->cmdline) % HASH_SIZE;
-    // first insert
-    if (htable[i].cmdline == NULL) {
-        htable[i].cmdline = strdup(item->cmdline);
-        head = &htable[i].head;
-        hit = &htable[i];
-        hit->init_pss = hit->min_pss = hit->max_pss = pinfo->pss;
+/* anonymous arena, used when there's no state file */
+static int arena_anon(struct tracker *tr)
+{
+    void *p;
+
+    tr->arena.record_size = record_bytes(tr);
+    tr->arena.len = arena_size(tr, init_records(tr));
+    p = mmap(NULL, tr->arena.len, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return -1;
+    tr->arena.hdr = p;
+    arena_init(tr, tr->arena.hdr, init_records(tr));
+    tr->clock_offset = 0;
+    return 0;
+}
+
+#define REC_ID(tr, h) ((uint32_t)(((char *)(h) - (char *)REC(tr, 0)) / (tr)->arena.record_size))
+
+static int evict(struct tracker *tr, uint32_t pin);
+
+/*
+ * a cleared record, from the free list or the end of the arena. at the
+ * budget groups other than pin are evicted to make room, NO_ROOM when
+ * there's none, the budget is never exceeded. the free list goes first,
+ * so the arena only grows with no free record and used stays within the
+ * cap too. -1 when the arena can't grow.
+ */
+static int64_t record_alloc(struct tracker *tr, uint32_t pin)
+{
+    uint32_t rec;
+
+    if (tr->arena.hdr == NULL && arena_anon(tr) < 0)
+        return -1;
+
+    while (tr->budget_kb > 0 && records_live(tr) >= tr->max_records)
+        if (evict(tr, pin) < 0)
+            return NO_ROOM;
+
+    if (tr->free_head != 0) {
+        rec = tr->free_head - 1;
+        tr->free_head = REC(tr, rec)->group;
+        tr->nfree--;
     } else {
-        if (!strcmp(item->cmdline, htable[i].cmdline)) {
-            head = &htable[i].head;
-            hit = &htable[i];
-        } else { //conflict
-            struct hash  *tmp = htable[i].next;
-
-            while(tmp != NULL) {
-                if (!strcmp(item->cmdline, tmp->cmdline)) {
-                    hit = tmp;
-                    break;
-                }
-                tmp = tmp->next;
-            }
-
-            // not found
-            if (hit == NULL) {
-                hit = malloc(sizeof(struct hash));
-                if (hit == NULL) err_sys("malloc hit error\n");
-                hit->head = NULL;
-                hit->cmdline = strdup(item->cmdline);
-                hit->init_pss = hit->min_pss = hit->max_pss = pinfo->pss;
-                // insert into the hash table
-                hit->next = htable[i].next;
-                htable[i].next = hit;
-            }
-
-            head = &(hit->head);
+        if (tr->arena.hdr->used == tr->arena.hdr->nrecords && arena_grow(tr) < 0)
+            return -1;
+        rec = tr->arena.hdr->used++;
+    }
+    memset(REC(tr, rec), 0, sizeof(struct hash));
+    return rec;
+}
+
+/*
+ * under a budget the history pages of a free record go back to the
+ * system, only the page with the free list link stays resident. a
+ * state file is paid for whole instead, see arena_compact.
+ */
+static void record_free(struct tracker *tr, uint32_t rec)
+{
+    struct hash *h = REC(tr, rec);
+    uintptr_t page = sysconf(_SC_PAGESIZE), from, to;
+
+    memset(h, 0, sizeof(struct hash));
+    h->group = tr->free_head;
+    tr->free_head = rec + 1;
+    tr->nfree++;
+
+    if (tr->budget_kb == 0 || tr->arena.fd >= 0)
+        return;
+    from = ((uintptr_t)h + sizeof(struct hash) + page - 1) & ~(page - 1);
+    to = ((uintptr_t)h + tr->arena.record_size) & ~(page - 1);
+    if (to > from)
+        madvise((void *)from, to - from, MADV_DONTNEED);
+}
+
+/* take group rec off its eviction list */
+static void lru_unlink(struct tracker *tr, uint32_t rec)
+{
+    struct hash *g = REC(tr, rec);
+    struct evict_list *l = &tr->lru[g->kept];
+
+    if (g->older != 0)
+        REC(tr, g->older - 1)->newer = g->newer;
+    else
+        l->oldest = g->newer;
+    if (g->newer != 0)
+        REC(tr, g->newer - 1)->older = g->older;
+    else
+        l->newest = g->older;
+    g->older = g->newer = 0;
+}
+
+/*
+ * put group rec on eviction list kept, in seen_ms order. it's mostly
+ * just been seen, so the walk from the newest end stops right away.
+ */
+static void lru_insert(struct tracker *tr, uint32_t rec, int kept)
+{
+    struct hash *g = REC(tr, rec);
+    struct evict_list *l = &tr->lru[kept];
+    uint32_t at = l->newest;
+
+    while (at != 0 && REC(tr, at - 1)->seen_ms > g->seen_ms)
+        at = REC(tr, at - 1)->older;
+
+    g->kept = kept;
+    g->older = at;
+    if (at != 0) {
+        g->newer = REC(tr, at - 1)->newer;
+        REC(tr, at - 1)->newer = rec + 1;
+    } else {
+        g->newer = l->oldest;
+        l->oldest = rec + 1;
+    }
+    if (g->newer != 0)
+        REC(tr, g->newer - 1)->older = rec + 1;
+    else
+        l->newest = rec + 1;
+}
+
+/* group rec was seen again, it moves to the newest end of its list */
+static void lru_touch(struct tracker *tr, uint32_t rec)
+{
+    lru_unlink(tr, rec);
+    lru_insert(tr, rec, REC(tr, rec)->kept);
+}
+
+/*
+ * remove a record from the index. later entries of its probe run move
+ * back into the hole, so lookups never stop short of them.
+ */
+static void hash_unindex(struct tracker *tr, uint32_t rec)
+{
+    unsigned int i, j, k, mask = tr->htable.cap - 1;
+
+    i = REC(tr, rec)->hval & mask;
+    while (tr->htable.slots[i] != rec + 1) {
+        if (tr->htable.slots[i] == 0)
+            return;
+        i = (i + 1) & mask;
+    }
+
+    for (j = (i + 1) & mask; tr->htable.slots[j] != 0; j = (j + 1) & mask) {
+        k = REC(tr, tr->htable.slots[j] - 1)->hval & mask;
+        // k cyclically in (i, j] means the entry can't move to i
+        if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        tr->htable.slots[i] = tr->htable.slots[j];
+        i = j;
+    }
+    tr->htable.slots[i] = 0;
+    tr->htable.size--;
+}
+
+static unsigned int instance_hash(int pid, uint64_t starttime)
+{
+    uint64_t k = ((uint64_t)(uint32_t)pid << 32) ^ starttime;
+
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    return (unsigned int)k;
+}
+
+/*
+ * find the group of cmdline, creating it when it's not there yet.
+ * a new group counts as seen at ts.
+ */
+static int64_t group_lookup(struct tracker *tr, const char *cmdline, int64_t ts)
+{
+    unsigned int i, hval = hash_index(cmdline);
+    int64_t rec;
+    struct hash *hit;
+
+    if (tr->htable.cap > 0) {
+        i = hval & (tr->htable.cap - 1);
+        while (tr->htable.slots[i] != 0) {
+            hit = REC(tr, tr->htable.slots[i] - 1);
+            if (hit->hval == hval && hit->kind == RECORD_GROUP
+                    && !strcmp(hit->cmdline, cmdline))
+                return tr->htable.slots[i] - 1;
+            i = (i + 1) & (tr->htable.cap - 1);
         }
     }
-    hit->count++;
 
-    if (*head != NULL) {
-        // pss not change skip
-        if ((*head)->pss == pinfo->pss)
-            return 0;
+    if ((rec = record_alloc(tr, UINT32_MAX)) < 0)
+        return rec;
+    hit = REC(tr, rec);
+    snprintf(hit->cmdline, sizeof(hit->cmdline), "%s", cmdline);
+    hit->kind = RECORD_GROUP;
+    hit->hval = hval;
+    hit->seen_ms = ts;
+    hit->gen = 2;
+    if (hash_index_record(tr, rec) < 0) {
+        record_free(tr, rec);
+        return -1;
+    }
+    lru_insert(tr, rec, 0);
+    return rec;
+}
+
+/* the instance (pid, starttime), -1 when it isn't tracked */
+static int64_t instance_find(struct tracker *tr, int pid, uint64_t starttime)
+{
+    unsigned int i, hval = instance_hash(pid, starttime);
+    struct hash *hit;
+
+    if (tr->htable.cap == 0)
+        return -1;
+    i = hval & (tr->htable.cap - 1);
+    while (tr->htable.slots[i] != 0) {
+        hit = REC(tr, tr->htable.slots[i] - 1);
+        if (hit->hval == hval && hit->kind == RECORD_INSTANCE
+                && hit->pid == pid && hit->starttime == starttime)
+            return tr->htable.slots[i] - 1;
+        i = (i + 1) & (tr->htable.cap - 1);
+    }
+    return -1;
+}
+
+static int64_t instance_create(struct tracker *tr, struct proc_info *item, uint32_t group)
+{
+    int64_t rec = record_alloc(tr, group);
+    struct hash *hit, *g;
+
+    if (rec < 0)
+        return rec;
+    hit = REC(tr, rec);
+    g = REC(tr, group);
+
+    snprintf(hit->cmdline, sizeof(hit->cmdline), "%s", item->cmdline);
+    hit->kind = RECORD_INSTANCE;
+    hit->pid = item->pid;
+    hit->starttime = item->starttime;
+    hit->hval = instance_hash(item->pid, item->starttime);
+    hit->group = group + 1;
+    hit->gen = 2;
+    if (hash_index_record(tr, rec) < 0) {
+        record_free(tr, rec);
+        return -1;
+    }
+
+    record_begin(g);
+    hit->next = g->head;
+    g->head = rec + 1;
+    record_end(g);
+    return rec;
+}
+
+/* whether group g or one of its instances holds a leak verdict */
+static int group_interest(struct tracker *tr, const struct hash *g)
+{
+    uint32_t rec;
+
+    if (g->reported)
+        return 1;
+    for (rec = g->head; rec != 0; rec = REC(tr, rec - 1)->next)
+        if (REC(tr, rec - 1)->reported)
+            return 1;
+    return 0;
+}
+
+/* a verdict came or went in group rec, which may move it to the other list */
+static void lru_verdict(struct tracker *tr, uint32_t rec)
+{
+    int kept = group_interest(tr, REC(tr, rec));
+
+    if (kept == (int)REC(tr, rec)->kept)
+        return;
+    lru_unlink(tr, rec);
+    lru_insert(tr, rec, kept);
+}
+
+/*
+ * an instance exited: give its verdict through leak_report, which holds
+ * back a repeat within the report interval, note the exit in its group
+ * for the restart that may follow, and drop its history.
+ */
+static void instance_retire(struct tracker *tr, uint32_t rec)
+{
+    struct hash *hit = REC(tr, rec), *g = REC(tr, hit->group - 1);
+    uint32_t *link, group = hit->group - 1, reported = hit->reported;
+    int leak;
 
-        if (pinfo->pss > hit->max_pss)
-            hit->max_pss = pinfo->pss;
-        else if (pinfo->pss < hit->min_pss)
-            hit->min_pss = pinfo->pss;
-
-        // oops pid changes
-        if (pinfo->pid != (*head)->pid) {
-            struct proc *tmp, *pn = *head;
-            int leak = leak_check_process(hit);
-            if (leak == 1)
-                print_hash(hit);
-    
-            while(pn) {
-                tmp = pn;
-                pn = pn->next;
-                free(tmp);
-            }
-            *head = NULL;
+    leak = tr->mode & TRACK_LEAK ? leak_check_process(tr, hit) : 0;
+    if (leak > 0)
+        leak_report(tr, hit, leak);
+
+    record_begin(g);
+    for (link = &g->head; *link != 0; link = &REC(tr, *link - 1)->next)
+        if (*link == rec + 1) {
+            *link = hit->next;
+            break;
         }
+    g->gone++;
+    g->gone_pid = hit->pid;
+    g->gone_pss = hit->len > 0 ? ring_value(tr, hit, SERIES_TOTAL, hit->len - 1) : 0;
+    record_end(g);
+
+    hash_unindex(tr, rec);
+    record_free(tr, rec);
+    if (reported)
+        lru_verdict(tr, group);
+}
+
+/*
+ * drop the group that matters least, with its instances: the least
+ * recently seen one without a leak verdict, else the least recently
+ * seen one with one. pin is never the victim.
+ */
+static int evict(struct tracker *tr, uint32_t pin)
+{
+    uint32_t v = 0, rec, next;
+    int k;
+
+    for (k = 0; k < 2 && v == 0; k++) {
+        v = tr->lru[k].oldest;
+        if (v != 0 && v - 1 == pin)
+            v = REC(tr, v - 1)->newer;
     }
+    if (v-- == 0)
+        return -1;
 
-    pinfo->next = *head;
-    *head= pinfo;
+    lru_unlink(tr, v);
+    for (rec = REC(tr, v)->head; rec != 0; rec = next) {
+        next = REC(tr, rec - 1)->next;
+        hash_unindex(tr, rec - 1);
+        record_free(tr, rec - 1);
+    }
+    hash_unindex(tr, v);
+    record_free(tr, v);
+    tr->evicted++;
+    return 0;
+}
 
+static int cmptickproc(const void *a, const void *b)
+{
+    const struct tick_proc *x = a, *y = b;
+
+    if (x->pid != y->pid)
+        return x->pid < y->pid ? -1 : 1;
+    if (x->starttime != y->starttime)
+        return x->starttime < y->starttime ? -1 : 1;
     return 0;
 }
 
-int hash_insert(struct meminfo *minfo)
+/*
+ * whether the process of instance hit still runs: on the system, or in
+ * a replay in the recorded tick, so the verdicts don't depend on the
+ * machine replaying
+ */
+static int instance_running(struct tracker *tr, const struct hash *hit)
 {
-    int i;
+    struct tick_proc key;
+
+    if (!(tr->mode & TRACK_REPLAY))
+        return get_starttime(tr->root, hit->pid) == hit->starttime;
+    key.pid = hit->pid;
+    key.starttime = hit->starttime;
+    return bsearch(&key, tr->tick_procs, tr->ntick_procs, sizeof(key), cmptickproc) != NULL;
+}
+
+/* the processes of a recorded tick, samples or not */
+static int tick_procs_set(struct tracker *tr, struct meminfo *minfo)
+{
+    struct tick_proc *p;
+    int i, n = 0;
+
+    if (minfo->num_procs > tr->tick_cap) {
+        p = realloc(tr->tick_procs, minfo->num_procs * sizeof(*p));
+        if (p == NULL)
+            return -1;
+        tr->tick_procs = p;
+        tr->tick_cap = minfo->num_procs;
+    }
     for (i = 0; i < minfo->num_procs; i++) {
         if (minfo->pss[i] == NULL)
             continue;
-        if (minfo->pss[i]->totalpss == 0)
+        tr->tick_procs[n].pid = minfo->pss[i]->pid;
+        tr->tick_procs[n].starttime = minfo->pss[i]->starttime;
+        n++;
+    }
+    qsort(tr->tick_procs, n, sizeof(*tr->tick_procs), cmptickproc);
+    tr->ntick_procs = n;
+    return 0;
+}
+
+/*
+ * close the tick of group g: instances without a sample in it are
+ * checked for exit, exits and starts pair up into restarts, and the
+ * summed growth becomes the group's next sample.
+ */
+static void group_flush(struct tracker *tr, struct hash *g)
+{
+    struct hash *hit;
+    uint32_t rec, next;
+    uint64_t v[_NUM_SERIES];
+    int n, live = 0;
+
+    for (rec = g->head; rec != 0; rec = next) {
+        hit = REC(tr, rec - 1);
+        next = hit->next;
+        if (g->tick_ms != 0 && hit->len > 0
+                && RING_TS(tr, hit, hit->len - 1) == g->tick_ms) {
+            live++;
             continue;
+        }
+        // gone, its pid reused, or still running but without samples
+        if (!instance_running(tr, hit) || ++hit->missed >= INSTANCE_GRACE)
+            instance_retire(tr, rec - 1);
+    }
 
-        if (minfo->pss[i]->cmdline[0] == '\0')
-            if (getprocname(minfo->pss[i]->pid, minfo->pss[i]->cmdline,
-                        sizeof(minfo->pss[i]->cmdline)) != 0)
-                continue;
+    record_begin(g);
+    g->ninst = live;
+    while (g->started > 0 && g->gone > 0) {
+        g->started--;
+        g->gone--;
+        g->restarts++;
+        report_restart(tr, g);
+    }
+    g->started = 0;
 
-        hash_insert_item(minfo->pss[i]);
+    if (g->tick_ms != 0) {
+        for (n = 0; n < _NUM_SERIES; n++)
+            v[n] = g->acc[n] > 0 ? g->acc[n] : 0;
+        g->count++;
+        ring_push(tr, g, g->tick_ms, v);
+        if (tr->mode & TRACK_QUANTILE) {
+            qwindow_add(&g->q_hour, QWIN_HOUR, g->tick_ms, g->tick_pss);
+            qwindow_add(&g->q_day, QWIN_DAY, g->tick_ms, g->tick_pss);
+        }
+        g->tick_ms = 0;
     }
+    record_end(g);
+}
+
+/* add the growth of an instance since its previous sample to its group */
+static void group_add(struct tracker *tr, struct hash *g, struct hash *hit, int64_t ts, const uint64_t *v)
+{
+    int n;
+
+    if (g->tick_ms != ts) {
+        // the last tick wasn't closed by detect_leak
+        if (g->tick_ms != 0)
+            group_flush(tr, g);
+        if (g->len == 0)
+            memset(g->acc, 0, sizeof(g->acc));
+        g->tick_ms = ts;
+        g->tick_pss = 0;
+        g->seen_ms = ts;
+        lru_touch(tr, REC_ID(tr, g));
+    }
+
+    record_begin(g);
+    g->tick_pss += v[SERIES_TOTAL];
+    if (g->len == 0) {
+        // the first sample is the plain sum
+        for (n = 0; n < _NUM_SERIES; n++)
+            g->acc[n] += v[n];
+    } else if (hit->len > 0) {
+        for (n = 0; n < _NUM_SERIES; n++)
+            g->acc[n] += (int64_t)v[n] - (int64_t)ring_value(tr, hit, n, hit->len - 1);
+    } else {
+        g->started++;
+        g->start_pid = hit->pid;
+    }
+    record_end(g);
+}
+
+static int cmpseen(const void *a, const void *b)
+{
+    const int64_t *x = a, *y = b;
+
+    if (x[0] != y[0])
+        return x[0] < y[0] ? -1 : 1;
     return 0;
 }
 
-static void shrink_link(struct hash *h)
+/* the eviction lists from the records, in seen_ms order */
+static int lru_rebuild(struct tracker *tr)
 {
-    int size;
-    struct proc *pnext, *tmp;
-    if (h == NULL)
-        return;
-    if (h->head == NULL)
+    int64_t (*seen)[2];
+    uint32_t i, n = 0;
+
+    memset(tr->lru, 0, sizeof(tr->lru));
+    if ((seen = malloc(tr->arena.hdr->used * sizeof(*seen) + 1)) == NULL)
+        return -1;
+    for (i = 0; i < tr->arena.hdr->used; i++) {
+        if (REC(tr, i)->gen == 0 || REC(tr, i)->kind != RECORD_GROUP)
+            continue;
+        seen[n][0] = REC(tr, i)->seen_ms;
+        seen[n][1] = i;
+        n++;
+    }
+    qsort(seen, n, sizeof(*seen), cmpseen);
+    for (i = 0; i < n; i++)
+        lru_insert(tr, seen[i][1], group_interest(tr, REC(tr, seen[i][1])));
+    free(seen);
+    return 0;
+}
+
+/*
+ * the group, free and eviction lists from the records alone, with the
+ * group heads cleared. an instance whose group is gone goes too.
+ */
+static int state_relink(struct tracker *tr)
+{
+    uint32_t i;
+
+    tr->free_head = tr->nfree = 0;
+    for (i = tr->arena.hdr->used; i-- > 0; ) {
+        struct hash *h = REC(tr, i), *g;
+        if (h->gen == 0) {
+            record_free(tr, i);
+            continue;
+        }
+        if (h->kind != RECORD_INSTANCE)
+            continue;
+        g = h->group > 0 && h->group <= tr->arena.hdr->used ? REC(tr, h->group - 1) : NULL;
+        if (g == NULL || g->gen == 0 || g->kind != RECORD_GROUP) {
+            hash_unindex(tr, i);
+            record_free(tr, i);
+            continue;
+        }
+        h->next = g->head;
+        g->head = i + 1;
+    }
+    return lru_rebuild(tr);
+}
+
+/*
+ * move the live records of a state file down over the free ones and
+ * cut the file after them, for when the budget no longer pays for all
+ * of it. older, rebuilt anyway, holds where a record goes so instances
+ * can follow their group there. the index and the lists are rebuilt.
+ */
+static int arena_compact(struct tracker *tr)
+{
+    uint32_t i, n = 0, used = tr->arena.hdr->used;
+    struct hash *h;
+
+    for (i = 0; i < used; i++) {
+        if (REC(tr, i)->gen != 0)
+            REC(tr, i)->older = n++;
+    }
+    for (i = 0; i < used; i++) {
+        h = REC(tr, i);
+        if (h->gen != 0 && h->kind == RECORD_INSTANCE)
+            h->group = REC(tr, h->group - 1)->older + 1;
+    }
+    for (i = 0, n = 0; i < used; i++) {
+        if (REC(tr, i)->gen == 0)
+            continue;
+        if (i != n)
+            memcpy(REC(tr, n), REC(tr, i), tr->arena.record_size);
+        n++;
+    }
+
+    memset(tr->htable.slots, 0, tr->htable.cap * sizeof(uint32_t));
+    tr->htable.size = 0;
+    for (i = 0; i < n; i++) {
+        REC(tr, i)->head = 0;
+        hash_index_record(tr, i);
+    }
+
+    tr->arena.hdr->used = n;
+    if (arena_resize(tr, n > 0 ? n : 1) < 0 || state_relink(tr) < 0)
+        return -1;
+    return 0;
+}
+
+/*
+ * refit the record cap and evict down to it, a state file is cut down to
+ * the cap as well. once per tick, the cap holds until the next.
+ */
+static int budget_trim(struct tracker *tr)
+{
+    budget_fit(tr);
+    if (tr->arena.hdr == NULL)
+        return 0;
+    while (records_live(tr) > tr->max_records && evict(tr, UINT32_MAX) == 0)
+        ;
+    if (tr->arena.fd >= 0 && tr->arena.hdr->nrecords > tr->max_records)
+        return arena_compact(tr);
+    return 0;
+}
+
+/*
+ * keep the leak state in a memory mapped file so a restarted tracker
+ * picks up where it left off. the records are used in place, loading
+ * only rebuilds the index, whatever the length of the history.
+ */
+int hash_open(struct meminfo_ctx *ctx, const char *path)
+{
+    struct tracker *tr = &ctx->tr;
+    struct state_header hdr;
+    struct stat st;
+    int fd, fresh = 0;
+    uint32_t i, torn = 0;
+    int64_t gap;
+
+    if (tr->arena.hdr != NULL)
+        return ctx_error(ctx, MEMINFO_ESTATE, "leak state already in use");
+
+    tr->arena.record_size = record_bytes(tr);
+
+    if ((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0)
+        return ctx_error(ctx, MEMINFO_ESTATE, "open state file %s error %s",
+                path, strerror(errno));
+    if (fstat(fd, &st) < 0)
+        goto fail;
+
+    if (st.st_size < (off_t)ARENA_HDR
+            || pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)
+            || memcmp(hdr.magic, STATE_MAGIC, sizeof(hdr.magic))
+            || hdr.version != STATE_VERSION
+            || hdr.ring_cap != tr->ring_cap
+            || hdr.record_size != tr->arena.record_size
+            || hdr.used > hdr.nrecords
+            || st.st_size < (off_t)arena_size(tr, hdr.nrecords)) {
+        if (st.st_size > 0)
+            err_msg("state file %s doesn't match this version or -n, starting over\n", path);
+        fresh = 1;
+        hdr.nrecords = init_records(tr);
+        if (ftruncate(fd, 0) < 0 || ftruncate(fd, arena_size(tr, hdr.nrecords)) < 0)
+            goto fail;
+    }
+
+    tr->arena.len = arena_size(tr, hdr.nrecords);
+    tr->arena.hdr = mmap(NULL, tr->arena.len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (tr->arena.hdr == MAP_FAILED) {
+        tr->arena.hdr = NULL;
+        goto fail;
+    }
+    tr->arena.fd = fd;
+
+    if (fresh)
+        arena_init(tr, tr->arena.hdr, hdr.nrecords);
+
+    /*
+     * continue the tracker clock from the last commit, advanced by the
+     * wall time since then; CLOCK_MONOTONIC itself restarts on reboot.
+     */
+    gap = clock_ms(CLOCK_REALTIME) - tr->arena.hdr->wall_ms;
+    if (gap < 0)
+        gap = 0;
+    tr->clock_offset = tr->arena.hdr->clock_ms + gap - clock_ms(CLOCK_MONOTONIC);
+
+    if (hash_reserve(tr, tr->arena.hdr->used) < 0)
+        goto fail;
+    for (i = 0; i < tr->arena.hdr->used; i++) {
+        struct hash *h = REC(tr, i);
+        if (h->gen == 0)
+            continue;
+        if (h->gen & 1) {
+            // died half way through an update
+            ring_reset(h);
+            h->tick_ms = 0;
+            h->gen++;
+            torn++;
+        }
+        h->head = 0;
+        if (hash_index_record(tr, i) < 0)
+            goto fail;
+    }
+
+    /*
+     * the group, free and eviction lists are rebuilt rather than trusted,
+     * a crash may have left them half updated.
+     */
+    if (state_relink(tr) < 0)
+        goto fail;
+
+    /*
+     * a state from a larger budget is trimmed and cut down to the cap.
+     * going through it above mapped it whole, it's within the budget
+     * from here on.
+     */
+    if (tr->budget_kb > 0 && budget_trim(tr) < 0)
+        goto fail;
+
+    if (!fresh)
+        err_msg("resumed %u tracked records from %s (generation %" PRIu64 ", %u torn)\n",
+                tr->htable.size, path, tr->arena.hdr->generation, torn);
+    return 0;
+
+fail:
+    ctx_error(ctx, MEMINFO_ESTATE, "state file %s error %s", path, strerror(errno));
+    if (tr->arena.hdr != NULL)
+        munmap(tr->arena.hdr, tr->arena.len);
+    tr->arena.hdr = NULL;
+    tr->arena.fd = -1;
+    free(tr->htable.slots);
+    memset(&tr->htable, 0, sizeof(tr->htable));
+    close(fd);
+    return MEMINFO_ESTATE;
+}
+
+/* mark the end of a tick, the state on disk is consistent up to here */
+void hash_commit(struct meminfo_ctx *ctx)
+{
+    struct tracker *tr = &ctx->tr;
+
+    if (tr->arena.hdr == NULL)
         return;
 
-    pnext = h->head;
-    size = list_size(pnext);
-    if (size < SHRINK_SIZE)
+    tr->arena.hdr->clock_ms = clock_ms(CLOCK_MONOTONIC) + tr->clock_offset;
+    tr->arena.hdr->wall_ms = clock_ms(CLOCK_REALTIME);
+    __atomic_add_fetch(&tr->arena.hdr->generation, 1, __ATOMIC_RELEASE);
+    if (tr->arena.fd >= 0)
+        msync(tr->arena.hdr, tr->arena.len, MS_ASYNC);
+}
+
+int64_t hash_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* a tracker with nothing tracked yet and the default settings */
+void tracker_init(struct tracker *tr)
+{
+    memset(tr, 0, sizeof(*tr));
+    tr->ring_cap = RING_SIZE;
+    tr->arena.fd = -1;
+    memcpy(tr->thresholds, default_thresholds, sizeof(tr->thresholds));
+    tr->mode = TRACK_LEAK;
+}
+
+/*
+ * send verdicts and restarts to fn instead of stdout, NULL goes back
+ * to printing. fn runs from detect_leak and hash_insert.
+ */
+void hash_set_report(struct meminfo_ctx *ctx, leak_report_fn fn, void *arg)
+{
+    ctx->tr.report = fn;
+    ctx->tr.report_arg = arg;
+}
+
+/* TRACK_LEAK and/or TRACK_QUANTILE, leak checks alone by default */
+void hash_set_mode(struct meminfo_ctx *ctx, int mode)
+{
+    ctx->tr.mode = mode;
+}
+
+/*
+ * cap the resident set of the whole tool at kb. the record cap is refit
+ * at the start of every tick, what the rest of the tool grows within one
+ * comes out of BUDGET_SLACK_KB. set after the ring size, it fails when
+ * what the tool already uses leaves no room for a few records.
+ */
+int hash_set_budget(struct meminfo_ctx *ctx, uint64_t kb)
+{
+    struct tracker *tr = &ctx->tr;
+
+    if (tr->arena.hdr != NULL)
+        return -1;
+    tr->budget_kb = kb;
+    budget_fit(tr);
+    if (tr->max_records < 4) {
+        tr->budget_kb = tr->max_records = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void print_tracker_stats(struct meminfo_ctx *ctx)
+{
+    struct tracker *tr = &ctx->tr;
+    uint32_t i, groups = 0, instances = 0;
+    uint64_t kb;
+
+    if (tr->arena.hdr == NULL)
         return;
+    for (i = 0; i < tr->arena.hdr->used; i++) {
+        if (REC(tr, i)->gen == 0)
+            continue;
+        if (REC(tr, i)->kind == RECORD_GROUP)
+            groups++;
+        else
+            instances++;
+    }
+    kb = (arena_size(tr, tr->arena.hdr->used) + tr->htable.cap * sizeof(uint32_t)) / 1024;
+
+    printf("tracker: %u cmdlines, %u processes, %u series, state %" PRIu64 " kB",
+            groups, instances, (groups + instances) * _NUM_SERIES, kb);
+    if (tr->budget_kb > 0)
+        printf(" of %" PRIu64 " kB budget less %" PRIu64 " kB for the rest,"
+                " %" PRIu64 " evicted, %" PRIu64 " refused",
+                tr->budget_kb, tr->overhead_kb, tr->evicted, tr->refused);
+    printf(", rss %" PRIu64 " kB\n", self_rss());
+}
+
+/*
+ * samples kept per process, only before the first insert since every
+ * ring is sized once when its entry is created.
+ */
+int hash_set_capacity(struct meminfo_ctx *ctx, int samples)
+{
+    struct tracker *tr = &ctx->tr;
+
+    if (samples < 4 || tr->arena.hdr != NULL)
+        return -1;
+    tr->ring_cap = samples;
+    return 0;
+}
+
+/* one sample of item at ts, its totals as stat_procmem summed them */
+int hash_insert_item(struct meminfo_ctx *ctx, struct proc_info *item, int64_t ts)
+{
+    struct tracker *tr = &ctx->tr;
+    int i;
+    int64_t rec, group;
+    uint64_t pss, v[_NUM_SERIES];
+    struct hash *hit;
+
+    if (item == NULL)
+        return ctx_error(ctx, MEMINFO_EINVAL, "no process to insert");
+    if (item->totalpss == 0)
+        return ctx_error(ctx, MEMINFO_EINVAL, "hash insert %s total pss is 0, skip",
+                item->cmdline);
+    pss = item->totalpss;
+    v[SERIES_TOTAL] = pss;
+    for (i = 1; i < _NUM_SERIES; i++)
+        v[i] = item->stats[series_heap[i]].pss;
 
-    while(pnext) {
-        tmp = pnext;
-        pnext = pnext->next;
-        free(tmp);
+    ts += tr->clock_offset;
+    if (ts > tr->last_ms) {
+        tr->last_ms = ts;
+        // a new tick, its snapshot in memory is the peak of the rest of the tool
+        if (tr->budget_kb > 0)
+            budget_trim(tr);
     }
-    h->head = NULL;
+    if ((group = group_lookup(tr, item->cmdline, ts)) == NO_ROOM)
+        goto full;
+    if (group < 0)
+        return ctx_error(ctx, MEMINFO_ENOMEM, "grow leak state error");
+    rec = instance_find(tr, item->pid, item->starttime);
+    if (rec >= 0 && strcmp(REC(tr, rec)->cmdline, item->cmdline)) {
+        // exec'd, or a reused pid whose start time we can't tell
+        instance_retire(tr, rec);
+        rec = -1;
+    }
+    if (rec < 0 && (rec = instance_create(tr, item, group)) == NO_ROOM)
+        goto full;
+    if (rec < 0)
+        return ctx_error(ctx, MEMINFO_ENOMEM, "grow leak state error");
+    hit = REC(tr, rec);
+
+    group_add(tr, REC(tr, group), hit, ts, v);
+
+    record_begin(hit);
+    // first insert
+    if (hit->count == 0)
+        hit->init_pss = hit->min_pss = hit->max_pss = pss;
+    else if (pss > hit->max_pss)
+        hit->max_pss = pss;
+    else if (pss < hit->min_pss)
+        hit->min_pss = pss;
+    hit->count++;
+    hit->missed = 0;
+    ring_push(tr, hit, ts, v);
+    record_end(hit);
+
+    return 0;
 
+full:
+    tr->refused++;
+    return ctx_error(ctx, MEMINFO_ESTATE, "leak state budget full, %s not tracked",
+            item->cmdline);
 }
 
-void hash_shrink()
+int hash_insert(struct meminfo_ctx *ctx, struct meminfo *minfo)
 {
+    struct tracker *tr = &ctx->tr;
+    const char *name;
     int i;
-    struct hash *hnext;
+    int64_t ts;
 
-    for (i = 0; i < HASH_SIZE; i++) {
-        if (htable[i].cmdline == NULL)
+    if (tr->mode & TRACK_QUANTILE) {
+        if (tr->arena.hdr == NULL && arena_anon(tr) < 0)
+            return ctx_error(ctx, MEMINFO_ENOMEM, "mmap leak state error");
+        ts = (int64_t)minfo->kern_start.tv_sec * 1000
+            + minfo->kern_start.tv_nsec / 1000000 + tr->clock_offset;
+        if (ts > tr->last_ms)
+            tr->last_ms = ts;
+        for (i = 0; i < MEMINFO_COUNT; i++) {
+            if ((name = mem_label(minfo->item, i)) == NULL)
+                continue;
+            strcpy(tr->kern_names[i], name);
+            qwindow_add(&tr->arena.hdr->kern_hour[i], QWIN_HOUR, ts, minfo->item[i].num);
+            qwindow_add(&tr->arena.hdr->kern_day[i], QWIN_DAY, ts, minfo->item[i].num);
+        }
+    }
+
+    ts = (int64_t)minfo->proc_start.tv_sec * 1000
+        + minfo->proc_start.tv_nsec / 1000000;
+
+    if ((tr->mode & TRACK_REPLAY) && tick_procs_set(tr, minfo) < 0)
+        return ctx_error(ctx, MEMINFO_ENOMEM, "realloc tick processes error");
+    for (i = 0; i < minfo->num_procs; i++) {
+        if (minfo->pss[i] == NULL)
             continue;
-        if (htable[i].head == NULL)
+        if (minfo->pss[i]->totalpss == 0)
             continue;
 
-        shrink_link(&htable[i]);
+        if (minfo->pss[i]->cmdline[0] == '\0')
+            continue;
 
-        hnext = htable[i].next;
-        while(hnext) {
-            shrink_link(hnext);
-            hnext = hnext->next;
-        }
+        if (hash_insert_item(ctx, minfo->pss[i], ts) == MEMINFO_ENOMEM)
+            return MEMINFO_ENOMEM;
     }
+    return 0;
 }
 
-int detect_leak()
+/*
+ * a group is only worth its own verdict when it's more than the one
+ * instance that is checked anyway.
+ */
+static int group_shared(const struct hash *g)
 {
-    int i;
-    struct hash *hnext;
+    return g->restarts > 0 || g->ninst > 1;
+}
+
+int detect_leak(struct meminfo_ctx *ctx)
+{
+    struct tracker *tr = &ctx->tr;
+    uint32_t i, reported;
+    int leak;
+    struct hash *hit;
+
+    if (tr->arena.hdr == NULL)
+        return 0;
+
+    // close the tick first, it may retire instances
+    for (i = 0; i < tr->arena.hdr->used; i++) {
+        hit = REC(tr, i);
+        if (hit->gen != 0 && hit->kind == RECORD_GROUP)
+            group_flush(tr, hit);
+    }
+    if (!(tr->mode & TRACK_LEAK))
+        return 0;
 
-    for (i = 0; i < HASH_SIZE; i++) {
-        if (htable[i].cmdline == NULL)
+    for (i = 0; i < tr->arena.hdr->used; i++) {
+        hit = REC(tr, i);
+        if (hit->gen == 0 || hit->len == 0)
             continue;
-        if (htable[i].head == NULL)
+        if (hit->kind == RECORD_GROUP && !group_shared(hit))
             continue;
 
-        if (leak_check_process(&htable[i]) == 1)
-                print_hash(&htable[i]);
-
-        hnext = htable[i].next;
-        while(hnext) {
-            if (leak_check_process(hnext) == 1)
-                print_hash(hnext);
-            hnext = hnext->next;
+        reported = hit->reported;
+        leak = leak_check_process(tr, hit);
+        if (leak > 0)
+            leak_report(tr, hit, leak);
+        else if (leak == 0 && hit->reported) {
+            record_begin(hit);
+            hit->reported = 0;
+            record_end(hit);
         }
+        if (!reported != !hit->reported)
+            lru_verdict(tr, hit->kind == RECORD_GROUP ? i : hit->group - 1);
     }
 
     return 0;
 }
 
-static void list_clear(struct proc *head)
+/*
+ * the verdicts standing after the last detect_leak, reported or held
+ * back by the report interval alike. returns how many fn was given.
+ */
+int hash_verdicts(struct meminfo_ctx *ctx, leak_report_fn fn, void *arg)
+{
+    struct tracker *tr = &ctx->tr;
+    struct leak_event ev;
+    struct hash *hit;
+    uint32_t i;
+    int n = 0;
+
+    if (tr->arena.hdr == NULL || !(tr->mode & TRACK_LEAK))
+        return 0;
+    for (i = 0; i < tr->arena.hdr->used; i++) {
+        hit = REC(tr, i);
+        if (hit->gen == 0 || hit->len == 0 || hit->reported == 0)
+            continue;
+        if (hit->kind == RECORD_GROUP && !group_shared(hit))
+            continue;
+        leak_event_fill(tr, hit, hit->reported, &ev);
+        fn(arg, &ev);
+        n++;
+    }
+    return n;
+}
+
+/* quantiles of the total pss of cmdline, MEMINFO_EINVAL if not tracked */
+int hash_quantiles(struct meminfo_ctx *ctx, const char *cmdline,
+        struct quantiles *hour, struct quantiles *day)
 {
-    struct proc *pnext;
-    while(head) {
-        pnext = head;
-        head = head->next;
-        free(pnext);
+    struct tracker *tr = &ctx->tr;
+    unsigned int i, hval = hash_index(cmdline);
+    int64_t now = tr->last_ms;
+    struct hash *g;
+
+    if (!(tr->mode & TRACK_QUANTILE) || tr->htable.cap == 0)
+        return ctx_error(ctx, MEMINFO_EINVAL, "quantiles are not being kept");
+
+    i = hval & (tr->htable.cap - 1);
+    while (tr->htable.slots[i] != 0) {
+        g = REC(tr, tr->htable.slots[i] - 1);
+        if (g->hval == hval && g->kind == RECORD_GROUP && !strcmp(g->cmdline, cmdline)) {
+            qwindow_query(&g->q_hour, QWIN_HOUR, now, hour);
+            qwindow_query(&g->q_day, QWIN_DAY, now, day);
+            return 0;
+        }
+        i = (i + 1) & (tr->htable.cap - 1);
     }
+    return ctx_error(ctx, MEMINFO_EINVAL, "%s is not tracked", cmdline);
 }
 
-void hash_clear()
+struct quantile_row {
+    struct quantiles hour, day;
+    const char *name;
+};
+
+static int cmprow(const void *a, const void *b)
+{
+    double x = ((const struct quantile_row *)a)->day.p95;
+    double y = ((const struct quantile_row *)b)->day.p95;
+    return (x < y) - (x > y);
+}
+
+static void print_rows(struct quantile_row *rows, int n)
 {
     int i;
-    struct hash *hnext, *tmp;
 
-    for (i = 0; i < HASH_SIZE; i++) {
-        if (htable[i].cmdline == NULL)
+    qsort(rows, n, sizeof(rows[0]), cmprow);
+    printf("%9s %9s %9s  %9s %9s %9s\n", "hour p50", "p95", "max", "day p50", "p95", "max");
+    for (i = 0; i < n; i++)
+        printf("%9.0f %9.0f %9.0f  %9.0f %9.0f %9.0f  %s\n",
+                rows[i].hour.p50, rows[i].hour.p95, rows[i].hour.max,
+                rows[i].day.p50, rows[i].day.p95, rows[i].day.max, rows[i].name);
+}
+
+/* pss quantiles of every cmdline and kernel category, sorted by day p95 */
+void print_quantiles(struct meminfo_ctx *ctx)
+{
+    struct tracker *tr = &ctx->tr;
+    struct quantile_row *rows;
+    int64_t now = tr->last_ms;
+    uint32_t i;
+    int n = 0;
+
+    if (tr->arena.hdr == NULL || !(tr->mode & TRACK_QUANTILE))
+        return;
+
+    rows = malloc((tr->arena.hdr->used + MEMINFO_COUNT) * sizeof(*rows));
+    if (rows == NULL)
+        return;
+
+    for (i = 0; i < tr->arena.hdr->used; i++) {
+        struct hash *g = REC(tr, i);
+        if (g->gen == 0 || g->kind != RECORD_GROUP)
+            continue;
+        qwindow_query(&g->q_day, QWIN_DAY, now, &rows[n].day);
+        if (rows[n].day.n == 0)
             continue;
+        qwindow_query(&g->q_hour, QWIN_HOUR, now, &rows[n].hour);
+        rows[n++].name = g->cmdline;
+    }
+    printf("Total PSS quantiles by process (kB):\n");
+    print_rows(rows, n);
 
-        if (htable[i].head == NULL)
+    n = 0;
+    for (i = 0; i < MEMINFO_COUNT; i++) {
+        qwindow_query(&tr->arena.hdr->kern_day[i], QWIN_DAY, now, &rows[n].day);
+        // a source that's off or absent stays at 0
+        if (rows[n].day.max == 0 || tr->kern_names[i][0] == '\0')
             continue;
+        qwindow_query(&tr->arena.hdr->kern_hour[i], QWIN_HOUR, now, &rows[n].hour);
+        rows[n++].name = tr->kern_names[i];
+    }
+    printf("kernel memory quantiles (kB):\n");
+    print_rows(rows, n);
 
-        hnext = htable[i].next;
-        while(hnext) {
-            list_clear(hnext->head);
-            tmp = hnext;
-            hnext = hnext->next;
-            free(tmp);
-        }
+    free(rows);
+}
+
+/* drop the index and unmap the state, a state file keeps its contents */
+void hash_clear(struct meminfo_ctx *ctx)
+{
+    struct tracker *tr = &ctx->tr;
+
+    free(tr->htable.slots);
+    tr->htable.slots = NULL;
+    tr->htable.cap = tr->htable.size = 0;
+    free(tr->tick_procs);
+    tr->tick_procs = NULL;
+    tr->ntick_procs = tr->tick_cap = 0;
+    tr->free_head = tr->nfree = 0;
+    memset(tr->lru, 0, sizeof(tr->lru));
 
-        list_clear(htable[i].head);
+    if (tr->arena.hdr != NULL) {
+        if (tr->arena.fd >= 0)
+            msync(tr->arena.hdr, tr->arena.len, MS_SYNC);
+        munmap(tr->arena.hdr, tr->arena.len);
     }
+    if (tr->arena.fd >= 0)
+        close(tr->arena.fd);
+    tr->arena.hdr = NULL;
+    tr->arena.fd = -1;
 }
@@ -1,32 +1,278 @@
 #ifndef MEMINFO_HASH_H
 #define MEMINFO_HASH_H
 
-#define HASH_SIZE 200
-#define GAP_SIZE 50
-#define SHRINK_SIZE (60*6)
+/* initial slot count, must be a power of two */
+#define HASH_INIT_SIZE 256
+/* grow when more than HASH_LOAD_PCT percent of the slots are used */
+#define HASH_LOAD_PCT 70
+/* default number of samples kept per process */
+#define RING_SIZE (60*6)
+
+/* a verdict needs at least this many samples ... */
+#define LEAK_MIN_SAMPLES 16
+/* ... and, until the ring is full, over at least this long (ms) */
+#define LEAK_MIN_SPAN (60 * 60 * 1000)
+/* newest samples the Mann-Kendall S covers, what a sample costs to add */
+#define MK_WINDOW 64
+/* a process already reported isn't reported again before this (ms) ... */
+#define LEAK_REPORT_INTERVAL (60 * 60 * 1000)
+/* ... unless its estimated rate grew by this many percent */
+#define LEAK_REPORT_RISE_PCT 50
+
+/* an instance not seen for this many ticks while still running is dropped */
+#define INSTANCE_GRACE 2
+
+/* persistent state file, see struct state_header */
+#define STATE_MAGIC "MILEAK\0"
+#define STATE_VERSION 7
+/* records the arena starts with, doubled as needed */
+#define STATE_INIT_RECORDS 64
 
 #include "getpss.h"
+#include "sketch.h"
 
-struct proc {
-    struct proc *next;
-    int pid;
-    int pss;
+/* what the tracker is used for, see hash_set_mode */
+#define TRACK_LEAK 1
+#define TRACK_QUANTILE 2
+/* samples come from a recording, exits are judged by its ticks, not /proc */
+#define TRACK_REPLAY 4
+
+/* pss series tracked per process, each with its own trend */
+enum enum_series {
+    SERIES_TOTAL,
+    SERIES_NATIVE,
+    SERIES_DALVIK,
+    SERIES_DALVIK_OTHER,
+    SERIES_GL,
+    SERIES_ASHMEM,
+    SERIES_UNKNOWN,
+    _NUM_SERIES
+};
+
+/*
+ * per series verdict: a Mann-Kendall z of at least min_z over the last
+ * MK_WINDOW samples and a growth rate, over the whole ring, whose 95%
+ * confidence interval lies above min_rate kB/hour.
+ */
+struct leak_threshold {
+    double min_z;
+    double min_rate;
+};
+
+/* growth estimate of one series, kB/hour */
+struct leak_rate {
+    double rate;
+    double lo, hi;      /* 95% confidence interval */
+    double tto;         /* hours until free memory runs out, < 0 unknown */
+};
+
+/*
+ * running statistics over the samples in the ring, updated as samples
+ * enter and leave it. x is seconds since t0 and shared by all series,
+ * y is the series value in kB relative to its base.
+ */
+struct trend {
+    double sx, sxx;
+    double sy[_NUM_SERIES];
+    double syy[_NUM_SERIES];
+    double sxy[_NUM_SERIES];
+    int64_t s[_NUM_SERIES];     /* Mann-Kendall S of the last MK_WINDOW samples */
+    int64_t t0;
+    uint32_t since_rebase;
+    uint32_t pad;
 };
 
+enum enum_record {
+    RECORD_INSTANCE,    /* one process, keyed by (pid, starttime) */
+    RECORD_GROUP,       /* all instances sharing a cmdline */
+};
+
+/*
+ * one tracked process or group. records have a fixed size and live in
+ * an arena that may be a memory mapped file, so no pointers in here,
+ * links are record index + 1. the record is followed by its history as
+ * struct of arrays: ts[cap] (tracker clock, ms) then
+ * val[_NUM_SERIES][cap], kB relative to base[]. oldest sample at index
+ * first, once full each new sample evicts the oldest.
+ *
+ * a group's history is the summed growth of its instances: an instance
+ * adds what it grew since its previous sample, a new one adds nothing
+ * and one that exits takes nothing away. a restart is a memory reset
+ * of the group, not growth.
+ */
 struct hash {
-    struct hash *next;
-    struct proc *head;
-    char *cmdline;
-    int init_pss;
-    int max_pss;
-    int min_pss;
-    int count;
-};
-
-void hash_clear();
-void hash_shrink();
-int detect_leak();
-int hash_insert(struct meminfo *minfo);
-int hash_insert_item(struct proc_info *item);
+    uint32_t gen;       /* odd while being updated, 0 for an unused record */
+    uint32_t hval;      /* cached hash of the key */
+    uint32_t first;
+    uint32_t len;
+    uint32_t kind;
+    int32_t pid;
+    uint64_t starttime;
+    int32_t count;
+    uint32_t group;     /* instance: its group; free record: next free */
+    uint32_t next;      /* instance: next one of the same group */
+    uint32_t head;      /* group: first instance */
+    uint32_t missed;    /* instance: ticks in a row without a sample */
+    uint32_t ninst;     /* group: instances seen in the last tick */
+    uint32_t started;   /* group: instances new in the current tick */
+    uint32_t gone;      /* group: exits not matched by a start yet */
+    uint32_t restarts;
+    int32_t gone_pid;   /* group: last instance that exited ... */
+    uint64_t gone_pss;  /* ... and its last total pss */
+    int32_t start_pid;  /* group: last instance that started */
+    uint32_t pad;
+    int64_t tick_ms;    /* group: tick being summed up, 0 when none */
+    int64_t seen_ms;    /* group: last tick with an instance in it */
+    int64_t acc[_NUM_SERIES];   /* group: summed growth, kB */
+    uint64_t tick_pss;  /* group: summed total pss of the current tick */
+    struct qwindow q_hour, q_day;   /* group: total pss quantiles */
+    uint64_t base[_NUM_SERIES];
+    uint64_t init_pss;
+    uint64_t max_pss;
+    uint64_t min_pss;
+    struct trend trend;
+    int64_t report_ms;      /* tracker clock of the last report */
+    double report_rate;     /* total rate at that report */
+    uint32_t reported;      /* series mask of that report */
+    uint32_t kept;          /* group: on the eviction list of verdicts */
+    uint32_t older, newer;  /* group: neighbours on its eviction list */
+    char cmdline[96];
+};
+
+/*
+ * start of the arena. generation counts committed ticks; clock_ms and
+ * wall_ms let a restarted tracker continue its clock, even across a
+ * reboot where CLOCK_MONOTONIC starts over.
+ */
+struct state_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t ring_cap;
+    uint32_t record_size;
+    uint32_t nrecords;  /* records there is room for */
+    uint32_t used;      /* records handed out */
+    uint32_t pad;
+    uint64_t generation;
+    int64_t clock_ms;
+    int64_t wall_ms;
+    struct qwindow kern_hour[MEMINFO_COUNT];
+    struct qwindow kern_day[MEMINFO_COUNT];
+};
+
+/* open addressing with linear probing, slots hold record index + 1 */
+struct hash_table {
+    uint32_t *slots;
+    unsigned int cap;
+    unsigned int size;
+};
+
+/* groups by seen_ms, oldest first, record index + 1 */
+struct evict_list {
+    uint32_t oldest, newest;
+};
+
+/* a leak verdict or a restart, as handed to a report callback */
+struct leak_event {
+    int restart;        /* pid restarted as new_pid, no verdict */
+    int group;          /* verdict on all instances of cmdline */
+    const char *cmdline;
+    int pid;
+    int new_pid;
+    uint32_t leak;      /* series with a verdict */
+    uint32_t samples;
+    double hours;       /* span of the samples */
+    struct leak_rate rate[_NUM_SERIES];
+};
+
+typedef void (*leak_report_fn)(void *arg, const struct leak_event *ev);
+
+/*
+ * everything the leak tracker keeps, one per struct meminfo_ctx. the
+ * records live in the arena, the rest is the index and the settings.
+ */
+struct tracker {
+    struct hash_table htable;
+    unsigned int ring_cap;
+
+    /* record arena, anonymous or backed by the state file */
+    struct {
+        struct state_header *hdr;
+        size_t len;
+        int fd;
+        size_t record_size;
+    } arena;
+
+    /* tracker clock = CLOCK_MONOTONIC + clock_offset */
+    int64_t clock_offset;
+
+    struct leak_threshold thresholds[_NUM_SERIES];
+    int mode;
+
+    /* data root the exit checks look under, the context's */
+    const char *root;
+
+    /* with TRACK_REPLAY, the processes of the tick being inserted */
+    struct tick_proc *tick_procs;
+    int ntick_procs, tick_cap;
+
+    /* kernel category names, as last collected */
+    char kern_names[MEMINFO_COUNT][64];
+
+    /* tracker clock of the latest sample, queries look back from it */
+    int64_t last_ms;
+
+    /* memory left for leaks to eat, kB, 0 when unknown */
+    uint64_t free_kb;
+
+    /* unused records, chained through group, index + 1 */
+    uint32_t free_head;
+    uint32_t nfree;
+
+    /*
+     * records the memory budget leaves room for once the rest of the
+     * tool's resident set, overhead_kb, is taken out of it
+     */
+    uint32_t max_records;
+    uint64_t budget_kb;
+    uint64_t overhead_kb;
+    uint64_t evicted;
+    uint64_t refused;   /* samples dropped with nothing left to evict */
+
+    /* eviction order: groups without a verdict, then those with one */
+    struct evict_list lru[2];
+
+    /* verdicts and restarts go here, printed when NULL */
+    leak_report_fn report;
+    void *report_arg;
+};
+
+/* a process as a recorded tick has it */
+struct tick_proc {
+    int pid;
+    uint64_t starttime;
+};
+
+struct meminfo_ctx;
+
+void tracker_init(struct tracker *tr);
+const char *series_name(int which);
+void hash_clear(struct meminfo_ctx *ctx);
+void hash_set_mode(struct meminfo_ctx *ctx, int mode);
+int hash_set_budget(struct meminfo_ctx *ctx, uint64_t kb);
+int hash_set_capacity(struct meminfo_ctx *ctx, int samples);
+int hash_open(struct meminfo_ctx *ctx, const char *path);
+void hash_commit(struct meminfo_ctx *ctx);
+int hash_set_threshold(struct meminfo_ctx *ctx, const char *spec);
+void hash_set_free(struct meminfo_ctx *ctx, uint64_t kb);
+void hash_set_report(struct meminfo_ctx *ctx, leak_report_fn fn, void *arg);
+int detect_leak(struct meminfo_ctx *ctx);
+int hash_verdicts(struct meminfo_ctx *ctx, leak_report_fn fn, void *arg);
+int hash_quantiles(struct meminfo_ctx *ctx, const char *cmdline,
+        struct quantiles *hour, struct quantiles *day);
+void print_quantiles(struct meminfo_ctx *ctx);
+void print_tracker_stats(struct meminfo_ctx *ctx);
+int64_t hash_now(void);
+int hash_insert(struct meminfo_ctx *ctx, struct meminfo *minfo);
+int hash_insert_item(struct meminfo_ctx *ctx, struct proc_info *item, int64_t ts);
 
 #endif
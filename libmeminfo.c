@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <time.h>
+#include <dirent.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "context.h"
+
+struct meminfo_ctx *meminfo_ctx_new(void)
+{
+    struct meminfo_ctx *ctx = calloc(1, sizeof(*ctx));
+
+    if (ctx == NULL)
+        return NULL;
+    if ((ctx->root = strdup(MEMINFO_ROOT)) == NULL) {
+        free(ctx);
+        return NULL;
+    }
+    collector_init(ctx);
+    tracker_init(&ctx->tr);
+    ctx->tr.root = ctx->root;
+    return ctx;
+}
+
+void meminfo_ctx_free(struct meminfo_ctx *ctx)
+{
+    if (ctx == NULL)
+        return;
+    serve_close(ctx);
+    psi_close(ctx);
+    hash_clear(ctx);
+    record_close(ctx);
+    replay_close(ctx);
+    files_free(ctx->files);
+    free(ctx->prof);
+    free(ctx->root);
+    free(ctx);
+}
+
+/* record what went wrong, returns err so callers can return it as is */
+int ctx_error(struct meminfo_ctx *ctx, int err, const char *fmt, ...)
+{
+    va_list ap;
+
+    ctx->err = err;
+    va_start(ap, fmt);
+    vsnprintf(ctx->errmsg, sizeof(ctx->errmsg), fmt, ap);
+    va_end(ap);
+    return err;
+}
+
+const char *meminfo_strerror(int err)
+{
+    switch (err) {
+        case MEMINFO_OK: return "success";
+        case MEMINFO_ENOMEM: return "out of memory";
+        case MEMINFO_EIO: return "can't read source";
+        case MEMINFO_EFORMAT: return "source format not understood";
+        case MEMINFO_ENOPROC: return "no process";
+        case MEMINFO_EINVAL: return "invalid argument";
+        case MEMINFO_ESTATE: return "leak state unusable";
+        default: return "unknown error";
+    }
+}
+
+const char *meminfo_last_error(struct meminfo_ctx *ctx)
+{
+    if (ctx->err == MEMINFO_OK)
+        return meminfo_strerror(MEMINFO_OK);
+    return ctx->errmsg[0] ? ctx->errmsg : meminfo_strerror(ctx->err);
+}
+
+/* a process directory with its smaps, the scan has something to read */
+static int root_has_procs(const char *root)
+{
+    char path[PATH_MAX];
+    struct dirent *de;
+    DIR *dir;
+    int found = 0;
+
+    snprintf(path, sizeof(path), "%s" PROCDIR, root);
+    if ((dir = opendir(path)) == NULL)
+        return 0;
+    while (!found && (de = readdir(dir)) != NULL) {
+        if (!isdigit((unsigned char)de->d_name[0]))
+            continue;
+        snprintf(path, sizeof(path), "%s" PROCDIR "/%s/smaps", root, de->d_name);
+        found = access(path, R_OK) == 0;
+    }
+    closedir(dir);
+    return found;
+}
+
+/*
+ * read everything under dir instead, laid out like the device: a
+ * captured tree such as a bug report extract. checked once here,
+ * without /proc/meminfo or a process with its smaps it's refused; an
+ * optional source that isn't there is turned off.
+ */
+int meminfo_set_root(struct meminfo_ctx *ctx, const char *dir)
+{
+    char path[PATH_MAX], *root;
+    struct stat st;
+    size_t len = strlen(dir);
+
+    // "/" is the empty root, the paths carry their own slash
+    while (len > 0 && dir[len - 1] == '/')
+        len--;
+    if (stat(dir, &st) < 0 || !S_ISDIR(st.st_mode))
+        return ctx_error(ctx, MEMINFO_EINVAL, "%s isn't a directory", dir);
+    if ((root = strndup(dir, len)) == NULL)
+        return ctx_error(ctx, MEMINFO_ENOMEM, "strdup root error");
+
+    snprintf(path, sizeof(path), "%s" PROC_MEMINFO, root);
+    if (access(path, R_OK) < 0) {
+        free(root);
+        return ctx_error(ctx, MEMINFO_EIO, "no %s under %s", PROC_MEMINFO, dir);
+    }
+    if (!root_has_procs(root)) {
+        free(root);
+        return ctx_error(ctx, MEMINFO_ENOPROC, "no process smaps under %s" PROCDIR, dir);
+    }
+
+    free(ctx->root);
+    ctx->root = root;
+    ctx->tr.root = root;
+    collector_set_root(ctx);
+    return 0;
+}
+
+/* where the context reads from, "" for the device itself */
+const char *meminfo_root(struct meminfo_ctx *ctx)
+{
+    return ctx->root;
+}
+
+/* keep warnings about disabled sources off stderr, for batch workers */
+void meminfo_set_quiet(struct meminfo_ctx *ctx, int quiet)
+{
+    ctx->quiet = quiet;
+}
+
+struct meminfo *meminfo_snapshot(struct meminfo_ctx *ctx)
+{
+    struct meminfo *minfo = calloc(1, sizeof(struct meminfo));
+    time_t now;
+
+    if (minfo == NULL) {
+        ctx_error(ctx, MEMINFO_ENOMEM, "calloc meminfo error");
+        return NULL;
+    }
+    time(&now);
+    localtime_r(&now, &minfo->timestap);
+    if (get_snapshot(ctx, minfo) < 0) {
+        meminfo_free(minfo);
+        return NULL;
+    }
+    return minfo;
+}
+
+void meminfo_free(struct meminfo *minfo)
+{
+    int i;
+
+    if (minfo == NULL)
+        return;
+    if (minfo->pss != NULL) {
+        for (i = 0; i < minfo->num_procs; i++)
+            free(minfo->pss[i]);
+        free(minfo->pss);
+    }
+    free(minfo->files);
+    free(minfo);
+}
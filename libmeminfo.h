@@ -0,0 +1,45 @@
+#ifndef MEMINFO_LIBMEMINFO_H
+#define MEMINFO_LIBMEMINFO_H
+
+/*
+ * in process api. a context holds the kernel source settings and the
+ * leak tracker, so several can live in one process, each used by one
+ * thread at a time. calls return 0 or a negative meminfo_error and
+ * never exit, meminfo_last_error() tells what went wrong.
+ */
+
+#include "getpss.h"
+#include "getmem.h"
+#include "hash.h"
+#include "record.h"
+#include "diff.h"
+#include "output.h"
+#include "serve.h"
+#include "batch.h"
+#include "files.h"
+#include "profile.h"
+#include "psi.h"
+
+enum meminfo_error {
+    MEMINFO_OK = 0,
+    MEMINFO_ENOMEM = -1,
+    MEMINFO_EIO = -2,       /* a source couldn't be read */
+    MEMINFO_EFORMAT = -3,   /* a source didn't parse */
+    MEMINFO_ENOPROC = -4,   /* no process to look at */
+    MEMINFO_EINVAL = -5,    /* bad argument */
+    MEMINFO_ESTATE = -6,    /* leak state unusable */
+};
+
+struct meminfo_ctx *meminfo_ctx_new(void);
+void meminfo_ctx_free(struct meminfo_ctx *ctx);
+const char *meminfo_strerror(int err);
+const char *meminfo_last_error(struct meminfo_ctx *ctx);
+int meminfo_set_root(struct meminfo_ctx *ctx, const char *dir);
+const char *meminfo_root(struct meminfo_ctx *ctx);
+void meminfo_set_quiet(struct meminfo_ctx *ctx, int quiet);
+
+/* a full snapshot, kernel and processes; NULL on error */
+struct meminfo *meminfo_snapshot(struct meminfo_ctx *ctx);
+void meminfo_free(struct meminfo *minfo);
+
+#endif
@@ -11,6 +11,7 @@
 #include <ctype.h>
 #include <stdbool.h>
 #include <getopt.h>
+#include <limits.h>
 
 /*
  * headers for unix like programming environment
@@ -22,22 +23,59 @@
 #include <sys/types.h>	/* for type like int8_t uint32_t etc. */
 #include <sys/time.h>	/* for time */
 
-#include "getmem.h"
-#include "getpss.h"
+#include "libmeminfo.h"
 #include "error.h"
-#include "hash.h"
 
 extern char *optarg;
 extern int optind;
 
+static struct meminfo_ctx *ctx;
+static struct out out;
+
 static void usage(const char *cmd)
 {
+    char names[256];
+
     fprintf(stderr, "Usage: %s [options] [pid or proc name]\n", cmd);
     fprintf(stderr, "Options include:\n"
-//            "  -f <filename>   Log to file. Default to stdout\n"
+            "  -f <filename>   record every snapshot to a compact binary file\n"
             "  -t <time>       dump meminfo every specific time in second\n"
             "  -l              detect leak\n"
-            "  -h              show help\n");
+            "  -n <samples>    samples of history kept per process (default %d)\n"
+            "  -p <file>       keep the leak detector state in file across restarts\n"
+            "  -r <kB/h>       leak report threshold, e.g. 2048 or total=4096,native=512\n"
+            "  -Q              keep hour and day pss quantiles, print them on SIGUSR1\n"
+            "  -M <kB>         memory budget of the whole tool, least interesting\n"
+            "                  processes are dropped to keep its rss within it\n"
+            "  -c <list>       kernel sources to collect, e.g. ion,gpu or -vmalloc\n"
+            "                  (%s)\n"
+            "  -s, --stats     print the cost of each kernel source and snapshot timing,\n"
+            "                  and of each stage with a -DMEMINFO_PROFILE build\n"
+            "  --diff <a> <b>  per process and per heap deltas from snapshot a to b;\n"
+            "                  each a recording (its last tick, or file@n for tick n)\n"
+            "                  or - for the system now, - - takes two -t apart\n"
+            "  --format <fmt>  text (default), json or csv, json lines carry leak\n"
+            "                  reports too\n"
+            "  --serve <addr>  serve OpenMetrics of the last snapshot over http on\n"
+            "                  [host:]port (loopback by default) or a unix socket\n"
+            "                  path, /path or @abstract\n"
+            "  --files <n>     sum pss of each mapped file over every process, print\n"
+            "                  the top n\n"
+            "  --psi <trigger> snapshot when memory pressure crosses the trigger,\n"
+            "                  e.g. \"%s\" (stall and window in us),\n"
+            "                  only /proc/meminfo every -t seconds (default %d) between\n"
+            "  --root <dir>    read /proc and /sys under dir, a tree captured from a\n"
+            "                  device (default %s)\n"
+            "  --replay <file> play back a -f recording instead of reading the system,\n"
+            "                  through the tracker with -l or -Q, one tick per -t\n"
+            "                  seconds of recorded time (default every tick)\n"
+            "  --batch <path>...\n"
+            "                  summarize many captured trees, directories or ustar\n"
+            "                  files (- reads the paths from stdin), then the fleet\n"
+            "  -j <jobs>       --batch worker threads (default one per core)\n"
+            "  -h              show help\n", RING_SIZE,
+            collector_names(names, sizeof(names)), PSI_DEFAULT_TRIGGER, PSI_DEFAULT_INTERVAL,
+            MEMINFO_ROOT[0] ? MEMINFO_ROOT : "/");
 }
 
 /*
@@ -57,56 +95,269 @@ static int catch_sig(int signo, void(*handler)())
     return 1;
 }
 
-static void clean_quit(int signo)
+static volatile sig_atomic_t want_quantiles;
+
+static void query_quantiles(int signo)
+{
+    (void)signo;
+    want_quantiles = 1;
+}
+
+/* the main loop winds down at the end of its tick, see clean_quit */
+static volatile sig_atomic_t quit_signal;
+
+static void catch_quit(int signo)
 {
-    printf("Terminating early on signal %d\n", signo);
-    hash_clear();
+    quit_signal = signo;
+}
+
+static void clean_quit(void)
+{
+    printf("Terminating early on signal %d\n", (int)quit_signal);
+    out_free(&out);
+    meminfo_ctx_free(ctx);
     exit(-1);
 }
 
-static int get_time(struct meminfo *minfo)
+static void flush_out(void)
 {
-    time_t rawtime;
+    if (out_flush(&out) < 0)
+        err_msg("output of this tick lost\n");
+}
 
-    time(&rawtime);
-    minfo->timestap = *localtime(&rawtime);
-    //printf("Current local time and date: %s", asctime(minfo->timestap));
-    return 0;
+/* a snapshot in the chosen format, prev is the codec view of the one before */
+static void print_snapshot(struct meminfo *minfo, const struct codec_info *prev)
+{
+    if (out.format == FORMAT_TEXT) {
+        print_procmem(&out, minfo);
+        print_files(&out, minfo);
+        print_meminfo(&out, minfo->item);
+        print_codec_mem(&out, &minfo->codec, prev);
+    } else {
+        out_snapshot(&out, minfo);
+    }
+    flush_out();
+}
+
+static void report_json(void *arg, const struct leak_event *ev)
+{
+    out_leak_event(arg, ev);
+}
+
+/*
+ * a recording fed through the same printers and tracker as live
+ * snapshots, as fast as it decodes. the interval is in recorded time.
+ */
+static void replay(const char *path, int interval, int track)
+{
+    struct meminfo *minfo;
+    struct timespec start, end;
+    int64_t ts, next = 0;
+    unsigned long ticks = 0, used = 0;
+    int ret;
+
+    if (replay_open(ctx, path) < 0)
+        err_quit("can't replay %s: %s\n", path, meminfo_last_error(ctx));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while ((ret = replay_next(ctx, &minfo)) > 0) {
+        ticks++;
+        ts = (int64_t)minfo->kern_start.tv_sec * 1000 + minfo->kern_start.tv_nsec / 1000000;
+        if (ts < next)
+            continue;
+        next = ts + interval * 1000LL;
+        used++;
+
+        // totals as a live tick has them, before the tracker sees them
+        stat_procmem(minfo);
+        if (!track) {
+            print_snapshot(minfo, NULL);
+            if (out.format == FORMAT_TEXT)
+                printf("---------------------------------------------------------\n");
+            continue;
+        }
+        hash_set_free(ctx, minfo->item[MEMINFO_FREE].num
+                + minfo->item[MEMINFO_CACHED].num
+                - minfo->item[MEMINFO_MAPPED].num);
+        if (hash_insert(ctx, minfo) < 0)
+            err_quit("%s\n", meminfo_last_error(ctx));
+        detect_leak(ctx);
+        flush_out();
+    }
+    if (ret < 0)
+        err_msg("%s\n", meminfo_last_error(ctx));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (track && out.format == FORMAT_TEXT) {
+        print_quantiles(ctx);
+        print_tracker_stats(ctx);
+    }
+    fprintf(stderr, "replayed %lu of %lu ticks in %.3f s\n", used, ticks,
+            (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+    replay_close(ctx);
 }
 
-static void clear_minfo(struct meminfo *minfo)
+/*
+ * a snapshot to diff: "-" is the system now, anything else a recording,
+ * its last tick or tick n of it with file@n
+ */
+static struct meminfo *diff_snapshot(const char *spec)
 {
-    int i;
+    struct meminfo *minfo;
+    char *path, *at;
+    long n = -1;
+
+    if (!strcmp(spec, "-")) {
+        minfo = meminfo_snapshot(ctx);
+    } else {
+        path = strdup(spec);
+        if ((at = strrchr(path, '@')) != NULL && isdigit(at[1])) {
+            n = atol(at + 1);
+            *at = '\0';
+        }
+        minfo = replay_load(ctx, path, n);
+        free(path);
+    }
     if (minfo == NULL)
-        return;
-    if (minfo->pss == NULL) {
-        free(minfo);
-        return;
+        err_quit("%s: %s\n", spec, meminfo_last_error(ctx));
+    return minfo;
+}
+
+/* the paths after the options, "-" for one per line on stdin; failed count */
+static int batch(char **args, int nargs, int jobs, const char *collectors)
+{
+    struct batch_opts opts;
+    char line[PATH_MAX], **paths = NULL;
+    int i, n = 0, cap = 0, ret;
+    size_t len;
+
+    for (i = 0; i < nargs; i++) {
+        FILE *fp = strcmp(args[i], "-") ? NULL : stdin;
+
+        do {
+            if (fp != NULL) {
+                if (fgets(line, sizeof(line), fp) == NULL)
+                    break;
+                len = strlen(line);
+                while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+                    line[--len] = '\0';
+                if (len == 0)
+                    continue;
+            }
+            if (n == cap) {
+                cap = cap ? cap * 2 : 64;
+                if ((paths = realloc(paths, cap * sizeof(*paths))) == NULL)
+                    err_sys("realloc batch paths error\n");
+            }
+            if ((paths[n++] = strdup(fp != NULL ? line : args[i])) == NULL)
+                err_sys("strdup batch path error\n");
+        } while (fp != NULL);
     }
+    if (n == 0)
+        err_quit("--batch needs a directory or a tar file\n");
+
+    opts.paths = paths;
+    opts.npaths = n;
+    opts.jobs = jobs;
+    opts.collectors = collectors;
+    if ((ret = batch_run(ctx, &opts, &out)) < 0)
+        err_quit("%s\n", meminfo_last_error(ctx));
+    flush_out();
+    if (ret > 0)
+        err_msg("%d of %d snapshots failed\n", ret, n);
+
+    for (i = 0; i < n; i++)
+        free(paths[i]);
+    free(paths);
+    return ret;
+}
+
+/* heartbeats until memory pressure crosses the trigger */
+static void wait_pressure(void)
+{
+    struct heartbeat hb;
+    int ret;
+
+    while (!quit_signal && (ret = psi_wait(ctx)) != PSI_FIRED) {
+        if (ret < 0)
+            err_quit("%s\n", meminfo_last_error(ctx));
+        if (want_quantiles) {
+            want_quantiles = 0;
+            print_quantiles(ctx);
+        }
+        if (ret != PSI_BEAT)
+            continue;
+        if (psi_heartbeat(ctx, &hb) < 0) {
+            err_msg("%s\n", meminfo_last_error(ctx));
+            continue;
+        }
+        print_heartbeat(&out, &hb);
+        flush_out();
+    }
+}
+
+static void diff(const char *spec_a, const char *spec_b, int interval)
+{
+    struct meminfo *a, *b;
+    struct snapshot_diff d;
 
-    for(i = 0; i < minfo->num_procs; i++)
-        if (minfo->pss[i])
-            free(minfo->pss[i]);
+    a = diff_snapshot(spec_a);
+    if (!strcmp(spec_a, "-") && !strcmp(spec_b, "-"))
+        sleep(interval > 0 ? interval : 1);
+    b = diff_snapshot(spec_b);
 
-    free(minfo->pss);
-    free(minfo);
+    if (snapshot_diff(ctx, a, b, &d) < 0)
+        err_quit("%s\n", meminfo_last_error(ctx));
+    print_diff(a, b, &d);
+    snapshot_diff_free(&d);
+    meminfo_free(a);
+    meminfo_free(b);
 }
 
 int main(int argc, char *argv[])
 {
     int c, index = 0, time = 0, count = 1;
-    int pid = -1, ret, leak = 0;
+    int pid = -1, ret, leak = 0, stats = 0, quant = 0;
+    unsigned int left;
     char *procn = NULL;
-    char *outfile;
+    char *outfile = NULL;
+    char *statefile = NULL;
+    char *replayfile = NULL;
+    char *diffa = NULL;
+    char *serveaddr = NULL;
+    char *rootdir = NULL;
+    char *trigger = NULL;
+    char *collectors = NULL;
+    int batchmode = 0, jobs = 0;
+    int format = FORMAT_TEXT;
+    unsigned long long budget = 0;
+    struct codec_info last_codec;
+    int have_codec = 0;
+    struct proc_info procs, *pp = &procs;
+    struct meminfo one, *minfo;
+    struct prof *prof = NULL;
+    PROF_SPAN(span);
+
+    if ((ctx = meminfo_ctx_new()) == NULL)
+        err_sys("calloc meminfo context error\n");
 
     /* option_name, has_arg(0: none, 1:recquired, 2 optional), flag, return_value) */
     static struct option long_opts[] = {
         {"help", 0, NULL, 'h'},
         {"version", 0, NULL, 'v'},
+        {"stats", 0, NULL, 's'},
+        {"replay", 1, NULL, 'R'},
+        {"diff", 1, NULL, 'D'},
+        {"format", 1, NULL, 'F'},
+        {"serve", 1, NULL, 'S'},
+        {"root", 1, NULL, 'P'},
+        {"batch", 0, NULL, 'B'},
+        {"files", 1, NULL, 'A'},
+        {"psi", 1, NULL, 'T'},
         {0, 0, NULL, 0}
     };
 
-    while ((c=getopt_long(argc, argv, "f:t:lhv", long_opts, &index)) != EOF) {
+    while ((c=getopt_long(argc, argv, "f:t:ln:p:r:QM:c:j:shv", long_opts, &index)) != EOF) {
         switch (c) {
         case 'f':
             count += 2;
@@ -123,6 +374,78 @@ int main(int argc, char *argv[])
             count += 1;
             leak = 1;
             break;
+        case 'n':
+            count += 2;
+            if (!isdigit(optarg[0]) || hash_set_capacity(ctx, atoi(optarg)) < 0)
+                err_quit("samples should be a number of at least 4\n");
+            break;
+        case 'p':
+            count += 2;
+            statefile = strdup(optarg);
+            break;
+        case 'r':
+            count += 2;
+            if (hash_set_threshold(ctx, optarg) < 0)
+                err_quit("bad leak threshold %s\n", optarg);
+            break;
+        case 'Q':
+            count += 1;
+            quant = 1;
+            break;
+        case 'M':
+            count += 2;
+            if (!isdigit(optarg[0]) || (budget = strtoull(optarg, NULL, 10)) == 0)
+                err_quit("memory budget should be a number of kB\n");
+            break;
+        case 'c':
+            count += 2;
+            if (collector_mask(ctx, optarg) < 0)
+                err_quit("bad collector list %s: %s\n", optarg, meminfo_last_error(ctx));
+            collectors = strdup(optarg);
+            break;
+        case 'j':
+            count += 2;
+            if (!isdigit(optarg[0]) || (jobs = atoi(optarg)) < 1)
+                err_quit("jobs should be a number of at least 1\n");
+            break;
+        case 'A':
+            count += 2;
+            if (!isdigit(optarg[0]) || meminfo_set_files(ctx, atoi(optarg)) < 0)
+                err_quit("files should be a number\n");
+            break;
+        case 'B':
+            count += 1;
+            batchmode = 1;
+            break;
+        case 's':
+            count += 1;
+            stats = 1;
+            break;
+        case 'R':
+            count += 2;
+            replayfile = strdup(optarg);
+            break;
+        case 'D':
+            count += 2;
+            diffa = strdup(optarg);
+            break;
+        case 'F':
+            count += 2;
+            if ((format = out_format(optarg)) < 0)
+                err_quit("format should be text, json or csv\n");
+            break;
+        case 'S':
+            count += 2;
+            serveaddr = strdup(optarg);
+            break;
+        case 'P':
+            count += 2;
+            rootdir = strdup(optarg);
+            break;
+        case 'T':
+            count += 2;
+            trigger = strdup(optarg);
+            break;
         case 'v':
             printf("version 0.1\n");
             exit(0);
@@ -133,6 +456,51 @@ int main(int argc, char *argv[])
         }
     }
 
+    // each snapshot gets a context of its own, nothing is kept across them
+    if (batchmode) {
+        if (leak || quant || time || outfile != NULL || statefile != NULL || serveaddr != NULL
+                || replayfile != NULL || diffa != NULL || rootdir != NULL || trigger != NULL)
+            err_quit("--batch doesn't go with -l, -Q, -t, -f, -p, --serve, --replay, --diff, --root or --psi\n");
+        if (stats || format == FORMAT_CSV)
+            err_quit("--batch prints text or json\n");
+        out_init(&out, STDOUT_FILENO, format);
+        ret = batch(argv + optind, argc - optind, jobs, collectors);
+        meminfo_ctx_free(ctx);
+        return ret > 0 ? 1 : 0;
+    }
+    if (jobs > 0)
+        err_quit("-j is for --batch\n");
+
+    // after -c, the sources missing from the tree are turned off up front
+    if (rootdir != NULL && meminfo_set_root(ctx, rootdir) < 0)
+        err_quit("bad --root: %s\n", meminfo_last_error(ctx));
+
+    // the machine readable formats only carry what they have a shape for
+    if (format != FORMAT_TEXT && (stats || quant || diffa != NULL))
+        err_quit("-s, -Q and --diff only print text\n");
+    if (format == FORMAT_CSV && leak)
+        err_quit("leak reports need --format=json or text\n");
+    if (format == FORMAT_CSV && trigger != NULL)
+        err_quit("heartbeats need --format=json or text\n");
+    out_init(&out, STDOUT_FILENO, format);
+    // a build without the spans has the collector costs only
+    if (stats && meminfo_set_profile(ctx, 1) == 0)
+        prof = meminfo_profile(ctx);
+    if (format == FORMAT_JSON)
+        hash_set_report(ctx, report_json, &out);
+
+    if (diffa != NULL) {
+        if (serveaddr != NULL || trigger != NULL)
+            err_quit("--diff doesn't go with --serve or --psi\n");
+        if (argc - count != 1) {
+            usage(argv[0]);
+            exit(0);
+        }
+        diff(diffa, argv[argc-1], time);
+        meminfo_ctx_free(ctx);
+        return 0;
+    }
+
     if (argc - count == 1) {
         if (isdigit(argv[argc-1][0]))
             pid = atoi(argv[argc-1]);
@@ -143,69 +511,158 @@ int main(int argc, char *argv[])
             exit(0);
     }
 
-    if (leak == 1 && time == 0)
+    // with --psi, -t is the heartbeat between triggers
+    if (trigger != NULL) {
+        if (pid != -1 || procn != NULL)
+            err_quit("--psi takes whole system snapshots\n");
+        if (time == 0)
+            time = PSI_DEFAULT_INTERVAL;
+    }
+    // a replay goes through every recorded tick unless -t thins it out
+    if ((leak || quant || serveaddr != NULL) && time == 0 && replayfile == NULL)
         time = 60;
 
+    hash_set_mode(ctx, (leak ? TRACK_LEAK : 0) | (quant ? TRACK_QUANTILE : 0)
+            | (replayfile != NULL ? TRACK_REPLAY : 0));
+    if (budget > 0 && hash_set_budget(ctx, budget) < 0)
+        err_quit("memory budget %llu kB is too small\n", budget);
+    if (replayfile != NULL) {
+        if (statefile != NULL || outfile != NULL || serveaddr != NULL || trigger != NULL)
+            err_quit("--replay doesn't go with -p, -f, --serve or --psi\n");
+        replay(replayfile, time, leak || quant);
+        meminfo_ctx_free(ctx);
+        return 0;
+    }
+    if ((leak || quant) && statefile != NULL && hash_open(ctx, statefile) < 0)
+        err_quit("can't use state file %s: %s\n", statefile, meminfo_last_error(ctx));
+
     /*
      *  We want to catch the interrupt signal
      *  We should probably clean up memory
      *  and free up the hashtable before we go.
      */
-    if (catch_sig(SIGINT, clean_quit) == -1) {
+    if (outfile != NULL && record_open(ctx, outfile) < 0)
+        err_quit("can't record to %s: %s\n", outfile, meminfo_last_error(ctx));
+    if (serveaddr != NULL && serve_open(ctx, serveaddr) < 0)
+        err_quit("can't serve metrics: %s\n", meminfo_last_error(ctx));
+    if (trigger != NULL && psi_open(ctx, trigger, time) < 0)
+        err_quit("can't watch memory pressure: %s\n", meminfo_last_error(ctx));
+
+    if (catch_sig(SIGINT, catch_quit) == -1) {
         err_quit("can't catch SIGINT signal.\n");
     }
+    if (quant && catch_sig(SIGUSR1, query_quantiles) == -1)
+        err_quit("can't catch SIGUSR1 signal.\n");
 
-    count = 0;
     do {
+        minfo = NULL;
         if (pid != -1 || procn != NULL) {
-            struct proc_info procs;
+            struct timespec now;
+
             if (procn != NULL)
-                if ((pid = get_pid(procn)) == -1)
+                if ((pid = get_pid(meminfo_root(ctx), procn)) == -1)
                     err_quit("process %s not running\n", procn);
 
-            if (getprocname(pid, procs.cmdline, sizeof(procs.cmdline)) != 0)
+            if (getprocname(meminfo_root(ctx), pid, procs.cmdline, sizeof(procs.cmdline)) != 0)
                 err_quit("count not find process of pid %d\n", pid);
 
             procs.pid = pid;
-            if ((ret = get_pss(&procs)) == -1) {
+            if ((ret = get_pss(meminfo_root(ctx), &procs)) == -1) {
                 err_msg("get pss of pid %d error\n", pid);
                 continue;
             }
 
-            print_pss(&procs);
-            if (leak) {
-                hash_insert_item(&procs);
-                count++;
+            // a snapshot of just this process for the formats and the recording
+            memset(&one, 0, sizeof(one));
+            one.pss = &pp;
+            one.num_procs = 1;
+            stat_procmem(&one);
+            clock_gettime(CLOCK_REALTIME, &now);
+            localtime_r(&now.tv_sec, &one.timestap);
+
+            if (out.format == FORMAT_TEXT)
+                print_pss(&out, &procs);
+            else
+                out_snapshot(&out, &one);
+            flush_out();
+            if (outfile != NULL && record_tick(ctx, &one) < 0)
+                err_msg("%s\n", meminfo_last_error(ctx));
+            // the total stat_procmem just summed
+            if (leak || quant) {
+                if (hash_insert_item(ctx, one.pss[0], hash_now()) < 0)
+                    err_msg("%s\n", meminfo_last_error(ctx));
             }
+            minfo = &one;
         } else {
-            struct meminfo *minfo;
-            minfo = calloc(1, sizeof(struct meminfo));
+            minfo = meminfo_snapshot(ctx);
             if (minfo == NULL)
-                err_sys("calloc meminfo error\n");
+                err_quit("%s\n", meminfo_last_error(ctx));
+            if (psi_snapshot(ctx, minfo) > 0)
+                print_psi_trigger(ctx, &out);
 
-            get_time(minfo);
-            get_procmem(minfo);
-            get_mem(minfo);
-            print_procmem(minfo);
-            print_meminfo(minfo->item);
+            PROF_BEGIN(prof, span);
+            print_snapshot(minfo, have_codec ? &last_codec : NULL);
+            PROF_END(prof, PROF_PRINT, span);
+            last_codec = minfo->codec;
+            have_codec = 1;
+            if (outfile != NULL && record_tick(ctx, minfo) < 0)
+                err_msg("%s\n", meminfo_last_error(ctx));
 
-            if (leak) {
-                hash_insert(minfo);
-                count++;
+            if (leak || quant) {
+                PROF_BEGIN(prof, span);
+                hash_set_free(ctx, minfo->item[MEMINFO_FREE].num
+                        + minfo->item[MEMINFO_CACHED].num
+                        - minfo->item[MEMINFO_MAPPED].num);
+                if (hash_insert(ctx, minfo) < 0)
+                    err_quit("%s\n", meminfo_last_error(ctx));
+                PROF_END(prof, PROF_LEAK, span);
             }
-            clear_minfo(minfo);
         }
 
-        if (leak) {
-            detect_leak();
-            if (!(count % SHRINK_SIZE))
-                hash_shrink();
+        if (leak || quant) {
+            PROF_BEGIN(prof, span);
+            detect_leak(ctx);
+            hash_commit(ctx);
+            flush_out();
+            if (out.format == FORMAT_TEXT)
+                print_tracker_stats(ctx);
+            PROF_END(prof, PROF_LEAK, span);
+        }
+        // the whole tick is in, leak check included
+        if (prof != NULL)
+            prof_tick(prof);
+        if (stats && minfo != NULL && minfo != &one) {
+            print_collector_stats(ctx);
+            print_profile(ctx);
+            print_snapshot_skew(minfo);
+            print_psi_stats(ctx);
         }
+        // after the leak check, the scrapes get its verdicts with the tick
+        if (serveaddr != NULL && minfo != NULL && serve_publish(ctx, minfo) < 0)
+            err_msg("%s\n", meminfo_last_error(ctx));
+        if (minfo != &one)
+            meminfo_free(minfo);
         if (time > 0) {
-            printf("---------------------------------------------------------\n");
-            sleep(time);
+            if (out.format == FORMAT_TEXT)
+                printf("---------------------------------------------------------\n");
+            if (trigger != NULL) {
+                wait_pressure();
+            } else {
+                // a query cuts the sleep short, finish it after answering
+                for (left = time; left > 0 && !quit_signal; ) {
+                    left = sleep(left);
+                    if (want_quantiles) {
+                        want_quantiles = 0;
+                        print_quantiles(ctx);
+                    }
+                }
+            }
         }
-    } while(time);
+    } while(time && !quit_signal);
 
+    if (quit_signal)
+        clean_quit();
+    out_free(&out);
+    meminfo_ctx_free(ctx);
     return 0;
 }
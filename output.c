@@ -0,0 +1,559 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <unistd.h>
+
+#include "output.h"
+#include "getmem.h"
+#include "hash.h"
+#include "files.h"
+
+int out_format(const char *name)
+{
+    if (!strcmp(name, "text"))
+        return FORMAT_TEXT;
+    if (!strcmp(name, "json"))
+        return FORMAT_JSON;
+    if (!strcmp(name, "csv"))
+        return FORMAT_CSV;
+    return -1;
+}
+
+void out_init(struct out *o, int fd, int format)
+{
+    memset(o, 0, sizeof(*o));
+    o->fd = fd;
+    o->format = format;
+}
+
+void out_free(struct out *o)
+{
+    free(o->buf);
+    o->buf = NULL;
+    o->len = o->cap = 0;
+}
+
+/* room for n more bytes, NULL once out of memory */
+static char *out_reserve(struct out *o, size_t n)
+{
+    size_t cap;
+    char *buf;
+
+    if (o->failed)
+        return NULL;
+    if (o->len + n > o->cap) {
+        cap = o->cap ? o->cap : OUT_INIT_SIZE;
+        while (cap < o->len + n)
+            cap *= 2;
+        if ((buf = realloc(o->buf, cap)) == NULL) {
+            o->failed = 1;
+            return NULL;
+        }
+        o->buf = buf;
+        o->cap = cap;
+    }
+    return o->buf + o->len;
+}
+
+/*
+ * write out what the tick produced. text printed through stdio before
+ * it goes first, so the two can be mixed.
+ */
+int out_flush(struct out *o)
+{
+    size_t off = 0;
+    ssize_t n;
+    int ret = 0;
+
+    if (o->failed) {
+        o->failed = 0;
+        o->len = 0;
+        return -1;
+    }
+    if (o->len == 0)
+        return 0;
+    if (o->fd == STDOUT_FILENO)
+        fflush(stdout);
+
+    // a pipe may take less than all of it
+    while (off < o->len) {
+        n = write(o->fd, o->buf + off, o->len - off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            ret = -1;
+            break;
+        }
+        off += n;
+    }
+    o->len = 0;
+    return ret;
+}
+
+void out_mem(struct out *o, const char *s, size_t n)
+{
+    char *p = out_reserve(o, n);
+
+    if (p == NULL)
+        return;
+    memcpy(p, s, n);
+    o->len += n;
+}
+
+void out_str(struct out *o, const char *s)
+{
+    out_mem(o, s, strlen(s));
+}
+
+void out_char(struct out *o, char c)
+{
+    char *p = out_reserve(o, 1);
+
+    if (p == NULL)
+        return;
+    *p = c;
+    o->len++;
+}
+
+static void out_spaces(struct out *o, int n)
+{
+    char *p;
+
+    if (n <= 0 || (p = out_reserve(o, n)) == NULL)
+        return;
+    memset(p, ' ', n);
+    o->len += n;
+}
+
+/* s padded to width like %*s */
+void out_pad(struct out *o, const char *s, int width)
+{
+    int len = strlen(s);
+
+    if (width > 0)
+        out_spaces(o, width - len);
+    out_mem(o, s, len);
+    if (width < 0)
+        out_spaces(o, -width - len);
+}
+
+static void out_num(struct out *o, uint64_t v, int neg, int width)
+{
+    char tmp[24], *p = tmp + sizeof(tmp);
+
+    do {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while (v != 0);
+    if (neg)
+        *--p = '-';
+
+    if (width > 0)
+        out_spaces(o, width - (int)(tmp + sizeof(tmp) - p));
+    out_mem(o, p, tmp + sizeof(tmp) - p);
+    if (width < 0)
+        out_spaces(o, -width - (int)(tmp + sizeof(tmp) - p));
+}
+
+void out_u64(struct out *o, uint64_t v, int width)
+{
+    out_num(o, v, 0, width);
+}
+
+void out_i64(struct out *o, int64_t v, int width)
+{
+    out_num(o, v < 0 ? -(uint64_t)v : (uint64_t)v, v < 0, width);
+}
+
+/* the + of %+d, the - comes with the number */
+void out_sign(struct out *o, int64_t v)
+{
+    if (v >= 0)
+        out_char(o, '+');
+}
+
+static void out_json_mem(struct out *o, const char *s, size_t n)
+{
+    static const char hex[] = "0123456789abcdef";
+    unsigned char c;
+    size_t i;
+
+    out_char(o, '"');
+    for (i = 0; i < n; i++) {
+        c = s[i];
+        if (c == '"' || c == '\\') {
+            out_char(o, '\\');
+            out_char(o, c);
+        } else if (c == '\n') {
+            out_mem(o, "\\n", 2);
+        } else if (c < 0x20) {
+            out_mem(o, "\\u00", 4);
+            out_char(o, hex[c >> 4]);
+            out_char(o, hex[c & 15]);
+        } else {
+            out_char(o, c);
+        }
+    }
+    out_char(o, '"');
+}
+
+void out_json_str(struct out *o, const char *s)
+{
+    out_json_mem(o, s, strlen(s));
+}
+
+/* quoted only when it has to be */
+void out_csv_str(struct out *o, const char *s)
+{
+    if (strpbrk(s, ",\"\r\n") == NULL) {
+        out_str(o, s);
+        return;
+    }
+    out_char(o, '"');
+    for (; *s != '\0'; s++) {
+        if (*s == '"')
+            out_char(o, '"');
+        out_char(o, *s);
+    }
+    out_char(o, '"');
+}
+
+/* a kernel category name as a key, without the colon /proc/meminfo has */
+static size_t label_len(const char *s)
+{
+    size_t n = strlen(s);
+
+    return (n > 0 && s[n - 1] == ':') ? n - 1 : n;
+}
+
+static void out_time(struct out *o, const struct tm *tm)
+{
+    out_u64(o, tm->tm_year + 1900, 0);
+    out_char(o, '-');
+    out_mem(o, "0", tm->tm_mon + 1 < 10);
+    out_u64(o, tm->tm_mon + 1, 0);
+    out_char(o, '-');
+    out_mem(o, "0", tm->tm_mday < 10);
+    out_u64(o, tm->tm_mday, 0);
+    out_char(o, 'T');
+    out_mem(o, "0", tm->tm_hour < 10);
+    out_u64(o, tm->tm_hour, 0);
+    out_char(o, ':');
+    out_mem(o, "0", tm->tm_min < 10);
+    out_u64(o, tm->tm_min, 0);
+    out_char(o, ':');
+    out_mem(o, "0", tm->tm_sec < 10);
+    out_u64(o, tm->tm_sec, 0);
+}
+
+static void json_key(struct out *o, const char *key, int first)
+{
+    if (!first)
+        out_char(o, ',');
+    out_char(o, '"');
+    out_str(o, key);
+    out_mem(o, "\":", 2);
+}
+
+static void json_u64(struct out *o, const char *key, uint64_t v, int first)
+{
+    json_key(o, key, first);
+    out_u64(o, v, 0);
+}
+
+/* the counters after the first six, in struct stats_t order */
+static void json_stats_more(struct out *o, const struct stats_t *s)
+{
+    json_u64(o, "swappable_pss", s->swappablePss, 0);
+    json_u64(o, "swap", s->swap, 0);
+    json_u64(o, "swap_pss", s->swapPss, 0);
+    json_u64(o, "anonymous", s->anonymous, 0);
+    json_u64(o, "anon_huge_pages", s->anonHugePages, 0);
+}
+
+static void csv_stats_more(struct out *o, const struct stats_t *s)
+{
+    out_char(o, ',');
+    out_u64(o, s->swappablePss, 0);
+    out_char(o, ',');
+    out_u64(o, s->swap, 0);
+    out_char(o, ',');
+    out_u64(o, s->swapPss, 0);
+    out_char(o, ',');
+    out_u64(o, s->anonymous, 0);
+    out_char(o, ',');
+    out_u64(o, s->anonHugePages, 0);
+}
+
+static int stats_zero(const struct stats_t *s)
+{
+    return !s->pss && !s->rss && !s->privateDirty && !s->sharedDirty
+        && !s->privateClean && !s->sharedClean && !s->swap && !s->swapPss
+        && !s->anonymous;
+}
+
+/* the processes worth a line */
+static int out_proc_ok(struct proc_info *proc)
+{
+    return proc != NULL && proc->totalpss != 0;
+}
+
+static void json_snapshot(struct out *o, struct meminfo *minfo)
+{
+    const struct stats_t *s;
+    struct proc_info *proc;
+    const char *name;
+    int i, j, first, heap_first;
+
+    out_str(o, "{\"type\":\"snapshot\",\"time\":\"");
+    out_time(o, &minfo->timestap);
+    out_char(o, '"');
+
+    // a single process snapshot comes without the kernel's view
+    if (minfo->item[MEMINFO_TOTAL].num != 0) {
+        out_str(o, ",\"kernel\":{");
+        for (i = 0, first = 1; i < MEMINFO_COUNT; i++) {
+            if ((name = mem_label(minfo->item, i)) == NULL)
+                continue;
+            if (!first)
+                out_char(o, ',');
+            out_json_mem(o, name, label_len(name));
+            out_char(o, ':');
+            out_u64(o, minfo->item[i].num, 0);
+            first = 0;
+        }
+        out_char(o, '}');
+    }
+
+    if (minfo->codec.num_owners > 0) {
+        out_str(o, ",\"codec\":{\"pools\":{");
+        for (i = 0; i < CODEC_POOL_COUNT; i++)
+            json_u64(o, codec_pool_name(i), minfo->codec.pool[i], i == 0);
+        out_str(o, "},\"owners\":[");
+        for (i = 0; i < minfo->codec.num_owners; i++) {
+            out_str(o, i ? ",{\"name\":" : "{\"name\":");
+            out_json_str(o, minfo->codec.owner[i].name);
+            json_u64(o, "bytes", minfo->codec.owner[i].bytes, 0);
+            json_u64(o, "count", minfo->codec.owner[i].cnt, 0);
+            out_char(o, '}');
+        }
+        out_str(o, "]}");
+    }
+
+    out_str(o, ",\"processes\":[");
+    for (i = 0, first = 1; i < minfo->num_procs; i++) {
+        if (!out_proc_ok(proc = minfo->pss[i]))
+            continue;
+        out_str(o, first ? "{" : ",{");
+        first = 0;
+        json_u64(o, "pid", proc->pid, 1);
+        json_u64(o, "starttime", proc->starttime, 0);
+        json_key(o, "cmdline", 0);
+        out_json_str(o, proc->cmdline);
+        json_u64(o, "total_pss", proc->totalpss, 0);
+        json_u64(o, "dalvik_pss", proc->dalvikpss, 0);
+        json_u64(o, "native_pss", proc->nativepss, 0);
+        json_u64(o, "total_uss", proc->totaluss, 0);
+        json_u64(o, "total_rss", proc->totalrss, 0);
+        json_u64(o, "total_swap_pss", proc->totalswappss, 0);
+        json_u64(o, "total_swappable_pss", proc->totalswappable, 0);
+        out_str(o, ",\"heaps\":{");
+        for (j = 0, heap_first = 1; j < _NUM_HEAP; j++) {
+            s = &proc->stats[j];
+            if (stats_zero(s))
+                continue;
+            if (!heap_first)
+                out_char(o, ',');
+            heap_first = 0;
+            out_json_str(o, heap_name(j));
+            out_str(o, ":{");
+            json_u64(o, "pss", s->pss, 1);
+            json_u64(o, "rss", s->rss, 0);
+            json_u64(o, "private_dirty", s->privateDirty, 0);
+            json_u64(o, "shared_dirty", s->sharedDirty, 0);
+            json_u64(o, "private_clean", s->privateClean, 0);
+            json_u64(o, "shared_clean", s->sharedClean, 0);
+            json_stats_more(o, s);
+            out_char(o, '}');
+        }
+        out_str(o, "}}");
+    }
+    out_char(o, ']');
+
+    if (minfo->num_files > 0) {
+        out_str(o, ",\"files\":[");
+        for (i = 0; i < minfo->num_files; i++) {
+            s = &minfo->files[i].stats;
+            out_str(o, i ? ",{\"name\":" : "{\"name\":");
+            out_json_str(o, minfo->files[i].name);
+            json_u64(o, "processes", minfo->files[i].procs, 0);
+            json_u64(o, "pss", s->pss, 0);
+            json_u64(o, "rss", s->rss, 0);
+            json_u64(o, "private_dirty", s->privateDirty, 0);
+            json_u64(o, "shared_dirty", s->sharedDirty, 0);
+            json_u64(o, "private_clean", s->privateClean, 0);
+            json_u64(o, "shared_clean", s->sharedClean, 0);
+            json_stats_more(o, s);
+            out_char(o, '}');
+        }
+        out_char(o, ']');
+    }
+    out_str(o, "}\n");
+}
+
+static void csv_row_head(struct out *o, struct meminfo *minfo)
+{
+    out_time(o, &minfo->timestap);
+    out_char(o, ',');
+}
+
+/*
+ * a row per kernel category and per heap of a process that has any of
+ * it. kernel rows have the value in the pss column and no pid, file
+ * rows have the path as their category and no pid either.
+ */
+static void csv_snapshot(struct out *o, struct meminfo *minfo)
+{
+    const struct stats_t *s;
+    struct proc_info *proc;
+    const char *name;
+    int i, j;
+
+    if (!o->header) {
+        out_str(o, "time,pid,starttime,process,category,pss,rss,"
+                "private_dirty,shared_dirty,private_clean,shared_clean,"
+                "swappable_pss,swap,swap_pss,anonymous,anon_huge_pages\n");
+        o->header = 1;
+    }
+
+    for (i = 0; i < MEMINFO_COUNT && minfo->item[MEMINFO_TOTAL].num != 0; i++) {
+        if ((name = mem_label(minfo->item, i)) == NULL)
+            continue;
+        csv_row_head(o, minfo);
+        out_str(o, ",,kernel,");
+        out_mem(o, name, label_len(name));
+        out_char(o, ',');
+        out_u64(o, minfo->item[i].num, 0);
+        out_str(o, ",,,,,,,,,,\n");
+    }
+
+    for (i = 0; i < minfo->num_procs; i++) {
+        if (!out_proc_ok(proc = minfo->pss[i]))
+            continue;
+        for (j = 0; j < _NUM_HEAP; j++) {
+            s = &proc->stats[j];
+            if (stats_zero(s))
+                continue;
+            csv_row_head(o, minfo);
+            out_u64(o, proc->pid, 0);
+            out_char(o, ',');
+            out_u64(o, proc->starttime, 0);
+            out_char(o, ',');
+            out_csv_str(o, proc->cmdline);
+            out_char(o, ',');
+            out_csv_str(o, heap_name(j));
+            out_char(o, ',');
+            out_u64(o, s->pss, 0);
+            out_char(o, ',');
+            out_u64(o, s->rss, 0);
+            out_char(o, ',');
+            out_u64(o, s->privateDirty, 0);
+            out_char(o, ',');
+            out_u64(o, s->sharedDirty, 0);
+            out_char(o, ',');
+            out_u64(o, s->privateClean, 0);
+            out_char(o, ',');
+            out_u64(o, s->sharedClean, 0);
+            csv_stats_more(o, s);
+            out_char(o, '\n');
+        }
+    }
+
+    for (i = 0; i < minfo->num_files; i++) {
+        s = &minfo->files[i].stats;
+        csv_row_head(o, minfo);
+        out_str(o, ",,file,");
+        out_csv_str(o, minfo->files[i].name);
+        out_char(o, ',');
+        out_u64(o, s->pss, 0);
+        out_char(o, ',');
+        out_u64(o, s->rss, 0);
+        out_char(o, ',');
+        out_u64(o, s->privateDirty, 0);
+        out_char(o, ',');
+        out_u64(o, s->sharedDirty, 0);
+        out_char(o, ',');
+        out_u64(o, s->privateClean, 0);
+        out_char(o, ',');
+        out_u64(o, s->sharedClean, 0);
+        csv_stats_more(o, s);
+        out_char(o, '\n');
+    }
+}
+
+/* a snapshot in the machine readable formats, the text one has its printers */
+void out_snapshot(struct out *o, struct meminfo *minfo)
+{
+    if (o->format == FORMAT_JSON)
+        json_snapshot(o, minfo);
+    else if (o->format == FORMAT_CSV)
+        csv_snapshot(o, minfo);
+}
+
+static void out_double(struct out *o, double v)
+{
+    char tmp[32];
+
+    snprintf(tmp, sizeof(tmp), "%.1f", v);
+    out_str(o, tmp);
+}
+
+static void json_double(struct out *o, const char *key, double v)
+{
+    json_key(o, key, 0);
+    out_double(o, v);
+}
+
+/* a leak verdict or restart as a json line, for a report callback */
+void out_leak_event(struct out *o, const struct leak_event *ev)
+{
+    const struct leak_rate *r;
+    int n, first = 1;
+
+    out_str(o, ev->restart ? "{\"type\":\"restart\"" : "{\"type\":\"leak\"");
+    json_key(o, "cmdline", 0);
+    out_json_str(o, ev->cmdline);
+    json_key(o, "pid", 0);
+    out_i64(o, ev->pid, 0);
+    if (ev->restart) {
+        json_key(o, "new_pid", 0);
+        out_i64(o, ev->new_pid, 0);
+        out_str(o, "}\n");
+        return;
+    }
+
+    out_str(o, ev->group ? ",\"group\":true" : ",\"group\":false");
+    json_u64(o, "samples", ev->samples, 0);
+    json_double(o, "hours", ev->hours);
+    out_str(o, ",\"series\":{");
+    for (n = 0; n < _NUM_SERIES; n++) {
+        if (!(ev->leak & (1u << n)))
+            continue;
+        r = &ev->rate[n];
+        if (!first)
+            out_char(o, ',');
+        first = 0;
+        out_json_str(o, series_name(n));
+        out_str(o, ":{\"rate\":");
+        out_double(o, r->rate);
+        json_double(o, "lo", r->lo);
+        json_double(o, "hi", r->hi);
+        if (r->tto >= 0)
+            json_double(o, "hours_to_oom", r->tto);
+        out_char(o, '}');
+    }
+    out_str(o, "}}\n");
+}
@@ -0,0 +1,51 @@
+#ifndef MEMINFO_OUTPUT_H
+#define MEMINFO_OUTPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "getpss.h"
+
+enum enum_format {
+    FORMAT_TEXT,
+    FORMAT_JSON,    /* one object per line, see out_snapshot */
+    FORMAT_CSV,
+};
+
+/* initial buffer, grown as a tick needs */
+#define OUT_INIT_SIZE (64 * 1024)
+
+/*
+ * the output of a tick, formatted into memory and written with a single
+ * write by out_flush. widths follow printf: right aligned, left aligned
+ * when negative.
+ */
+struct out {
+    char *buf;
+    size_t len, cap;
+    int fd;
+    int format;
+    int failed;         /* out of memory, the tick's output is dropped */
+    int header;         /* csv header written */
+};
+
+struct leak_event;
+
+int out_format(const char *name);
+void out_init(struct out *o, int fd, int format);
+void out_free(struct out *o);
+int out_flush(struct out *o);
+void out_mem(struct out *o, const char *s, size_t n);
+void out_str(struct out *o, const char *s);
+void out_char(struct out *o, char c);
+void out_pad(struct out *o, const char *s, int width);
+void out_u64(struct out *o, uint64_t v, int width);
+void out_i64(struct out *o, int64_t v, int width);
+void out_sign(struct out *o, int64_t v);
+void out_json_str(struct out *o, const char *s);
+void out_csv_str(struct out *o, const char *s);
+
+void out_snapshot(struct out *o, struct meminfo *minfo);
+void out_leak_event(struct out *o, const struct leak_event *ev);
+
+#endif
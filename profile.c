@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+
+#include "profile.h"
+#include "context.h"
+
+/*
+ * what the io samples of this thread read themselves. a span nested in
+ * another (a sort in print) would show up in the outer one's counts.
+ */
+static __thread uint64_t self_bytes, self_reads;
+
+static long long clock_ns(clockid_t id)
+{
+    struct timespec ts;
+
+    clock_gettime(id, &ts);
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * read bytes and read syscalls of this thread so far. the read of the
+ * io file itself only shows in the next sample, its size is returned.
+ */
+static int thread_io(uint64_t *rchar, uint64_t *syscr)
+{
+    char path[64], buf[512], *p;
+    int fd, n;
+
+    *rchar = *syscr = 0;
+    // the real /proc, not the data root: this is our own process
+    snprintf(path, sizeof(path), "/proc/self/task/%ld/io", (long)syscall(SYS_gettid));
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return 0;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return 0;
+    self_bytes += n;
+    self_reads++;
+    buf[n] = '\0';
+    if ((p = strstr(buf, "rchar:")) != NULL)
+        *rchar = strtoull(p + 6, NULL, 10);
+    if ((p = strstr(buf, "syscr:")) != NULL)
+        *syscr = strtoull(p + 6, NULL, 10);
+    return n;
+}
+
+void prof_begin(struct prof_span *span)
+{
+    int n = thread_io(&span->rchar, &span->syscr);
+
+    // count from after this sample's own read
+    if (n > 0) {
+        span->rchar += n;
+        span->syscr++;
+    }
+    span->self_bytes = self_bytes;
+    span->self_reads = self_reads;
+    span->cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+    span->wall_ns = clock_ns(CLOCK_MONOTONIC);
+}
+
+void prof_end(struct prof *p, int which, const struct prof_span *span)
+{
+    struct prof_count *c = &p->cur[which];
+    // the samples of spans nested in this one
+    uint64_t nested_bytes = self_bytes - span->self_bytes;
+    uint64_t nested_reads = self_reads - span->self_reads;
+    uint64_t rchar, syscr;
+
+    c->wall_ns += clock_ns(CLOCK_MONOTONIC) - span->wall_ns;
+    c->cpu_ns += clock_ns(CLOCK_THREAD_CPUTIME_ID) - span->cpu_ns;
+    if (thread_io(&rchar, &syscr) > 0 && rchar >= span->rchar + nested_bytes &&
+            syscr >= span->syscr + nested_reads) {
+        rchar -= nested_bytes;
+        syscr -= nested_reads;
+        c->bytes += rchar - span->rchar;
+        c->reads += syscr - span->syscr;
+    }
+}
+
+static int prof_bucket(long long ns)
+{
+    long long us = ns / 1000;
+    int b = 0;
+
+    while (us > 0 && b < PROF_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    return b;
+}
+
+/* the tick is over, its counts go to the totals and the histograms */
+void prof_tick(struct prof *p)
+{
+    struct prof_stage_stats *s;
+    struct prof_count *c;
+    int i;
+
+    p->ticks++;
+    for (i = 0; i < _NUM_PROF; i++) {
+        s = &p->st[i];
+        c = &p->cur[i];
+        s->last = *c;
+        if (c->wall_ns == 0 && c->lines == 0 && c->opens == 0)
+            continue;
+        s->total.wall_ns += c->wall_ns;
+        s->total.cpu_ns += c->cpu_ns;
+        s->total.bytes += c->bytes;
+        s->total.lines += c->lines;
+        s->total.opens += c->opens;
+        s->total.reads += c->reads;
+        if (c->wall_ns > s->max_wall_ns)
+            s->max_wall_ns = c->wall_ns;
+        s->hist[prof_bucket(c->wall_ns)]++;
+        s->runs++;
+    }
+    memset(p->cur, 0, sizeof(p->cur));
+}
+
+static const char *prof_name(int which)
+{
+    switch (which) {
+        case PROF_PIDS: return "get_pids";
+        case PROF_SMAPS: return "smaps";
+        case PROF_KERNEL: return "get_mem";
+        case PROF_STAT: return "stat_procmem";
+        case PROF_SORT: return "sort";
+        case PROF_LEAK: return "leak";
+        case PROF_PRINT: return "print";
+        default: return "????";
+    }
+}
+
+/* stage costs are kept from now on, off drops them */
+int meminfo_set_profile(struct meminfo_ctx *ctx, int on)
+{
+#ifdef MEMINFO_PROFILE
+    if (!on) {
+        free(ctx->prof);
+        ctx->prof = NULL;
+    } else if (ctx->prof == NULL && (ctx->prof = calloc(1, sizeof(*ctx->prof))) == NULL) {
+        return ctx_error(ctx, MEMINFO_ENOMEM, "calloc profile error");
+    }
+    return 0;
+#else
+    if (!on)
+        return 0;
+    return ctx_error(ctx, MEMINFO_EINVAL, "built without MEMINFO_PROFILE");
+#endif
+}
+
+struct prof *meminfo_profile(struct meminfo_ctx *ctx)
+{
+    return ctx->prof;
+}
+
+void print_profile(struct meminfo_ctx *ctx)
+{
+    struct prof *p = ctx->prof;
+    struct prof_stage_stats *s;
+    struct collector *c;
+    int i, b, lo = PROF_BUCKETS, hi = -1;
+
+    if (p == NULL || p->ticks == 0)
+        return;
+
+    printf("\nstage cost over %d ticks (us), bytes and syscalls of the last tick:\n", p->ticks);
+    printf("%15s%10s%10s%10s%10s%10s%10s%9s%7s%7s\n", "stage", "wall", "avg", "max",
+            "cpu", "avg cpu", "bytes", "lines", "opens", "reads");
+    for (i = 0; i < _NUM_PROF; i++) {
+        s = &p->st[i];
+        if (s->runs == 0)
+            continue;
+        printf("%15s%10lld%10lld%10lld%10lld%10lld%10"PRIu64"%9"PRIu64"%7"PRIu64"%7"PRIu64"\n",
+                prof_name(i), s->last.wall_ns / 1000, s->total.wall_ns / 1000 / s->runs,
+                s->max_wall_ns / 1000, s->last.cpu_ns / 1000, s->total.cpu_ns / 1000 / s->runs,
+                s->last.bytes, s->last.lines, s->last.opens, s->last.reads);
+        for (b = 0; b < PROF_BUCKETS; b++) {
+            if (s->hist[b] == 0)
+                continue;
+            if (b < lo)
+                lo = b;
+            if (b > hi)
+                hi = b;
+        }
+    }
+
+    printf("\nlines parsed per source, last tick:\n");
+    printf("%15s%10s%10s\n", "source", "bytes", "lines");
+    printf("%15s%10"PRIu64"%10"PRIu64"\n", "smaps", p->st[PROF_SMAPS].last.bytes,
+            p->st[PROF_SMAPS].last.lines);
+    for (c = ctx->collectors; c->name; c++)
+        if (c->enabled && c->runs > 0)
+            printf("%15s%10"PRIu64"%10"PRIu64"\n", c->name, c->last_bytes, c->last_lines);
+
+    if (hi < 0)
+        return;
+    printf("\nstage wall time histogram, ticks under each bound (us):\n");
+    printf("%15s", "stage");
+    for (b = lo; b <= hi; b++)
+        printf("%8lld", 1LL << b);
+    printf("\n");
+    for (i = 0; i < _NUM_PROF; i++) {
+        s = &p->st[i];
+        if (s->runs == 0)
+            continue;
+        printf("%15s", prof_name(i));
+        for (b = lo; b <= hi; b++)
+            printf("%8u", s->hist[b]);
+        printf("\n");
+    }
+}
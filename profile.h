@@ -0,0 +1,75 @@
+#ifndef MEMINFO_PROFILE_H
+#define MEMINFO_PROFILE_H
+
+#include <stdint.h>
+
+/*
+ * what meminfo itself costs, stage by stage, for --stats. the spans are
+ * only compiled in with -DMEMINFO_PROFILE, without it the macros are
+ * empty and meminfo_set_profile() refuses.
+ */
+enum prof_stage {
+    PROF_PIDS,      /* listing /proc */
+    PROF_SMAPS,     /* smaps, stat and cmdline of every process */
+    PROF_KERNEL,    /* the get_mem collectors, on their own thread */
+    PROF_STAT,      /* stat_procmem */
+    PROF_SORT,
+    PROF_LEAK,      /* tracker insert, leak check and commit */
+    PROF_PRINT,     /* formatting and writing a tick, its sorts included */
+    _NUM_PROF
+};
+
+/* wall time histogram, bucket 0 is under 1 us, bucket i under 2^i us */
+#define PROF_BUCKETS 24
+
+struct prof_count {
+    long long wall_ns, cpu_ns;
+    uint64_t bytes;         /* read by the stage's thread */
+    uint64_t lines;         /* parsed */
+    uint64_t opens;
+    uint64_t reads;         /* read syscalls */
+};
+
+struct prof_stage_stats {
+    struct prof_count last, total;
+    long long max_wall_ns;
+    uint32_t hist[PROF_BUCKETS];
+    int runs;               /* ticks the stage ran in */
+};
+
+struct prof {
+    struct prof_stage_stats st[_NUM_PROF];
+    struct prof_count cur[_NUM_PROF];   /* the tick so far */
+    int ticks;
+};
+
+/* where a span started */
+struct prof_span {
+    long long wall_ns, cpu_ns;
+    uint64_t rchar, syscr;
+    uint64_t self_bytes, self_reads;    /* the samples' own, see profile.c */
+};
+
+struct meminfo_ctx;
+
+int meminfo_set_profile(struct meminfo_ctx *ctx, int on);
+struct prof *meminfo_profile(struct meminfo_ctx *ctx);
+void prof_begin(struct prof_span *span);
+void prof_end(struct prof *p, int which, const struct prof_span *span);
+void prof_tick(struct prof *p);
+void print_profile(struct meminfo_ctx *ctx);
+
+#ifdef MEMINFO_PROFILE
+#define PROF_SPAN(span) struct prof_span span
+#define PROF_BEGIN(p, span) do { if ((p) != NULL) prof_begin(&(span)); } while (0)
+#define PROF_END(p, which, span) do { if ((p) != NULL) prof_end(p, which, &(span)); } while (0)
+#define PROF_COUNT(p, which, field, n) \
+    do { if ((p) != NULL) (p)->cur[which].field += (n); } while (0)
+#else
+#define PROF_SPAN(span) struct prof_span span __attribute__((unused))
+#define PROF_BEGIN(p, span) do { (void)(p); } while (0)
+#define PROF_END(p, which, span) do { (void)(p); } while (0)
+#define PROF_COUNT(p, which, field, n) do { (void)(p); } while (0)
+#endif
+
+#endif
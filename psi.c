@@ -0,0 +1,353 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+
+#include "psi.h"
+#include "context.h"
+
+/*
+ * event driven snapshots. a psi trigger is written to the pressure file
+ * and the fd polled for POLLPRI, which the kernel raises at most once a
+ * window when the stall crosses the threshold. between triggers only
+ * /proc/meminfo and the stall averages are read, through fds kept open.
+ */
+
+struct psi {
+    int fd;                 /* the trigger */
+    int pressure_fd;        /* the same file, read for the averages */
+    int meminfo_fd;
+    long long interval_ns;  /* between heartbeats */
+    long long due_ns;       /* the next heartbeat */
+    struct timespec fired;  /* poll woke up for the trigger */
+    int pending;            /* fired, no snapshot yet */
+    char trigger[64];
+    struct psi_stats st;
+};
+
+static long long ts_ns(const struct timespec *ts)
+{
+    return (long long)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts_ns(&ts);
+}
+
+static void psi_free(struct psi *psi)
+{
+    if (psi->fd >= 0)
+        close(psi->fd);
+    if (psi->pressure_fd >= 0)
+        close(psi->pressure_fd);
+    if (psi->meminfo_fd >= 0)
+        close(psi->meminfo_fd);
+    free(psi);
+}
+
+/* "some|full <stall us> <window us>", the kernel checks the ranges */
+static int trigger_ok(const char *trigger)
+{
+    char type[8];
+    unsigned long stall, window;
+    int n = 0;
+
+    if (sscanf(trigger, "%7s %lu %lu%n", type, &stall, &window, &n) != 3
+            || trigger[n] != '\0')
+        return 0;
+    return (!strcmp(type, "some") || !strcmp(type, "full"))
+        && stall > 0 && stall <= window;
+}
+
+/*
+ * watch memory pressure with trigger, a heartbeat every interval seconds
+ * in between. only a live /proc takes a trigger, a captured tree doesn't.
+ */
+int psi_open(struct meminfo_ctx *ctx, const char *trigger, int interval)
+{
+    struct psi *psi;
+    struct statfs fs;
+    char path[PATH_MAX];
+    int err;
+
+    if (ctx->psi != NULL)
+        return ctx_error(ctx, MEMINFO_EINVAL, "already watching pressure");
+    if (!trigger_ok(trigger) || strlen(trigger) >= sizeof(psi->trigger))
+        return ctx_error(ctx, MEMINFO_EINVAL, "bad trigger \"%s\", want some|full <stall us> <window us>",
+                trigger);
+    if (interval <= 0)
+        return ctx_error(ctx, MEMINFO_EINVAL, "heartbeat interval %d", interval);
+    if ((psi = calloc(1, sizeof(*psi))) == NULL)
+        return ctx_error(ctx, MEMINFO_ENOMEM, "calloc psi error");
+    psi->pressure_fd = psi->meminfo_fd = -1;
+    strcpy(psi->trigger, trigger);
+    psi->interval_ns = interval * 1000000000LL;
+
+    snprintf(path, sizeof(path), "%s" PSI_MEMORY, ctx->root);
+    if ((psi->fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC)) < 0) {
+        err = errno;
+        psi_free(psi);
+        return ctx_error(ctx, MEMINFO_EIO, "open %s error %s%s", path, strerror(err),
+                err == ENOENT ? ", kernel without psi?" : "");
+    }
+    // a trigger written to a plain file would only change the capture
+    if (fstatfs(psi->fd, &fs) < 0 || fs.f_type != PROC_SUPER_MAGIC) {
+        psi_free(psi);
+        return ctx_error(ctx, MEMINFO_EINVAL, "%s isn't a live /proc", path);
+    }
+    if (write(psi->fd, trigger, strlen(trigger) + 1) < 0) {
+        err = errno;
+        psi_free(psi);
+        return ctx_error(ctx, MEMINFO_EINVAL, "trigger \"%s\" refused: %s%s", trigger, strerror(err),
+                err == EINVAL ? " (without CAP_SYS_RESOURCE the window is a multiple of 2 s)" : "");
+    }
+    psi->pressure_fd = open(path, O_RDONLY | O_CLOEXEC);
+    snprintf(path, sizeof(path), "%s" PROC_MEMINFO, ctx->root);
+    if (psi->pressure_fd < 0 || (psi->meminfo_fd = open(path, O_RDONLY | O_CLOEXEC)) < 0) {
+        err = errno;
+        psi_free(psi);
+        return ctx_error(ctx, MEMINFO_EIO, "open %s error %s", path, strerror(err));
+    }
+
+    psi->due_ns = now_ns() + psi->interval_ns;
+    ctx->psi = psi;
+    return 0;
+}
+
+void psi_close(struct meminfo_ctx *ctx)
+{
+    if (ctx->psi == NULL)
+        return;
+    psi_free(ctx->psi);
+    ctx->psi = NULL;
+}
+
+/* sleep until the trigger fires or the next heartbeat, a psi_wake or an error */
+int psi_wait(struct meminfo_ctx *ctx)
+{
+    struct psi *psi = ctx->psi;
+    struct pollfd pfd;
+    long long left = psi->due_ns - now_ns();
+    int n;
+
+    pfd.fd = psi->fd;
+    pfd.events = POLLPRI;
+    pfd.revents = 0;
+    n = poll(&pfd, 1, left > 0 ? (int)((left + 999999) / 1000000) : 0);
+    if (n < 0) {
+        if (errno == EINTR)
+            return PSI_INTR;
+        return ctx_error(ctx, MEMINFO_EIO, "poll " PSI_MEMORY " error %s", strerror(errno));
+    }
+    if (n == 0) {
+        // a heartbeat late by more than an interval doesn't catch up
+        psi->due_ns += psi->interval_ns;
+        if (psi->due_ns <= now_ns())
+            psi->due_ns = now_ns() + psi->interval_ns;
+        return PSI_BEAT;
+    }
+    if (pfd.revents & (POLLERR | POLLNVAL))
+        return ctx_error(ctx, MEMINFO_EIO, PSI_MEMORY " trigger is gone");
+    clock_gettime(CLOCK_MONOTONIC, &psi->fired);
+    psi->pending = 1;
+    return PSI_FIRED;
+}
+
+/* the file behind fd from the start, NUL terminated; bytes or -1 */
+static ssize_t read_whole(int fd, char *buf, size_t size)
+{
+    ssize_t n = pread(fd, buf, size - 1, 0);
+
+    if (n < 0)
+        return -1;
+    buf[n] = '\0';
+    return n;
+}
+
+static uint64_t meminfo_value(const char *buf, const char *tag)
+{
+    const char *p = strstr(buf, tag);
+
+    return p != NULL ? strtoull(p + strlen(tag), NULL, 10) : 0;
+}
+
+int psi_heartbeat(struct meminfo_ctx *ctx, struct heartbeat *hb)
+{
+    struct psi *psi = ctx->psi;
+    char buf[8192];
+    const char *full;
+    time_t now;
+
+    memset(hb, 0, sizeof(*hb));
+    time(&now);
+    localtime_r(&now, &hb->when);
+
+    if (read_whole(psi->meminfo_fd, buf, sizeof(buf)) < 0)
+        return ctx_error(ctx, MEMINFO_EIO, "read " PROC_MEMINFO " error %s", strerror(errno));
+    hb->total = meminfo_value(buf, "MemTotal:");
+    hb->available = meminfo_value(buf, "MemAvailable:");
+    hb->free = meminfo_value(buf, "MemFree:");
+    hb->swap_free = meminfo_value(buf, "SwapFree:");
+
+    if (read_whole(psi->pressure_fd, buf, sizeof(buf)) < 0)
+        return ctx_error(ctx, MEMINFO_EIO, "read " PSI_MEMORY " error %s", strerror(errno));
+    if (sscanf(buf, "some avg10=%lf", &hb->some10) != 1)
+        return ctx_error(ctx, MEMINFO_EFORMAT, PSI_MEMORY " not understood");
+    if ((full = strstr(buf, "full avg10=")) != NULL)
+        hb->full10 = strtod(full + strlen("full avg10="), NULL);
+
+    psi->st.beats++;
+    return 0;
+}
+
+static void latency_add(struct psi_latency *l, long long ns)
+{
+    l->last_ns = ns;
+    l->total_ns += ns;
+    if (ns > l->max_ns)
+        l->max_ns = ns;
+}
+
+/*
+ * minfo was just taken, 1 when it was for a trigger and its latency
+ * is counted. the next heartbeat is an interval after it.
+ */
+int psi_snapshot(struct meminfo_ctx *ctx, struct meminfo *minfo)
+{
+    struct psi *psi = ctx->psi;
+    long long fired, ks, ps, ke, pe;
+
+    if (psi == NULL)
+        return 0;
+    psi->due_ns = now_ns() + psi->interval_ns;
+    if (!psi->pending)
+        return 0;
+    psi->pending = 0;
+
+    fired = ts_ns(&psi->fired);
+    ks = ts_ns(&minfo->kern_start);
+    ps = ts_ns(&minfo->proc_start);
+    ke = ts_ns(&minfo->kern_end);
+    pe = ts_ns(&minfo->proc_end);
+    latency_add(&psi->st.start, (ks < ps ? ks : ps) - fired);
+    latency_add(&psi->st.done, (ke > pe ? ke : pe) - fired);
+    psi->st.fired++;
+    return 1;
+}
+
+static void out_ms(struct out *o, long long ns)
+{
+    char tmp[32];
+
+    snprintf(tmp, sizeof(tmp), "%.3f", ns / 1e6);
+    out_str(o, tmp);
+}
+
+static void out_percent(struct out *o, double v)
+{
+    char tmp[32];
+
+    snprintf(tmp, sizeof(tmp), "%.2f", v);
+    out_str(o, tmp);
+}
+
+void print_heartbeat(struct out *o, const struct heartbeat *hb)
+{
+    char when[32];
+
+    if (o->format == FORMAT_JSON) {
+        strftime(when, sizeof(when), "%Y-%m-%dT%H:%M:%S", &hb->when);
+        out_str(o, "{\"type\":\"heartbeat\",\"time\":");
+        out_json_str(o, when);
+        out_str(o, ",\"mem_total\":");
+        out_u64(o, hb->total, 0);
+        out_str(o, ",\"mem_available\":");
+        out_u64(o, hb->available, 0);
+        out_str(o, ",\"mem_free\":");
+        out_u64(o, hb->free, 0);
+        out_str(o, ",\"swap_free\":");
+        out_u64(o, hb->swap_free, 0);
+        out_str(o, ",\"some_avg10\":");
+        out_percent(o, hb->some10);
+        out_str(o, ",\"full_avg10\":");
+        out_percent(o, hb->full10);
+        out_str(o, "}\n");
+        return;
+    }
+    strftime(when, sizeof(when), "%H:%M:%S", &hb->when);
+    out_str(o, "heartbeat ");
+    out_str(o, when);
+    out_str(o, ": MemAvailable ");
+    out_u64(o, hb->available, 0);
+    out_str(o, " kB, MemFree ");
+    out_u64(o, hb->free, 0);
+    out_str(o, " kB, SwapFree ");
+    out_u64(o, hb->swap_free, 0);
+    out_str(o, " kB, stall avg10 some ");
+    out_percent(o, hb->some10);
+    out_str(o, "% full ");
+    out_percent(o, hb->full10);
+    out_str(o, "%\n");
+}
+
+/* the trigger behind the snapshot psi_snapshot just counted */
+void print_psi_trigger(struct meminfo_ctx *ctx, struct out *o)
+{
+    struct psi *psi = ctx->psi;
+
+    if (o->format == FORMAT_JSON) {
+        out_str(o, "{\"type\":\"psi\",\"trigger\":");
+        out_json_str(o, psi->trigger);
+        out_str(o, ",\"count\":");
+        out_u64(o, psi->st.fired, 0);
+        out_str(o, ",\"start_ms\":");
+        out_ms(o, psi->st.start.last_ns);
+        out_str(o, ",\"done_ms\":");
+        out_ms(o, psi->st.done.last_ns);
+        out_str(o, "}\n");
+        return;
+    }
+    out_str(o, "psi trigger \"");
+    out_str(o, psi->trigger);
+    out_str(o, "\" #");
+    out_u64(o, psi->st.fired, 0);
+    out_str(o, ": snapshot started ");
+    out_ms(o, psi->st.start.last_ns);
+    out_str(o, " ms, done ");
+    out_ms(o, psi->st.done.last_ns);
+    out_str(o, " ms after it\n\n");
+}
+
+void print_psi_stats(struct meminfo_ctx *ctx)
+{
+    struct psi *psi = ctx->psi;
+    const struct psi_latency *l;
+    unsigned long n;
+    int i;
+
+    if (psi == NULL)
+        return;
+    n = psi->st.fired;
+    printf("\npsi trigger \"%s\": %lu snapshots, %lu heartbeats\n", psi->trigger, n, psi->st.beats);
+    if (n == 0)
+        return;
+    printf("%15s%10s%10s%10s\n", "latency(ms)", "last", "avg", "max");
+    for (i = 0; i < 2; i++) {
+        l = i ? &psi->st.done : &psi->st.start;
+        printf("%15s%10.3f%10.3f%10.3f\n", i ? "done" : "start", l->last_ns / 1e6,
+                l->total_ns / 1e6 / n, l->max_ns / 1e6);
+    }
+}
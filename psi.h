@@ -0,0 +1,53 @@
+#ifndef MEMINFO_PSI_H
+#define MEMINFO_PSI_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "getpss.h"
+
+#define PSI_MEMORY "/proc/pressure/memory"
+/* 150 ms of stall in any 1 s window, lmkd's low pressure level */
+#define PSI_DEFAULT_TRIGGER "some 150000 1000000"
+/* seconds between heartbeats when -t isn't given */
+#define PSI_DEFAULT_INTERVAL 10
+
+/* why psi_wait returned */
+enum psi_wake {
+    PSI_FIRED,      /* pressure crossed the trigger, take a snapshot */
+    PSI_BEAT,       /* a heartbeat is due */
+    PSI_INTR,       /* a signal, call again to wait out the rest */
+};
+
+/* the cheap reading between triggers, /proc/meminfo and the stall averages */
+struct heartbeat {
+    struct tm when;
+    uint64_t total, available, free, swap_free;     /* kB */
+    double some10, full10;      /* avg10 of PSI_MEMORY, % */
+};
+
+/* trigger to snapshot latency, from poll waking up */
+struct psi_latency {
+    long long last_ns, total_ns, max_ns;
+};
+
+struct psi_stats {
+    unsigned long fired;        /* snapshots taken for a trigger */
+    unsigned long beats;
+    struct psi_latency start;   /* to the first source read */
+    struct psi_latency done;    /* to the snapshot complete */
+};
+
+struct meminfo_ctx;
+struct out;
+
+int psi_open(struct meminfo_ctx *ctx, const char *trigger, int interval);
+void psi_close(struct meminfo_ctx *ctx);
+int psi_wait(struct meminfo_ctx *ctx);
+int psi_heartbeat(struct meminfo_ctx *ctx, struct heartbeat *hb);
+int psi_snapshot(struct meminfo_ctx *ctx, struct meminfo *minfo);
+void print_heartbeat(struct out *o, const struct heartbeat *hb);
+void print_psi_trigger(struct meminfo_ctx *ctx, struct out *o);
+void print_psi_stats(struct meminfo_ctx *ctx);
+
+#endif
@@ -0,0 +1,862 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "error.h"
+#include "record.h"
+#include "context.h"
+
+/*
+ * file layout, integers are LEB128 varints unless noted, signed ones
+ * zigzag encoded first:
+ *
+ *   header:  RECORD_MAGIC (8 bytes), version, MEMINFO_COUNT, _NUM_HEAP,
+ *            RECORD_STATS
+ *   frame:   payload length (4 bytes, little endian), then
+ *            flags
+ *            time, ms since the epoch on a key frame, else signed delta
+ *            key frame only: MEMINFO_COUNT item names (length, bytes)
+ *            new strings: count, then (length, bytes) each, numbered on
+ *                from the last one
+ *            kernel items: changed count, then (index gap, signed delta)
+ *            processes: changed count, then for each in pid order
+ *                pid gap, flags, if RECORD_PROC_NEW cmdline string and
+ *                start time, then the fields as (index gap, signed delta)
+ *                against the previous tick, or against 0 when new
+ *            exits: count, then pid gaps
+ *
+ * a process that didn't change costs nothing. a key frame starts over
+ * with an empty string table and no previous tick, so a reader can
+ * start at any of them.
+ */
+
+/* string table slots, a power of two */
+#define STR_INIT_SLOTS 256
+
+struct recorder {
+    int fd;
+    off_t size;             /* file size after the last full frame */
+    int header;             /* header still to be written */
+
+    unsigned char *buf;
+    size_t cap;
+
+    /* the tick written last, sorted by pid */
+    struct record_proc *prev, *cur;
+    int nprev, ncur, nprocs;
+    uint64_t kern[MEMINFO_COUNT];
+    int64_t ts_ms;
+    uint32_t ticks;         /* since the last key frame */
+
+    /* interned cmdlines, slots hold index + 1 */
+    char **strs;
+    uint32_t nstrs, capstrs, nsent;
+    uint32_t *slots;
+    unsigned int nslots;
+};
+
+static unsigned int str_hash(const char *str)
+{
+    unsigned int hash = 5381;
+    int c;
+
+    while ((c = *str++) != '\0')
+        hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
+
+    return hash;
+}
+
+static void str_reset(struct recorder *r)
+{
+    uint32_t i;
+
+    for (i = 0; i < r->nstrs; i++)
+        free(r->strs[i]);
+    r->nstrs = 0;
+    r->nsent = 0;
+    if (r->slots != NULL)
+        memset(r->slots, 0, r->nslots * sizeof(r->slots[0]));
+}
+
+static int str_grow(struct recorder *r)
+{
+    unsigned int n = r->nslots ? r->nslots * 2 : STR_INIT_SLOTS;
+    uint32_t *slots = calloc(n, sizeof(slots[0]));
+    uint32_t i;
+    unsigned int j;
+
+    if (slots == NULL)
+        return -1;
+    for (i = 0; i < r->nstrs; i++) {
+        for (j = str_hash(r->strs[i]) & (n - 1); slots[j] != 0; j = (j + 1) & (n - 1))
+            ;
+        slots[j] = i + 1;
+    }
+    free(r->slots);
+    r->slots = slots;
+    r->nslots = n;
+    return 0;
+}
+
+/* index of str in the string table, added when it's not there */
+static int64_t str_intern(struct recorder *r, const char *str)
+{
+    unsigned int j;
+    char **strs;
+
+    if ((r->nstrs + 1) * 10 > r->nslots * 7 && str_grow(r) < 0)
+        return -1;
+    for (j = str_hash(str) & (r->nslots - 1); r->slots[j] != 0; j = (j + 1) & (r->nslots - 1))
+        if (!strcmp(r->strs[r->slots[j] - 1], str))
+            return r->slots[j] - 1;
+
+    if (r->nstrs == r->capstrs) {
+        strs = realloc(r->strs, (r->capstrs ? r->capstrs * 2 : 64) * sizeof(char *));
+        if (strs == NULL)
+            return -1;
+        r->strs = strs;
+        r->capstrs = r->capstrs ? r->capstrs * 2 : 64;
+    }
+    if ((r->strs[r->nstrs] = strdup(str)) == NULL)
+        return -1;
+    r->slots[j] = r->nstrs + 1;
+    return r->nstrs++;
+}
+
+static unsigned char *put_uvarint(unsigned char *p, uint64_t v)
+{
+    while (v >= 0x80) {
+        *p++ = (unsigned char)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (unsigned char)v;
+    return p;
+}
+
+static unsigned char *put_svarint(unsigned char *p, int64_t v)
+{
+    return put_uvarint(p, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+}
+
+static unsigned char *put_str(unsigned char *p, const char *s)
+{
+    size_t len = strlen(s);
+
+    p = put_uvarint(p, len);
+    memcpy(p, s, len);
+    return p + len;
+}
+
+/* changed values of cur against prev, prev NULL for all of them */
+static unsigned char *put_sparse(unsigned char *p, const uint64_t *cur,
+        const uint64_t *prev, int n)
+{
+    int i, last = 0, changed = 0;
+
+    for (i = 0; i < n; i++)
+        changed += cur[i] != (prev ? prev[i] : 0);
+    p = put_uvarint(p, changed);
+    for (i = 0; i < n && changed > 0; i++) {
+        uint64_t old = prev ? prev[i] : 0;
+        if (cur[i] == old)
+            continue;
+        p = put_uvarint(p, i - last);
+        p = put_svarint(p, (int64_t)(cur[i] - old));
+        last = i;
+        changed--;
+    }
+    return p;
+}
+
+/* flatten the recorded values of a process */
+void record_fields(const struct proc_info *proc, uint64_t *v)
+{
+    memcpy(v, proc->stats, sizeof(proc->stats));
+    v += _NUM_HEAP * RECORD_STATS;
+    v[0] = proc->dalvikpss;
+    v[1] = proc->nativepss;
+    v[2] = proc->otherpss;
+    v[3] = proc->totalpss;
+}
+
+static int cmppid(const void *a, const void *b)
+{
+    return ((const struct record_proc *)a)->pid - ((const struct record_proc *)b)->pid;
+}
+
+int record_open(struct meminfo_ctx *ctx, const char *path)
+{
+    struct recorder *r;
+    char magic[9];
+    struct stat st;
+
+    if ((r = calloc(1, sizeof(*r))) == NULL)
+        return ctx_error(ctx, MEMINFO_ENOMEM, "calloc recorder error");
+    r->fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (r->fd < 0) {
+        free(r);
+        return ctx_error(ctx, MEMINFO_EIO, "open %s: %s", path, strerror(errno));
+    }
+    if (fstat(r->fd, &st) < 0) {
+        close(r->fd);
+        free(r);
+        return ctx_error(ctx, MEMINFO_EIO, "stat %s: %s", path, strerror(errno));
+    }
+
+    // appending to an older recording is fine as long as the format matches
+    r->size = st.st_size;
+    r->header = st.st_size == 0;
+    if (!r->header && (pread(r->fd, magic, 9, 0) != 9
+                || memcmp(magic, RECORD_MAGIC, 8) || magic[8] != RECORD_VERSION)) {
+        close(r->fd);
+        free(r);
+        return ctx_error(ctx, MEMINFO_EFORMAT, "%s isn't a version %d recording",
+                path, RECORD_VERSION);
+    }
+
+    record_close(ctx);
+    ctx->rec = r;
+    return 0;
+}
+
+void record_close(struct meminfo_ctx *ctx)
+{
+    struct recorder *r = ctx->rec;
+
+    if (r == NULL)
+        return;
+    close(r->fd);
+    str_reset(r);
+    free(r->strs);
+    free(r->slots);
+    free(r->prev);
+    free(r->cur);
+    free(r->buf);
+    free(r);
+    ctx->rec = NULL;
+}
+
+/* collect the processes of minfo into r->cur, sorted by pid */
+static int record_collect(struct recorder *r, struct meminfo *minfo)
+{
+    struct record_proc *p;
+    struct proc_info *proc;
+    int64_t str;
+    int i;
+
+    if (minfo->num_procs > r->nprocs) {
+        p = realloc(r->cur, minfo->num_procs * sizeof(*p));
+        if (p == NULL)
+            return -1;
+        r->cur = p;
+        p = realloc(r->prev, minfo->num_procs * sizeof(*p));
+        if (p == NULL)
+            return -1;
+        r->prev = p;
+        r->nprocs = minfo->num_procs;
+    }
+
+    r->ncur = 0;
+    for (i = 0; i < minfo->num_procs; i++) {
+        proc = minfo->pss[i];
+        // kernel threads and processes gone before their maps were read
+        if (proc == NULL || proc->totalpss == 0)
+            continue;
+        if ((str = str_intern(r, proc->cmdline)) < 0)
+            return -1;
+        p = &r->cur[r->ncur++];
+        p->pid = proc->pid;
+        p->str = str;
+        p->starttime = proc->starttime;
+        record_fields(proc, p->v);
+    }
+    qsort(r->cur, r->ncur, sizeof(r->cur[0]), cmppid);
+    return 0;
+}
+
+/* worst case size of the frame for the current tick */
+static size_t record_bound(struct recorder *r)
+{
+    size_t n = 64 + MEMINFO_COUNT * (2 * 10 + sizeof(((struct mem_item *)0)->name));
+    uint32_t i;
+
+    for (i = r->nsent; i < r->nstrs; i++)
+        n += 10 + strlen(r->strs[i]);
+    n += (size_t)r->ncur * (4 * 10 + RECORD_PROC_FIELDS * 2 * 10);
+    n += (size_t)r->nprev * 10;
+    return n;
+}
+
+static unsigned char *record_procs(struct recorder *r, unsigned char *p)
+{
+    struct record_proc *c, *o;
+    int i, j, changed = 0, gone = 0, last;
+    unsigned char *count;
+
+    /*
+     * the changed count goes first but is only known at the end. leave
+     * room for the largest one and move the rest down afterwards.
+     */
+    count = p;
+    p += 5;
+    last = 0;
+    for (i = 0, j = 0; i < r->ncur; i++) {
+        c = &r->cur[i];
+        while (j < r->nprev && r->prev[j].pid < c->pid)
+            j++, gone++;
+        o = (j < r->nprev && r->prev[j].pid == c->pid) ? &r->prev[j++] : NULL;
+        if (o != NULL && (o->starttime != c->starttime
+                    || strcmp(r->strs[o->str], r->strs[c->str])))
+            o = NULL;   // pid reused, a new process
+        if (o != NULL && !memcmp(o->v, c->v, sizeof(c->v)))
+            continue;
+
+        p = put_uvarint(p, c->pid - last);
+        last = c->pid;
+        p = put_uvarint(p, o == NULL ? RECORD_PROC_NEW : 0);
+        if (o == NULL) {
+            p = put_uvarint(p, c->str);
+            p = put_uvarint(p, c->starttime);
+        }
+        p = put_sparse(p, c->v, o ? o->v : NULL, RECORD_PROC_FIELDS);
+        changed++;
+    }
+    gone += r->nprev - j;
+
+    i = put_uvarint(count, changed) - count;
+    memmove(count + i, count + 5, p - count - 5);
+    p -= 5 - i;
+
+    // exits, processes of the previous tick with no pid in this one
+    p = put_uvarint(p, gone);
+    last = 0;
+    for (i = 0, j = 0; j < r->nprev; j++) {
+        while (i < r->ncur && r->cur[i].pid < r->prev[j].pid)
+            i++;
+        if (i < r->ncur && r->cur[i].pid == r->prev[j].pid)
+            continue;
+        p = put_uvarint(p, r->prev[j].pid - last);
+        last = r->prev[j].pid;
+    }
+    return p;
+}
+
+/*
+ * append minfo to the recording. the frame is built in memory and
+ * written with a single write, a failed one is cut off again so the
+ * file stays readable.
+ */
+int record_tick(struct meminfo_ctx *ctx, struct meminfo *minfo)
+{
+    struct recorder *r = ctx->rec;
+    struct record_proc *swap;
+    struct timespec now;
+    uint64_t kern[MEMINFO_COUNT];
+    unsigned char *p, *frame, *buf;
+    int64_t ts_ms;
+    size_t need, len;
+    ssize_t n;
+    int i, key;
+
+    if (r == NULL)
+        return ctx_error(ctx, MEMINFO_EINVAL, "no recording open");
+
+    key = r->ticks == 0;
+    if (key) {
+        str_reset(r);
+        r->nprev = 0;
+        memset(r->kern, 0, sizeof(r->kern));
+    }
+    if (record_collect(r, minfo) < 0) {
+        r->ticks = 0;
+        return ctx_error(ctx, MEMINFO_ENOMEM, "recording: out of memory");
+    }
+
+    need = record_bound(r);
+    if (need > r->cap) {
+        if ((buf = realloc(r->buf, need)) == NULL) {
+            r->ticks = 0;
+            return ctx_error(ctx, MEMINFO_ENOMEM, "recording: out of memory");
+        }
+        r->buf = buf;
+        r->cap = need;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    ts_ms = (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    for (i = 0; i < MEMINFO_COUNT; i++)
+        kern[i] = minfo->item[i].num;
+
+    p = r->buf;
+    if (r->header) {
+        memcpy(p, RECORD_MAGIC, 8);
+        p = put_uvarint(p + 8, RECORD_VERSION);
+        p = put_uvarint(p, MEMINFO_COUNT);
+        p = put_uvarint(p, _NUM_HEAP);
+        p = put_uvarint(p, RECORD_STATS);
+    }
+    frame = p;
+    p += 4;
+    *p++ = key ? RECORD_FRAME_KEY : 0;
+    if (key) {
+        p = put_uvarint(p, ts_ms);
+        for (i = 0; i < MEMINFO_COUNT; i++)
+            p = put_str(p, minfo->item[i].name);
+    } else {
+        p = put_svarint(p, ts_ms - r->ts_ms);
+    }
+    p = put_uvarint(p, r->nstrs - r->nsent);
+    for (i = r->nsent; i < (int)r->nstrs; i++)
+        p = put_str(p, r->strs[i]);
+    p = put_sparse(p, kern, r->kern, MEMINFO_COUNT);
+    p = record_procs(r, p);
+
+    len = p - frame - 4;
+    frame[0] = len;
+    frame[1] = len >> 8;
+    frame[2] = len >> 16;
+    frame[3] = len >> 24;
+
+    len = p - r->buf;
+    do {
+        n = write(r->fd, r->buf, len);
+    } while (n < 0 && errno == EINTR);
+    if (n != (ssize_t)len) {
+        i = n < 0 ? errno : ENOSPC;
+        if (n > 0 && ftruncate(r->fd, r->size) < 0)
+            err_msg("can't cut off the partial frame: %s\n", strerror(errno));
+        r->ticks = 0;
+        return ctx_error(ctx, MEMINFO_EIO, "recording: write error: %s", strerror(i));
+    }
+
+    r->size += len;
+    r->header = 0;
+    r->nsent = r->nstrs;
+    r->ts_ms = ts_ms;
+    memcpy(r->kern, kern, sizeof(kern));
+    swap = r->prev;
+    r->prev = r->cur;
+    r->cur = swap;
+    r->nprev = r->ncur;
+    if (++r->ticks == RECORD_KEYFRAME)
+        r->ticks = 0;
+    return 0;
+}
+
+/*
+ * reading a recording back. the file is mapped and decoded front to
+ * back; the processes live from one frame to the next and only the
+ * ones in a frame are touched, so a tick costs what changed in it.
+ */
+struct replay {
+    const unsigned char *map, *p, *end;
+    size_t len;
+
+    struct meminfo minfo;       /* handed out, pss points at ptrs */
+    struct proc_info **live;    /* sorted by pid */
+    struct proc_info **ptrs;
+    int nlive, cap;
+    struct proc_info **pool;    /* freed processes, for reuse */
+    int npool;
+
+    /* string table, pointing into the map */
+    const unsigned char **strs;
+    uint32_t *lens;
+    uint32_t nstrs, capstrs;
+
+    int64_t ts_ms;
+    int started;
+    int stats;                  /* counters per heap, fewer in older files */
+};
+
+static int get_uvarint(const unsigned char **pp, const unsigned char *end, uint64_t *v)
+{
+    const unsigned char *p = *pp;
+    uint64_t r = 0;
+    int shift = 0;
+
+    while (p < end && (*p & 0x80) && shift < 63) {
+        r |= (uint64_t)(*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    if (p >= end)
+        return -1;
+    *v = r | (uint64_t)*p++ << shift;
+    *pp = p;
+    return 0;
+}
+
+static int get_svarint(const unsigned char **pp, const unsigned char *end, int64_t *v)
+{
+    uint64_t u;
+
+    if (get_uvarint(pp, end, &u) < 0)
+        return -1;
+    *v = (int64_t)(u >> 1) ^ -(int64_t)(u & 1);
+    return 0;
+}
+
+static int get_str(const unsigned char **pp, const unsigned char *end,
+        const unsigned char **s, uint32_t *len)
+{
+    uint64_t n;
+
+    if (get_uvarint(pp, end, &n) < 0 || n > (uint64_t)(end - *pp))
+        return -1;
+    *s = *pp;
+    *len = n;
+    *pp += n;
+    return 0;
+}
+
+/*
+ * the i-th recorded value of a process, in record_fields() order. an
+ * older file has the leading nstats counters of each heap.
+ */
+static uint64_t *proc_field(struct proc_info *proc, int i, int nstats)
+{
+    if (i < _NUM_HEAP * nstats)
+        return &((uint64_t *)&proc->stats[i / nstats])[i % nstats];
+    switch (i - _NUM_HEAP * nstats) {
+        case 0: return &proc->dalvikpss;
+        case 1: return &proc->nativepss;
+        case 2: return &proc->otherpss;
+        default: return &proc->totalpss;
+    }
+}
+
+static int get_sparse(const unsigned char **pp, const unsigned char *end,
+        uint64_t *kern, struct proc_info *proc, int nstats, int n)
+{
+    uint64_t changed, gap;
+    int64_t delta;
+    int i = 0;
+
+    if (get_uvarint(pp, end, &changed) < 0)
+        return -1;
+    while (changed-- > 0) {
+        if (get_uvarint(pp, end, &gap) < 0 || get_svarint(pp, end, &delta) < 0)
+            return -1;
+        if (gap >= (uint64_t)(n - i))
+            return -1;
+        i += gap;
+        if (kern != NULL)
+            kern[i] += delta;
+        else
+            *proc_field(proc, i, nstats) += delta;
+    }
+    return 0;
+}
+
+static void replay_drop(struct replay *r, int i)
+{
+    r->pool[r->npool++] = r->live[i];
+    r->nlive--;
+    memmove(&r->live[i], &r->live[i + 1], (r->nlive - i) * sizeof(r->live[0]));
+}
+
+/* a new process at live[i], NULL when out of memory */
+static struct proc_info *replay_add(struct replay *r, int i)
+{
+    struct proc_info *proc, **live, **ptrs, **pool;
+
+    if (r->nlive == r->cap) {
+        int cap = r->cap ? r->cap * 2 : 512;
+        if ((live = realloc(r->live, cap * sizeof(*live))) == NULL)
+            return NULL;
+        r->live = live;
+        if ((ptrs = realloc(r->ptrs, cap * sizeof(*ptrs))) == NULL)
+            return NULL;
+        r->ptrs = ptrs;
+        if ((pool = realloc(r->pool, cap * sizeof(*pool))) == NULL)
+            return NULL;
+        r->pool = pool;
+        r->cap = cap;
+    }
+    if (r->npool > 0)
+        proc = r->pool[--r->npool];
+    else if ((proc = malloc(sizeof(*proc))) == NULL)
+        return NULL;
+    memset(proc, 0, sizeof(*proc));
+    memmove(&r->live[i + 1], &r->live[i], (r->nlive - i) * sizeof(r->live[0]));
+    r->live[i] = proc;
+    r->nlive++;
+    return proc;
+}
+
+static int replay_procs(struct replay *r, const unsigned char **pp, const unsigned char *end)
+{
+    struct proc_info *proc;
+    uint64_t n, gap, flags, str, start;
+    size_t len;
+    int i = 0, pid = 0;
+
+    if (get_uvarint(pp, end, &n) < 0)
+        return -1;
+    while (n-- > 0) {
+        if (get_uvarint(pp, end, &gap) < 0 || get_uvarint(pp, end, &flags) < 0)
+            return -1;
+        pid += gap;
+        while (i < r->nlive && r->live[i]->pid < pid)
+            i++;
+        proc = (i < r->nlive && r->live[i]->pid == pid) ? r->live[i] : NULL;
+        if (flags & RECORD_PROC_NEW) {
+            if (get_uvarint(pp, end, &str) < 0 || str >= r->nstrs
+                    || get_uvarint(pp, end, &start) < 0)
+                return -1;
+            if (proc != NULL)
+                memset(proc, 0, sizeof(*proc));
+            else if ((proc = replay_add(r, i)) == NULL)
+                return -2;
+            proc->pid = pid;
+            proc->starttime = start;
+            len = r->lens[str] < sizeof(proc->cmdline) ? r->lens[str] : sizeof(proc->cmdline) - 1;
+            memcpy(proc->cmdline, r->strs[str], len);
+        } else if (proc == NULL) {
+            return -1;
+        }
+        if (get_sparse(pp, end, NULL, proc, r->stats, _NUM_HEAP * r->stats + 4) < 0)
+            return -1;
+    }
+
+    // exits
+    if (get_uvarint(pp, end, &n) < 0)
+        return -1;
+    for (i = 0, pid = 0; n-- > 0; ) {
+        if (get_uvarint(pp, end, &gap) < 0)
+            return -1;
+        pid += gap;
+        while (i < r->nlive && r->live[i]->pid < pid)
+            i++;
+        if (i < r->nlive && r->live[i]->pid == pid)
+            replay_drop(r, i);
+    }
+    return 0;
+}
+
+static int replay_frame(struct replay *r, const unsigned char *p, const unsigned char *end)
+{
+    uint64_t n, kern[MEMINFO_COUNT], ts;
+    const unsigned char *s, **strs;
+    uint32_t len, *lens;
+    int64_t delta;
+    int i, key, ret;
+
+    key = *p++ & RECORD_FRAME_KEY;
+    if (key) {
+        while (r->nlive > 0)
+            replay_drop(r, r->nlive - 1);
+        r->nstrs = 0;
+        memset(r->minfo.item, 0, sizeof(r->minfo.item));
+        if (get_uvarint(&p, end, &ts) < 0)
+            return -1;
+        r->ts_ms = ts;
+        for (i = 0; i < MEMINFO_COUNT; i++) {
+            if (get_str(&p, end, &s, &len) < 0)
+                return -1;
+            if (len >= sizeof(r->minfo.item[i].name))
+                len = sizeof(r->minfo.item[i].name) - 1;
+            memcpy(r->minfo.item[i].name, s, len);
+        }
+        r->started = 1;
+    } else {
+        // a reader has to start at a key frame
+        if (!r->started || get_svarint(&p, end, &delta) < 0)
+            return -1;
+        r->ts_ms += delta;
+    }
+
+    if (get_uvarint(&p, end, &n) < 0)
+        return -1;
+    while (n-- > 0) {
+        if (get_str(&p, end, &s, &len) < 0)
+            return -1;
+        if (r->nstrs == r->capstrs) {
+            uint32_t cap = r->capstrs ? r->capstrs * 2 : 256;
+            if ((strs = realloc(r->strs, cap * sizeof(*strs))) == NULL)
+                return -2;
+            r->strs = strs;
+            if ((lens = realloc(r->lens, cap * sizeof(*lens))) == NULL)
+                return -2;
+            r->lens = lens;
+            r->capstrs = cap;
+        }
+        r->strs[r->nstrs] = s;
+        r->lens[r->nstrs++] = len;
+    }
+
+    for (i = 0; i < MEMINFO_COUNT; i++)
+        kern[i] = r->minfo.item[i].num;
+    if (get_sparse(&p, end, kern, NULL, 0, MEMINFO_COUNT) < 0)
+        return -1;
+    for (i = 0; i < MEMINFO_COUNT; i++)
+        r->minfo.item[i].num = kern[i];
+
+    if ((ret = replay_procs(r, &p, end)) < 0)
+        return ret;
+    return p == end ? 0 : -1;
+}
+
+int replay_open(struct meminfo_ctx *ctx, const char *path)
+{
+    struct replay *r;
+    const unsigned char *p;
+    uint64_t v[4];
+    struct stat st;
+    int fd, i;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return ctx_error(ctx, MEMINFO_EIO, "open %s: %s", path, strerror(errno));
+    if (fstat(fd, &st) < 0 || st.st_size < 8) {
+        close(fd);
+        return ctx_error(ctx, MEMINFO_EFORMAT, "%s isn't a recording", path);
+    }
+    if ((r = calloc(1, sizeof(*r))) == NULL) {
+        close(fd);
+        return ctx_error(ctx, MEMINFO_ENOMEM, "calloc replay error");
+    }
+    r->len = st.st_size;
+    r->map = mmap(NULL, r->len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (r->map == MAP_FAILED) {
+        free(r);
+        return ctx_error(ctx, MEMINFO_EIO, "mmap %s: %s", path, strerror(errno));
+    }
+    madvise((void *)r->map, r->len, MADV_SEQUENTIAL);
+    r->end = r->map + r->len;
+
+    p = r->map + 8;
+    for (i = 0; i < 4; i++)
+        if (get_uvarint(&p, r->end, &v[i]) < 0)
+            break;
+    if (memcmp(r->map, RECORD_MAGIC, 8) || i < 4
+            || !((v[0] == RECORD_VERSION && v[3] == RECORD_STATS)
+                || (v[0] == 1 && v[3] == RECORD_STATS_V1))
+            || v[1] != MEMINFO_COUNT || v[2] != _NUM_HEAP) {
+        munmap((void *)r->map, r->len);
+        free(r);
+        return ctx_error(ctx, MEMINFO_EFORMAT, "%s isn't a version 1 to %d recording",
+                path, RECORD_VERSION);
+    }
+    r->p = p;
+    r->stats = v[3];
+
+    replay_close(ctx);
+    ctx->replay = r;
+    return 0;
+}
+
+/*
+ * decode the next tick into a snapshot owned by the replay, valid until
+ * the next call. returns 1 for a tick, 0 at the end of the recording.
+ */
+int replay_next(struct meminfo_ctx *ctx, struct meminfo **minfo)
+{
+    struct replay *r = ctx->replay;
+    const unsigned char *p;
+    uint32_t len;
+    time_t sec;
+    int ret;
+
+    if (r == NULL)
+        return ctx_error(ctx, MEMINFO_EINVAL, "no recording to replay");
+    if (r->p == r->end)
+        return 0;
+    p = r->p;
+    if (r->end - p < 4 || (len = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24) == 0
+            || len > (size_t)(r->end - p - 4))
+        return ctx_error(ctx, MEMINFO_EFORMAT, "recording cut off at offset %zu",
+                (size_t)(p - r->map));
+    if ((ret = replay_frame(r, p + 4, p + 4 + len)) < 0) {
+        if (ret == -2)
+            return ctx_error(ctx, MEMINFO_ENOMEM, "replay: out of memory");
+        return ctx_error(ctx, MEMINFO_EFORMAT, "bad frame at offset %zu",
+                (size_t)(p - r->map));
+    }
+    r->p = p + 4 + len;
+
+    memcpy(r->ptrs, r->live, r->nlive * sizeof(r->live[0]));
+    r->minfo.pss = r->ptrs;
+    r->minfo.num_procs = r->nlive;
+    r->minfo.kern_start.tv_sec = r->ts_ms / 1000;
+    r->minfo.kern_start.tv_nsec = r->ts_ms % 1000 * 1000000;
+    r->minfo.kern_end = r->minfo.proc_start = r->minfo.proc_end = r->minfo.kern_start;
+    sec = r->ts_ms / 1000;
+    localtime_r(&sec, &r->minfo.timestap);
+    *minfo = &r->minfo;
+    return 1;
+}
+
+void replay_close(struct meminfo_ctx *ctx)
+{
+    struct replay *r = ctx->replay;
+    int i;
+
+    if (r == NULL)
+        return;
+    for (i = 0; i < r->nlive; i++)
+        free(r->live[i]);
+    for (i = 0; i < r->npool; i++)
+        free(r->pool[i]);
+    free(r->live);
+    free(r->ptrs);
+    free(r->pool);
+    free(r->strs);
+    free(r->lens);
+    munmap((void *)r->map, r->len);
+    free(r);
+    ctx->replay = NULL;
+}
+
+/*
+ * tick n of a recording, counted from 0, or its last tick when n < 0,
+ * as a snapshot of its own to be freed with meminfo_free. NULL on error.
+ */
+struct meminfo *replay_load(struct meminfo_ctx *ctx, const char *path, long n)
+{
+    struct meminfo *cur, *minfo = NULL, *copy = NULL;
+    long i;
+    int ret;
+
+    if (replay_open(ctx, path) < 0)
+        return NULL;
+    for (i = 0; (ret = replay_next(ctx, &cur)) > 0; i++) {
+        minfo = cur;
+        if (i == n)
+            break;
+    }
+    if (ret == 0 && (minfo == NULL || n >= 0)) {
+        ctx_error(ctx, MEMINFO_EINVAL, "%s has %ld ticks, no tick %ld", path, i, n);
+        goto out;
+    }
+    if (ret < 0)
+        goto out;
+
+    if ((copy = calloc(1, sizeof(*copy))) == NULL)
+        goto nomem;
+    *copy = *minfo;
+    if ((copy->pss = calloc(minfo->num_procs + 1, sizeof(copy->pss[0]))) == NULL)
+        goto nomem;
+    for (i = 0; i < minfo->num_procs; i++) {
+        if ((copy->pss[i] = malloc(sizeof(struct proc_info))) == NULL)
+            goto nomem;
+        *copy->pss[i] = *minfo->pss[i];
+    }
+    goto out;
+
+nomem:
+    ctx_error(ctx, MEMINFO_ENOMEM, "malloc snapshot error");
+    meminfo_free(copy);
+    copy = NULL;
+out:
+    replay_close(ctx);
+    return copy;
+}
@@ -0,0 +1,49 @@
+#ifndef MEMINFO_RECORD_H
+#define MEMINFO_RECORD_H
+
+#include <stdint.h>
+
+#include "getpss.h"
+
+/*
+ * binary recording of snapshots, see record.c for the layout. the file
+ * starts with RECORD_MAGIC and the format version, then one frame per
+ * tick.
+ */
+#define RECORD_MAGIC "MIREC\0\0"
+#define RECORD_VERSION 2
+/* version 1 had the first six counters of stats_t, replay still reads it */
+#define RECORD_STATS_V1 6
+/* a frame that doesn't depend on the ones before it every this many ticks */
+#define RECORD_KEYFRAME 3600
+
+/* stats_t has this many counters */
+#define RECORD_STATS (sizeof(struct stats_t) / sizeof(uint64_t))
+/* values recorded per process: the stats of every heap, then the sums */
+#define RECORD_PROC_FIELDS (_NUM_HEAP * RECORD_STATS + 4)
+
+/* frame flags */
+#define RECORD_FRAME_KEY 1
+/* process flags */
+#define RECORD_PROC_NEW 1
+
+/* one process as the recorder last wrote it */
+struct record_proc {
+    int pid;
+    uint32_t str;           /* cmdline, string table index */
+    uint64_t starttime;
+    uint64_t v[RECORD_PROC_FIELDS];
+};
+
+struct meminfo_ctx;
+
+int record_open(struct meminfo_ctx *ctx, const char *path);
+int record_tick(struct meminfo_ctx *ctx, struct meminfo *minfo);
+void record_close(struct meminfo_ctx *ctx);
+int replay_open(struct meminfo_ctx *ctx, const char *path);
+int replay_next(struct meminfo_ctx *ctx, struct meminfo **minfo);
+void replay_close(struct meminfo_ctx *ctx);
+struct meminfo *replay_load(struct meminfo_ctx *ctx, const char *path, long n);
+void record_fields(const struct proc_info *proc, uint64_t *v);
+
+#endif
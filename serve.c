@@ -0,0 +1,626 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "serve.h"
+#include "context.h"
+#include "error.h"
+
+/*
+ * OpenMetrics over HTTP on a tcp or unix socket. the sampler renders
+ * every tick into a page and swaps it in under the lock; a scrape only
+ * takes a reference to the current page and writes it out, so it never
+ * collects anything and a slow scraper never holds up the sampler.
+ */
+
+/* a rendered tick, freed when the last reference goes */
+struct page {
+    char *buf;
+    size_t len;
+    int refs;       /* scrapes writing it out, plus one while current */
+};
+
+struct server {
+    int fd;
+    int wake[2];            /* serve_close stops the accept loop with it */
+    pthread_t tid;
+    pthread_mutex_t lock;
+    pthread_cond_t idle;    /* the last client is gone */
+    struct page *cur;       /* NULL before the first publish */
+    int clients;
+    int client_fd[SERVE_MAX_CLIENTS];   /* fd + 1, 0 is free; serve_close cuts them short */
+    char path[sizeof(((struct sockaddr_un *)0)->sun_path)];  /* unlinked on close */
+};
+
+struct client {
+    struct server *srv;
+    int fd;
+    int slot;               /* in srv->client_fd */
+};
+
+/* called with the lock held */
+static void page_put(struct page *pg)
+{
+    if (pg == NULL || --pg->refs > 0)
+        return;
+    free(pg->buf);
+    free(pg);
+}
+
+static void metric_family(struct out *o, const char *name, const char *type,
+        const char *unit, const char *help)
+{
+    out_str(o, "# TYPE ");
+    out_str(o, name);
+    out_char(o, ' ');
+    out_str(o, type);
+    if (unit != NULL) {
+        out_str(o, "\n# UNIT ");
+        out_str(o, name);
+        out_char(o, ' ');
+        out_str(o, unit);
+    }
+    out_str(o, "\n# HELP ");
+    out_str(o, name);
+    out_char(o, ' ');
+    out_str(o, help);
+    out_char(o, '\n');
+}
+
+/* a label value, quoted and escaped */
+static void label_str(struct out *o, const char *s)
+{
+    out_char(o, '"');
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\') {
+            out_char(o, '\\');
+            out_char(o, *s);
+        } else if (*s == '\n') {
+            out_mem(o, "\\n", 2);
+        } else {
+            out_char(o, *s);
+        }
+    }
+    out_char(o, '"');
+}
+
+static void label(struct out *o, const char *name, const char *value, int first)
+{
+    if (!first)
+        out_char(o, ',');
+    out_str(o, name);
+    out_char(o, '=');
+    label_str(o, value);
+}
+
+static void out_double(struct out *o, double v)
+{
+    char tmp[32];
+
+    snprintf(tmp, sizeof(tmp), "%.1f", v);
+    out_str(o, tmp);
+}
+
+/* a process of the snapshot with memory to its name */
+static int metric_proc_ok(struct proc_info *proc)
+{
+    return proc != NULL && proc->totalpss != 0;
+}
+
+/* which number of a verdict a pass over them writes */
+enum enum_verdict_metric {
+    VERDICT_RATE,
+    VERDICT_TTO,
+};
+
+struct verdict_pass {
+    struct out *o;
+    const char *name;
+    int which;
+};
+
+static void verdict_metric(void *arg, const struct leak_event *ev)
+{
+    struct verdict_pass *vp = arg;
+    struct out *o = vp->o;
+    char pid[16];
+    int n;
+
+    for (n = 0; n < _NUM_SERIES; n++) {
+        if (!(ev->leak & (1u << n)))
+            continue;
+        if (vp->which == VERDICT_TTO && ev->rate[n].tto < 0)
+            continue;
+        out_str(o, vp->name);
+        out_char(o, '{');
+        label(o, "process", ev->cmdline, 1);
+        if (!ev->group) {
+            snprintf(pid, sizeof(pid), "%d", ev->pid);
+            label(o, "pid", pid, 0);
+        }
+        label(o, "series", series_name(n), 0);
+        out_str(o, "} ");
+        if (vp->which == VERDICT_RATE)
+            out_double(o, ev->rate[n].rate * 1024 / 3600);
+        else
+            out_double(o, ev->rate[n].tto * 3600);
+        out_char(o, '\n');
+    }
+}
+
+/*
+ * a snapshot and the standing leak verdicts as OpenMetrics text. sizes
+ * are bytes, the kernel categories are the ones print_meminfo draws.
+ */
+void out_metrics(struct meminfo_ctx *ctx, struct out *o, struct meminfo *minfo)
+{
+    struct mem_part part[_NUM_PART];
+    struct verdict_pass vp;
+    struct proc_info *proc;
+    struct tm tm = minfo->timestap;
+    char pid[16];
+    int i, j;
+
+    metric_family(o, "meminfo_snapshot_timestamp_seconds", "gauge", "seconds",
+            "When the snapshot was taken.");
+    out_str(o, "meminfo_snapshot_timestamp_seconds ");
+    out_i64(o, mktime(&tm), 0);
+    out_char(o, '\n');
+
+    // a single process snapshot comes without the kernel's view
+    if (minfo->item[MEMINFO_TOTAL].num != 0) {
+        mem_breakdown(minfo->item, part);
+        metric_family(o, "meminfo_memory_total_bytes", "gauge", "bytes",
+                "Memory the kernel manages.");
+        out_str(o, "meminfo_memory_total_bytes ");
+        out_u64(o, minfo->item[MEMINFO_TOTAL].num * 1024, 0);
+        out_char(o, '\n');
+
+        metric_family(o, "meminfo_memory_bytes", "gauge", "bytes",
+                "Memory by use, the categories add up to the total.");
+        for (i = 0; i < _NUM_TOP_PART; i++) {
+            out_str(o, "meminfo_memory_bytes{");
+            label(o, "category", part[i].name, 1);
+            out_str(o, "} ");
+            out_i64(o, part[i].kb * 1024, 0);
+            out_char(o, '\n');
+        }
+
+        metric_family(o, "meminfo_kernel_bytes", "gauge", "bytes",
+                "Kernel memory by category, unknown is what nothing accounts for.");
+        for (i = _NUM_TOP_PART; i < _NUM_PART; i++) {
+            out_str(o, "meminfo_kernel_bytes{");
+            label(o, "category", part[i].name, 1);
+            out_str(o, "} ");
+            out_i64(o, part[i].kb * 1024, 0);
+            out_char(o, '\n');
+        }
+    }
+
+    if (minfo->codec.num_owners > 0) {
+        metric_family(o, "meminfo_codec_pool_bytes", "gauge", "bytes",
+                "Codec memory by pool.");
+        for (i = 0; i < CODEC_POOL_COUNT; i++) {
+            out_str(o, "meminfo_codec_pool_bytes{");
+            label(o, "pool", codec_pool_name(i), 1);
+            out_str(o, "} ");
+            out_u64(o, minfo->codec.pool[i], 0);
+            out_char(o, '\n');
+        }
+    }
+
+    metric_family(o, "meminfo_process_pss_bytes", "gauge", "bytes",
+            "Proportional set size of a process by heap.");
+    for (i = 0; i < minfo->num_procs; i++) {
+        if (!metric_proc_ok(proc = minfo->pss[i]))
+            continue;
+        snprintf(pid, sizeof(pid), "%d", proc->pid);
+        for (j = 0; j < _NUM_HEAP; j++) {
+            if (proc->stats[j].pss == 0)
+                continue;
+            out_str(o, "meminfo_process_pss_bytes{");
+            label(o, "pid", pid, 1);
+            label(o, "process", proc->cmdline, 0);
+            label(o, "heap", heap_name(j), 0);
+            out_str(o, "} ");
+            out_u64(o, proc->stats[j].pss * 1024, 0);
+            out_char(o, '\n');
+        }
+    }
+
+    // the verdicts: a series is there while the detector holds it leaking
+    vp.o = o;
+    vp.name = "meminfo_leak_rate_bytes_per_second";
+    vp.which = VERDICT_RATE;
+    metric_family(o, vp.name, "gauge", "bytes_per_second",
+            "Growth of a series the leak detector holds to be leaking.");
+    hash_verdicts(ctx, verdict_metric, &vp);
+
+    vp.name = "meminfo_leak_time_to_oom_seconds";
+    vp.which = VERDICT_TTO;
+    metric_family(o, vp.name, "gauge", "seconds",
+            "Time until a leaking series eats the free memory at its rate.");
+    hash_verdicts(ctx, verdict_metric, &vp);
+
+    out_str(o, "# EOF\n");
+}
+
+/* render minfo for the scrapes to come, replacing the last tick */
+int serve_publish(struct meminfo_ctx *ctx, struct meminfo *minfo)
+{
+    struct server *srv = ctx->srv;
+    struct page *pg, *old;
+    struct out o;
+
+    if (srv == NULL)
+        return ctx_error(ctx, MEMINFO_EINVAL, "not serving metrics");
+
+    // rendered outside the lock, the swap is all scrapes wait for
+    out_init(&o, -1, FORMAT_TEXT);
+    out_metrics(ctx, &o, minfo);
+    if (o.failed || (pg = malloc(sizeof(*pg))) == NULL) {
+        out_free(&o);
+        return ctx_error(ctx, MEMINFO_ENOMEM, "metrics: out of memory");
+    }
+    pg->buf = o.buf;
+    pg->len = o.len;
+    pg->refs = 1;
+
+    pthread_mutex_lock(&srv->lock);
+    old = srv->cur;
+    srv->cur = pg;
+    page_put(old);
+    pthread_mutex_unlock(&srv->lock);
+    return 0;
+}
+
+static int send_all(int fd, const char *buf, size_t len, int flags)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = send(fd, buf, len, flags | MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        buf += n;
+        len -= n;
+    }
+    return 0;
+}
+
+static void reply(int fd, const char *status, const char *type,
+        const char *body, size_t len, int head)
+{
+    char hdr[256];
+    int n;
+
+    n = snprintf(hdr, sizeof(hdr), "HTTP/1.1 %s\r\nContent-Type: %s\r\n"
+            "Content-Length: %zu\r\nConnection: close\r\n\r\n", status, type, len);
+    // one segment with the body, not a small one waiting for an ack
+    if (send_all(fd, hdr, n, head ? 0 : MSG_MORE) < 0 || head)
+        return;
+    send_all(fd, body, len, 0);
+}
+
+/*
+ * the request head, up to the blank line; the reply waits for all of it
+ * since closing on unread data would reset the connection.
+ */
+static int read_request(int fd, char *req, size_t size)
+{
+    size_t len = 0;
+    ssize_t n;
+
+    while (len < size - 1) {
+        n = recv(fd, req + len, size - 1 - len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        len += n;
+        req[len] = '\0';
+        if (strstr(req, "\r\n\r\n") != NULL || strstr(req, "\n\n") != NULL)
+            return 0;
+    }
+    return len > 0 ? 0 : -1;
+}
+
+static void *client_thread(void *arg)
+{
+    struct client *cl = arg;
+    struct server *srv = cl->srv;
+    struct page *pg = NULL;
+    char req[SERVE_REQUEST_MAX], *path, *end;
+    int head;
+
+    if (read_request(cl->fd, req, sizeof(req)) < 0)
+        goto out;
+
+    head = !strncmp(req, "HEAD ", 5);
+    if (strncmp(req, "GET ", 4) && !head) {
+        reply(cl->fd, "405 Method Not Allowed", "text/plain", "GET or HEAD\n", 11, 0);
+        goto out;
+    }
+    path = req + (head ? 5 : 4);
+    end = path + strcspn(path, " ?\r\n");
+    *end = '\0';
+    if (strcmp(path, "/metrics") && strcmp(path, "/")) {
+        reply(cl->fd, "404 Not Found", "text/plain", "try /metrics\n", 13, head);
+        goto out;
+    }
+
+    pthread_mutex_lock(&srv->lock);
+    if ((pg = srv->cur) != NULL)
+        pg->refs++;
+    pthread_mutex_unlock(&srv->lock);
+
+    if (pg == NULL)
+        reply(cl->fd, "503 Service Unavailable", "text/plain", "no snapshot yet\n", 16, head);
+    else
+        reply(cl->fd, "200 OK", SERVE_CONTENT_TYPE, pg->buf, pg->len, head);
+
+out:
+    shutdown(cl->fd, SHUT_WR);
+    pthread_mutex_lock(&srv->lock);
+    // out of the table before the fd number can be reused
+    srv->client_fd[cl->slot] = 0;
+    close(cl->fd);
+    page_put(pg);
+    if (--srv->clients == 0)
+        pthread_cond_broadcast(&srv->idle);
+    pthread_mutex_unlock(&srv->lock);
+    free(cl);
+    return NULL;
+}
+
+static void serve_client(struct server *srv, int fd)
+{
+    struct timeval tv = { SERVE_TIMEOUT, 0 };
+    struct client *cl;
+    pthread_attr_t attr;
+    pthread_t tid;
+    int ret = -1, slot;
+
+    pthread_mutex_lock(&srv->lock);
+    if (srv->clients >= SERVE_MAX_CLIENTS) {
+        pthread_mutex_unlock(&srv->lock);
+        close(fd);
+        return;
+    }
+    srv->clients++;
+    for (slot = 0; srv->client_fd[slot] != 0; slot++)
+        ;
+    srv->client_fd[slot] = fd + 1;
+    pthread_mutex_unlock(&srv->lock);
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    if ((cl = malloc(sizeof(*cl))) != NULL) {
+        cl->srv = srv;
+        cl->fd = fd;
+        cl->slot = slot;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        ret = pthread_create(&tid, &attr, client_thread, cl);
+        pthread_attr_destroy(&attr);
+    }
+    if (ret != 0) {
+        free(cl);
+        pthread_mutex_lock(&srv->lock);
+        srv->client_fd[slot] = 0;
+        close(fd);
+        if (--srv->clients == 0)
+            pthread_cond_broadcast(&srv->idle);
+        pthread_mutex_unlock(&srv->lock);
+    }
+}
+
+static void *serve_thread(void *arg)
+{
+    struct server *srv = arg;
+    struct pollfd pfd[2];
+    int fd;
+
+    pfd[0].fd = srv->fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = srv->wake[0];
+    pfd[1].events = POLLIN;
+
+    for (;;) {
+        if (poll(pfd, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        if (pfd[1].revents)
+            break;
+        if (!(pfd[0].revents & POLLIN))
+            continue;
+        if ((fd = accept(srv->fd, NULL, NULL)) < 0)
+            continue;
+        serve_client(srv, fd);
+    }
+    return NULL;
+}
+
+/*
+ * a listening socket for addr: a path starting with / or an abstract
+ * name starting with @ is a unix socket, anything else [host:]port,
+ * the host defaulting to the loopback.
+ */
+static int serve_listen(struct meminfo_ctx *ctx, struct server *srv, const char *addr)
+{
+    struct sockaddr_un sun;
+    struct addrinfo hints, *res, *ai;
+    struct stat st;
+    char host[256], *node, *port;
+    socklen_t len;
+    int fd = -1, on = 1, ret;
+
+    if (addr[0] == '/' || addr[0] == '@') {
+        memset(&sun, 0, sizeof(sun));
+        sun.sun_family = AF_UNIX;
+        if (strlen(addr) >= sizeof(sun.sun_path))
+            return ctx_error(ctx, MEMINFO_EINVAL, "socket path %s too long", addr);
+        strcpy(sun.sun_path, addr);
+        len = offsetof(struct sockaddr_un, sun_path) + strlen(addr);
+        if (addr[0] == '@') {
+            sun.sun_path[0] = '\0';
+        } else {
+            // a socket left behind by an earlier run
+            if (lstat(addr, &st) == 0 && S_ISSOCK(st.st_mode))
+                unlink(addr);
+            strcpy(srv->path, addr);
+        }
+        if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0
+                || bind(fd, (struct sockaddr *)&sun, len) < 0)
+            goto fail;
+    } else {
+        if (strlen(addr) >= sizeof(host))
+            return ctx_error(ctx, MEMINFO_EINVAL, "bad address %s", addr);
+        strcpy(host, addr);
+        node = "";
+        if ((port = strrchr(host, ':')) != NULL) {
+            *port++ = '\0';
+            node = host;
+        } else {
+            port = host;
+        }
+        // [::1]:9100
+        if (node[0] == '[' && node[strlen(node) - 1] == ']') {
+            node[strlen(node) - 1] = '\0';
+            node++;
+        }
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+        if ((ret = getaddrinfo(node[0] ? node : "127.0.0.1", port, &hints, &res)) != 0)
+            return ctx_error(ctx, MEMINFO_EINVAL, "bad address %s: %s", addr, gai_strerror(ret));
+        for (ai = res; ai != NULL; ai = ai->ai_next) {
+            if ((fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol)) < 0)
+                continue;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+                break;
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(res);
+        if (fd < 0)
+            goto fail;
+    }
+
+    if (listen(fd, SERVE_MAX_CLIENTS) < 0
+            || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0)
+        goto fail;
+    srv->fd = fd;
+    return 0;
+
+fail:
+    ret = errno;
+    if (fd >= 0)
+        close(fd);
+    srv->path[0] = '\0';
+    return ctx_error(ctx, MEMINFO_EIO, "listen on %s: %s", addr, strerror(ret));
+}
+
+int serve_open(struct meminfo_ctx *ctx, const char *addr)
+{
+    struct server *srv;
+    sigset_t all, old;
+    int ret;
+
+    if (ctx->srv != NULL)
+        return ctx_error(ctx, MEMINFO_EINVAL, "already serving metrics");
+    if ((srv = calloc(1, sizeof(*srv))) == NULL)
+        return ctx_error(ctx, MEMINFO_ENOMEM, "calloc server error");
+    if ((ret = serve_listen(ctx, srv, addr)) < 0) {
+        free(srv);
+        return ret;
+    }
+    if (pipe(srv->wake) < 0) {
+        ret = ctx_error(ctx, MEMINFO_EIO, "pipe: %s", strerror(errno));
+        goto fail;
+    }
+    pthread_mutex_init(&srv->lock, NULL);
+    pthread_cond_init(&srv->idle, NULL);
+
+    // signals stay with the caller's threads
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    ret = pthread_create(&srv->tid, NULL, serve_thread, srv);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (ret != 0) {
+        close(srv->wake[0]);
+        close(srv->wake[1]);
+        pthread_mutex_destroy(&srv->lock);
+        pthread_cond_destroy(&srv->idle);
+        ret = ctx_error(ctx, MEMINFO_ENOMEM, "pthread_create: %s", strerror(ret));
+        goto fail;
+    }
+    ctx->srv = srv;
+    return 0;
+
+fail:
+    close(srv->fd);
+    if (srv->path[0] != '\0')
+        unlink(srv->path);
+    free(srv);
+    return ret;
+}
+
+/*
+ * stop accepting, cut the scrapes in flight short and wait for them to
+ * go, then drop the socket. not for a signal handler, it takes the lock.
+ */
+void serve_close(struct meminfo_ctx *ctx)
+{
+    struct server *srv = ctx->srv;
+    int i;
+
+    if (srv == NULL)
+        return;
+    if (write(srv->wake[1], "", 1) < 0)
+        err_msg("can't stop the metrics server\n");
+    pthread_join(srv->tid, NULL);
+    close(srv->fd);
+    close(srv->wake[0]);
+    close(srv->wake[1]);
+
+    pthread_mutex_lock(&srv->lock);
+    // a slow scraper would otherwise hold the exit up to SERVE_TIMEOUT
+    for (i = 0; i < SERVE_MAX_CLIENTS; i++)
+        if (srv->client_fd[i] != 0)
+            shutdown(srv->client_fd[i] - 1, SHUT_RDWR);
+    while (srv->clients > 0)
+        pthread_cond_wait(&srv->idle, &srv->lock);
+    page_put(srv->cur);
+    pthread_mutex_unlock(&srv->lock);
+
+    if (srv->path[0] != '\0')
+        unlink(srv->path);
+    pthread_mutex_destroy(&srv->lock);
+    pthread_cond_destroy(&srv->idle);
+    free(srv);
+    ctx->srv = NULL;
+}
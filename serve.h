@@ -0,0 +1,22 @@
+#ifndef MEMINFO_SERVE_H
+#define MEMINFO_SERVE_H
+
+#include "getpss.h"
+
+/* scrapes served at the same time, more are turned away */
+#define SERVE_MAX_CLIENTS 8
+/* seconds a scraper gets to send its request and to take the reply */
+#define SERVE_TIMEOUT 5
+/* longest request head read, a longer one is answered as is */
+#define SERVE_REQUEST_MAX 4096
+#define SERVE_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+struct meminfo_ctx;
+struct out;
+
+int serve_open(struct meminfo_ctx *ctx, const char *addr);
+int serve_publish(struct meminfo_ctx *ctx, struct meminfo *minfo);
+void serve_close(struct meminfo_ctx *ctx);
+void out_metrics(struct meminfo_ctx *ctx, struct out *o, struct meminfo *minfo);
+
+#endif
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "sketch.h"
+
+void sketch_add(struct sketch *s, double v)
+{
+    int i, k;
+    double gap, best = 0;
+
+    if (s->n == 0 || v < s->min)
+        s->min = v;
+    if (s->n == 0 || v > s->max)
+        s->max = v;
+    s->n++;
+
+    for (i = 0; i < (int)s->len && s->mean[i] < (float)v; i++)
+        ;
+    if (i < (int)s->len && s->mean[i] == (float)v) {
+        s->weight[i]++;
+        return;
+    }
+
+    memmove(&s->mean[i + 1], &s->mean[i], (s->len - i) * sizeof(float));
+    memmove(&s->weight[i + 1], &s->weight[i], (s->len - i) * sizeof(uint32_t));
+    s->mean[i] = v;
+    s->weight[i] = 1;
+    if (++s->len <= SKETCH_CENTROIDS)
+        return;
+
+    // over by one, merge the closest pair
+    for (i = 0, k = 0; i + 1 < (int)s->len; i++) {
+        gap = s->mean[i + 1] - s->mean[i];
+        if (i == 0 || gap < best) {
+            k = i;
+            best = gap;
+        }
+    }
+    s->mean[k] = ((double)s->mean[k] * s->weight[k] + (double)s->mean[k + 1] * s->weight[k + 1])
+        / (s->weight[k] + s->weight[k + 1]);
+    s->weight[k] += s->weight[k + 1];
+    s->len--;
+    memmove(&s->mean[k + 1], &s->mean[k + 2], (s->len - k - 1) * sizeof(float));
+    memmove(&s->weight[k + 1], &s->weight[k + 2], (s->len - k - 1) * sizeof(uint32_t));
+}
+
+void qwindow_add(struct qwindow *w, int64_t span, int64_t ts, double v)
+{
+    int64_t id = ts / (span / QWIN_BUCKETS);
+    int k = id % QWIN_BUCKETS;
+
+    if (w->id[k] != id) {
+        memset(&w->b[k], 0, sizeof(w->b[k]));
+        w->id[k] = id;
+    }
+    sketch_add(&w->b[k], v);
+}
+
+struct centroid {
+    float mean;
+    uint32_t weight;
+};
+
+static int cmpcentroid(const void *a, const void *b)
+{
+    float x = ((const struct centroid *)a)->mean;
+    float y = ((const struct centroid *)b)->mean;
+    return (x > y) - (x < y);
+}
+
+/*
+ * value at rank q * n. a centroid's weight is spread around its mean,
+ * so ranks are interpolated between centroid centres, and towards
+ * min and max at the ends.
+ */
+static double centroid_rank(const struct centroid *c, int len, uint32_t n,
+        double min, double max, double q)
+{
+    double target = q * n, lo, hi = c[0].weight / 2.0;
+    int i;
+
+    if (target <= hi)
+        return min + (c[0].mean - min) * target / hi;
+
+    for (i = 0; i + 1 < len; i++) {
+        lo = hi;
+        hi = lo + (c[i].weight + c[i + 1].weight) / 2.0;
+        if (target <= hi)
+            return c[i].mean + (c[i + 1].mean - c[i].mean) * (target - lo) / (hi - lo);
+    }
+    if (n <= hi)
+        return max;
+    return c[len - 1].mean + (max - c[len - 1].mean) * (target - hi) / (n - hi);
+}
+
+/* merge the buckets still inside the window ending at now */
+void qwindow_query(const struct qwindow *w, int64_t span, int64_t now,
+        struct quantiles *q)
+{
+    struct centroid c[QWIN_BUCKETS * SKETCH_CENTROIDS];
+    int64_t id = now / (span / QWIN_BUCKETS);
+    double min = 0, max = 0;
+    int i, j, len = 0;
+
+    memset(q, 0, sizeof(*q));
+    for (i = 0; i < QWIN_BUCKETS; i++) {
+        const struct sketch *s = &w->b[i];
+        if (s->n == 0 || w->id[i] <= id - QWIN_BUCKETS || w->id[i] > id)
+            continue;
+        if (q->n == 0 || s->min < min)
+            min = s->min;
+        if (q->n == 0 || s->max > max)
+            max = s->max;
+        q->n += s->n;
+        for (j = 0; j < (int)s->len; j++) {
+            c[len].mean = s->mean[j];
+            c[len].weight = s->weight[j];
+            len++;
+        }
+    }
+    if (q->n == 0)
+        return;
+
+    qsort(c, len, sizeof(c[0]), cmpcentroid);
+    q->p50 = centroid_rank(c, len, q->n, min, max, 0.50);
+    q->p95 = centroid_rank(c, len, q->n, min, max, 0.95);
+    q->max = max;
+}
@@ -0,0 +1,49 @@
+#ifndef MEMINFO_SKETCH_H
+#define MEMINFO_SKETCH_H
+
+#include <stdint.h>
+
+/* centroids per sketch, more is more accurate and more memory */
+#define SKETCH_CENTROIDS 12
+/* buckets a window slides by */
+#define QWIN_BUCKETS 12
+/* window lengths, ms */
+#define QWIN_HOUR (60 * 60 * 1000)
+#define QWIN_DAY (24 * 60 * 60 * 1000)
+
+/*
+ * streaming histogram in the style of Ben-Haim and Tom-Tov: at most
+ * SKETCH_CENTROIDS (mean, weight) pairs sorted by mean, the two closest
+ * merged when a new value doesn't fit. values are kB. one slot spare for
+ * the value being added.
+ */
+struct sketch {
+    float mean[SKETCH_CENTROIDS + 1];
+    uint32_t weight[SKETCH_CENTROIDS + 1];
+    uint32_t len;
+    uint32_t n;
+    float min, max;
+};
+
+/*
+ * a sketch per 1/QWIN_BUCKETS of the window, so the window slides by
+ * dropping whole buckets. fixed size and no pointers, it can live in
+ * the leak state arena.
+ */
+struct qwindow {
+    int64_t id[QWIN_BUCKETS];   /* bucket number, ts / bucket length */
+    struct sketch b[QWIN_BUCKETS];
+};
+
+/* quantiles pulled from a window */
+struct quantiles {
+    uint32_t n;
+    double p50, p95, max;
+};
+
+void sketch_add(struct sketch *s, double v);
+void qwindow_add(struct qwindow *w, int64_t span, int64_t ts, double v);
+void qwindow_query(const struct qwindow *w, int64_t span, int64_t now,
+        struct quantiles *q);
+
+#endif
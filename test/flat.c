@@ -0,0 +1,94 @@
+/*
+ * flat noise must give no leak verdict, for make check: 20 long running
+ * processes and 20 app slots whose occupant gives way to a new cmdline
+ * every 10 to 30 minutes, each around a fixed pss with 2 MB of noise,
+ * one tick a minute for two days.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libmeminfo.h"
+#include "context.h"
+
+#define DAEMONS 20
+#define SLOTS 20
+#define TICKS (2 * 24 * 60)
+
+static unsigned long verdicts;
+
+static void count_verdict(void *arg, const struct leak_event *ev)
+{
+    (void)arg;
+    if (ev->restart)
+        return;
+    printf("flat: verdict on %s (%d), %u samples over %.1f h\n",
+            ev->cmdline, ev->pid, ev->samples, ev->hours);
+    verdicts++;
+}
+
+static int insert(struct meminfo_ctx *ctx, int pid, const char *cmdline, uint64_t pss, int64_t ts)
+{
+    struct proc_info p;
+    int i;
+
+    memset(&p, 0, sizeof(p));
+    p.pid = pid;
+    p.starttime = 1;
+    snprintf(p.cmdline, sizeof(p.cmdline), "%s", cmdline);
+    for (i = 0; i < _NUM_HEAP; i++)
+        p.stats[i].pss = pss / _NUM_HEAP;
+    p.totalpss = p.stats[0].pss * _NUM_HEAP;
+    return hash_insert_item(ctx, &p, ts);
+}
+
+int main(void)
+{
+    struct meminfo_ctx *ctx = meminfo_ctx_new();
+    int app[SLOTS], until[SLOTS], apps = 0, t, i, ret = 0;
+    char cmdline[64];
+    int64_t ts;
+
+    if (ctx == NULL)
+        return 1;
+    hash_set_mode(ctx, TRACK_LEAK);
+    hash_set_report(ctx, count_verdict, NULL);
+
+    srand(11);
+    for (i = 0; i < SLOTS; i++) {
+        app[i] = apps++;
+        until[i] = 10 + rand() % 21;
+    }
+    for (t = 0; t < TICKS; t++) {
+        ts = 1000000 + t * 60000LL;
+        // pids no data root has, an instance without a sample is gone
+        for (i = 0; i < DAEMONS; i++) {
+            snprintf(cmdline, sizeof(cmdline), "/system/bin/daemon%d", i);
+            if (insert(ctx, 1000000 + i, cmdline, 20000 + rand() % 2000, ts) < 0)
+                goto fail;
+        }
+        for (i = 0; i < SLOTS; i++) {
+            if (--until[i] == 0) {
+                app[i] = apps++;
+                until[i] = 10 + rand() % 21;
+            }
+            snprintf(cmdline, sizeof(cmdline), "com.example.app%d", app[i]);
+            if (insert(ctx, 2000000 + app[i], cmdline, 40000 + rand() % 2000, ts) < 0)
+                goto fail;
+        }
+        detect_leak(ctx);
+    }
+
+    printf("flat: %d ticks, %d cmdlines, %lu verdicts\n", TICKS, DAEMONS + apps, verdicts);
+    if (verdicts > 0) {
+        fprintf(stderr, "flat: FAIL\n");
+        ret = 1;
+    }
+    meminfo_ctx_free(ctx);
+    return ret;
+
+fail:
+    fprintf(stderr, "flat: %s\n", meminfo_last_error(ctx));
+    meminfo_ctx_free(ctx);
+    return 1;
+}
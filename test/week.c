@@ -0,0 +1,158 @@
+/*
+ * a week of process churn under a memory budget, for make check: 40
+ * daemons, the first four leaking 60 kB a minute, and 60 app slots whose
+ * occupant gives way to a new cmdline every 10 to 30 minutes, one tick a
+ * minute. fails when the peak rss goes over the budget, nothing had to
+ * be evicted to stay under it, or the verdicts aren't on the leakers
+ * and all of them.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "libmeminfo.h"
+#include "context.h"
+
+#define DAEMONS 40
+#define LEAKERS 4
+#define SLOTS 60
+#define TICKS (7 * 24 * 60)
+/* kB a minute, 3600 kB/h against the 2048 kB/h default threshold */
+#define LEAK_PER_TICK 60
+
+static unsigned long verdicts, wrong;
+static int leakers_found;
+
+static void count_verdict(void *arg, const struct leak_event *ev)
+{
+    int i;
+
+    (void)arg;
+    if (ev->restart)
+        return;
+    verdicts++;
+    if (sscanf(ev->cmdline, "/system/bin/daemon%d", &i) == 1 && i < LEAKERS) {
+        leakers_found |= 1 << i;
+        return;
+    }
+    if (wrong++ == 0)
+        printf("week: verdict on %s (%d), %u samples over %.1f h\n",
+                ev->cmdline, ev->pid, ev->samples, ev->hours);
+}
+
+/* resident set of this process now, from /proc/self/statm */
+static long rss(void)
+{
+    long size, resident = -1;
+    FILE *fp = fopen("/proc/self/statm", "r");
+
+    if (fp == NULL)
+        return -1;
+    if (fscanf(fp, "%ld %ld", &size, &resident) != 2)
+        resident = -1;
+    fclose(fp);
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/*
+ * peak resident set of this process, VmHWM; ru_maxrss may predate the
+ * exec. the kernel only updates it now and then, the samples taken
+ * along the way may be higher.
+ */
+static long peak_rss(long sampled)
+{
+    char line[128];
+    long kb = -1;
+    FILE *fp = fopen("/proc/self/status", "r");
+
+    if (fp == NULL)
+        return -1;
+    while (fgets(line, sizeof(line), fp) != NULL)
+        if (sscanf(line, "VmHWM: %ld", &kb) == 1)
+            break;
+    fclose(fp);
+    return kb > sampled ? kb : sampled;
+}
+
+static int insert(struct meminfo_ctx *ctx, int pid, const char *cmdline, uint64_t pss, int64_t ts)
+{
+    struct proc_info p;
+    int i;
+
+    memset(&p, 0, sizeof(p));
+    p.pid = pid;
+    p.starttime = 1;
+    snprintf(p.cmdline, sizeof(p.cmdline), "%s", cmdline);
+    for (i = 0; i < _NUM_HEAP; i++)
+        p.stats[i].pss = pss / _NUM_HEAP;
+    p.totalpss = p.stats[0].pss * _NUM_HEAP;
+    return hash_insert_item(ctx, &p, ts);
+}
+
+int main(int argc, char **argv)
+{
+    struct meminfo_ctx *ctx = meminfo_ctx_new();
+    unsigned long budget = argc > 1 ? strtoul(argv[1], NULL, 10) : 8192;
+    int app[SLOTS], until[SLOTS], apps = 0, t, i, ret = 0;
+    char cmdline[64];
+    long peak = 0, now;
+    int64_t ts;
+
+    if (ctx == NULL)
+        return 1;
+    hash_set_mode(ctx, TRACK_LEAK);
+    hash_set_report(ctx, count_verdict, NULL);
+    if (hash_set_budget(ctx, budget) < 0) {
+        fprintf(stderr, "week: budget %lu kB too small\n", budget);
+        meminfo_ctx_free(ctx);
+        return 1;
+    }
+
+    srand(7);
+    for (i = 0; i < SLOTS; i++) {
+        app[i] = apps++;
+        until[i] = 10 + rand() % 21;
+    }
+    for (t = 0; t < TICKS; t++) {
+        ts = 1000000 + t * 60000LL;
+        // pids no data root has, an instance without a sample is gone
+        for (i = 0; i < DAEMONS; i++) {
+            snprintf(cmdline, sizeof(cmdline), "/system/bin/daemon%d", i);
+            if (insert(ctx, 1000000 + i, cmdline,
+                    20000 + rand() % 200 + (i < LEAKERS ? t * LEAK_PER_TICK : 0), ts) == MEMINFO_ENOMEM)
+                goto fail;
+        }
+        for (i = 0; i < SLOTS; i++) {
+            if (--until[i] == 0) {
+                app[i] = apps++;
+                until[i] = 10 + rand() % 21;
+            }
+            snprintf(cmdline, sizeof(cmdline), "com.example.app%d", app[i]);
+            if (insert(ctx, 2000000 + app[i], cmdline, 40000 + rand() % 2000, ts) == MEMINFO_ENOMEM)
+                goto fail;
+        }
+        // the tick's peak, before detect_leak retires what didn't show up
+        if ((now = rss()) > peak)
+            peak = now;
+        detect_leak(ctx);
+    }
+
+    peak = peak_rss(peak);
+    printf("week: %d ticks, %d cmdlines, %lu verdicts, %lu not on a leaker, %" PRIu64
+            " evicted, %" PRIu64 " refused, peak rss %ld kB of %lu kB\n", TICKS, DAEMONS + apps,
+            verdicts, wrong, ctx->tr.evicted, ctx->tr.refused, peak, budget);
+    if (peak < 0 || (unsigned long)peak > budget || ctx->tr.evicted == 0
+            || wrong > 0 || leakers_found != (1 << LEAKERS) - 1) {
+        fprintf(stderr, "week: FAIL\n");
+        ret = 1;
+    }
+    meminfo_ctx_free(ctx);
+    return ret;
+
+fail:
+    fprintf(stderr, "week: %s\n", meminfo_last_error(ctx));
+    meminfo_ctx_free(ctx);
+    return 1;
+}